@@ -21,7 +21,9 @@ e2fsck_src_files :=  \
 	unix.c \
 	dirinfo.c \
 	dx_dirinfo.c \
+	checkpoint.c \
 	ehandler.c \
+	incremental.c \
 	problem.c \
 	message.c \
 	ea_refcount.c \
@@ -0,0 +1,925 @@
+/*
+ * checkpoint.c --- save and restore the results of pass 1
+ *
+ * On large filesystems nearly all of e2fsck's run time is spent in
+ * pass 1, and everything is lost if the check is interrupted.  When
+ * e2fsck is run with "-E checkpoint=<file>", the state built up by
+ * pass 1 (the inode and block maps, the link counts, the directory
+ * information and the directory block list) is written to <file> as
+ * soon as the pass finishes.  Running e2fsck again with
+ * "-E checkpoint=<file>,resume" reloads that state and continues with
+ * the following pass, provided the superblock is still exactly the one
+ * the interrupted run left behind.
+ *
+ * Before the checkpoint is written, the filesystem is flushed with the
+ * superblock marked as not clean, so that an interrupted check can not
+ * leave behind a filesystem which claims to be valid.  The later passes
+ * write inodes and directory blocks without touching the superblock,
+ * so in read-write mode the checkpoint is removed before the first
+ * write made after it was taken.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "e2fsck.h"
+
+#define E2FSCK_CKPT_MAGIC	0x45324350	/* "E2CP" */
+#define E2FSCK_CKPT_VERSION	1
+
+/* Number of entries in e2fsck_passes[] covered by a checkpoint */
+#define E2FSCK_CKPT_PASSES	1
+
+/* Options which must be the same when resuming */
+#define E2FSCK_CKPT_OPTIONS	(E2F_OPT_READONLY | E2F_OPT_PREEN | \
+				 E2F_OPT_YES | E2F_OPT_NO | \
+				 E2F_OPT_COMPRESS_DIRS | E2F_OPT_CONVERT_BMAP)
+
+/* Context flags carried over from pass 1 */
+#define E2FSCK_CKPT_FLAGS	(E2F_FLAG_ALLOC_OK | E2F_FLAG_RESTART_LATER | \
+				 E2F_FLAG_JOURNAL_INODE | \
+				 E2F_FLAG_PROBLEMS_FIXED)
+
+/* Filesystem flags carried over from pass 1 */
+#define E2FSCK_CKPT_FS_FLAGS	(EXT2_FLAG_VALID | EXT2_FLAG_CHANGED | \
+				 EXT2_FLAG_MASTER_SB_ONLY)
+
+struct ckpt_header {
+	__u32	magic;
+	__u32	version;
+	__u32	passes_done;
+	__u32	sb_fingerprint;
+	__u32	options;
+	__u32	flags;
+	__u32	fs_flags;
+	__u32	group_desc_count;
+	__u64	blocks_count;
+	__u32	inodes_count;
+	__u32	invalid_bitmaps;
+	__u8	uuid[16];
+	__u64	root_repair_block;
+	__u64	lnf_repair_block;
+};
+
+struct ckpt_stats {
+	__u32	fs_directory_count;
+	__u32	fs_regular_count;
+	__u32	fs_blockdev_count;
+	__u32	fs_chardev_count;
+	__u32	fs_links_count;
+	__u32	fs_symlinks_count;
+	__u32	fs_fast_symlinks_count;
+	__u32	fs_fifo_count;
+	__u32	fs_total_count;
+	__u32	fs_badblocks_count;
+	__u32	fs_sockets_count;
+	__u32	fs_ind_count;
+	__u32	fs_dind_count;
+	__u32	fs_tind_count;
+	__u32	fs_fragmented;
+	__u32	fs_fragmented_dir;
+	__u32	large_files;
+	__u32	fs_ext_attr_inodes;
+	__u32	fs_ext_attr_blocks;
+	__u32	extent_depth_count[MAX_EXTENT_DEPTH_COUNT];
+};
+
+enum ckpt_tag {
+	CKPT_BITMAP = 1,
+	CKPT_ICOUNT,
+	CKPT_DIRINFO,
+	CKPT_DX_DIRINFO,
+	CKPT_DBLIST,
+	CKPT_U32_LIST,
+	CKPT_INVALID,
+	CKPT_END
+};
+
+struct ckpt_section {
+	__u32	tag;
+	__u32	id;
+	__u64	count;
+};
+
+struct ckpt_run {
+	__u64	start;
+	__u64	len;
+};
+
+struct ckpt_icount {
+	__u32	ino;
+	__u32	count;
+};
+
+struct ckpt_dx_dir {
+	__u32	ino;
+	__u32	numblocks;
+	__u32	hashversion;
+	__u32	depth;
+};
+
+#define CKPT_INODE_MAP		0
+#define CKPT_BLOCK_MAP		1
+#define CKPT_SUBCLUSTER_MAP	2
+
+static struct ckpt_bitmap {
+	size_t		offset;
+	int		kind;
+	int		type;
+	const char	*descr;
+	const char	*name;
+} ckpt_bitmaps[] = {
+	{ offsetof(struct e2fsck_struct, inode_used_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("in-use inode map"), "inode_used_map" },
+	{ offsetof(struct e2fsck_struct, inode_bad_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("bad inode map"), "inode_bad_map" },
+	{ offsetof(struct e2fsck_struct, inode_dir_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_AUTODIR, N_("directory inode map"), "inode_dir_map" },
+	{ offsetof(struct e2fsck_struct, inode_bb_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("inode in bad block map"),
+	  "inode_bb_map" },
+	{ offsetof(struct e2fsck_struct, inode_imagic_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("imagic inode map"), "inode_imagic_map" },
+	{ offsetof(struct e2fsck_struct, inode_reg_map), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("regular file inode map"),
+	  "inode_reg_map" },
+	{ offsetof(struct e2fsck_struct, inodes_to_rebuild), CKPT_INODE_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("extent rebuild inode map"),
+	  "inodes_to_rebuild" },
+	{ offsetof(struct e2fsck_struct, block_found_map), CKPT_SUBCLUSTER_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("in-use block map"), "block_found_map" },
+	{ offsetof(struct e2fsck_struct, block_dup_map), CKPT_BLOCK_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("multiply claimed block map"),
+	  "block_dup_map" },
+	{ offsetof(struct e2fsck_struct, block_metadata_map), CKPT_BLOCK_MAP,
+	  EXT2FS_BMAP64_RBTREE, N_("metadata block map"),
+	  "block_metadata_map" },
+};
+
+#define CKPT_NUM_BITMAPS (sizeof(ckpt_bitmaps) / sizeof(ckpt_bitmaps[0]))
+
+struct ckpt_file {
+	FILE		*f;
+	__u32		crc;
+	off_t		section_pos;
+	__u64		section_count;
+	errcode_t	err;
+};
+
+/*
+ * The fingerprint covers the whole superblock except its checksum, so
+ * that any change made to the filesystem by a mount or by another tool
+ * since the checkpoint was taken invalidates it.
+ */
+__u32 e2fsck_sb_fingerprint(ext2_filsys fs)
+{
+	return ext2fs_crc32c_le(~0, (unsigned char const *) fs->super,
+				offsetof(struct ext2_super_block, s_checksum));
+}
+
+/*
+ * In read-write mode the filesystem's io manager is wrapped once the
+ * checkpoint matches the disk, so that the first write removes the
+ * checkpoint before anything changes under it.
+ */
+static struct struct_io_manager	ckpt_io_manager;
+static io_manager		ckpt_orig_manager;
+static char			*ckpt_stale_file;
+
+static errcode_t ckpt_invalidate(io_channel channel)
+{
+	errcode_t	retval = 0;
+	char		*dir, *cp;
+	int		fd;
+
+	if (channel->manager == &ckpt_io_manager)
+		channel->manager = ckpt_orig_manager;
+	if (!ckpt_stale_file)
+		return 0;
+
+	if (unlink(ckpt_stale_file) && errno != ENOENT)
+		retval = errno;
+	else if ((dir = strdup(ckpt_stale_file)) != NULL) {
+		/* Make sure the unlink reaches the disk before the write */
+		cp = strrchr(dir, '/');
+		if (cp)
+			*(cp == dir ? cp + 1 : cp) = 0;
+		else
+			strcpy(dir, ".");
+		fd = open(dir, O_RDONLY);
+		if (fd >= 0) {
+			(void) fsync(fd);
+			close(fd);
+		}
+		free(dir);
+	}
+	if (retval)
+		com_err("e2fsck", retval, _("while removing checkpoint %s"),
+			ckpt_stale_file);
+	free(ckpt_stale_file);
+	ckpt_stale_file = 0;
+	return retval;
+}
+
+static errcode_t ckpt_write_blk(io_channel channel, unsigned long block,
+				int count, const void *data)
+{
+	errcode_t	retval = ckpt_invalidate(channel);
+
+	if (retval)
+		return retval;
+	return io_channel_write_blk(channel, block, count, data);
+}
+
+static errcode_t ckpt_write_blk64(io_channel channel, unsigned long long block,
+				  int count, const void *data)
+{
+	errcode_t	retval = ckpt_invalidate(channel);
+
+	if (retval)
+		return retval;
+	return io_channel_write_blk64(channel, block, count, data);
+}
+
+static errcode_t ckpt_write_byte(io_channel channel, unsigned long offset,
+				 int count, const void *data)
+{
+	errcode_t	retval = ckpt_invalidate(channel);
+
+	if (retval)
+		return retval;
+	return io_channel_write_byte(channel, offset, count, data);
+}
+
+static errcode_t ckpt_discard(io_channel channel, unsigned long long block,
+			      unsigned long long count)
+{
+	errcode_t	retval = ckpt_invalidate(channel);
+
+	if (retval)
+		return retval;
+	return io_channel_discard(channel, block, count);
+}
+
+static errcode_t ckpt_zeroout(io_channel channel, unsigned long long block,
+			      unsigned long long count)
+{
+	errcode_t	retval = ckpt_invalidate(channel);
+
+	if (retval)
+		return retval;
+	return io_channel_zeroout(channel, block, count);
+}
+
+static void ckpt_watch_writes(e2fsck_t ctx)
+{
+	io_channel	channel = ctx->fs->io;
+
+	if (ctx->options & E2F_OPT_READONLY)
+		return;
+	if (channel->manager == &ckpt_io_manager)
+		channel->manager = ckpt_orig_manager;
+	free(ckpt_stale_file);
+	ckpt_stale_file = strdup(ctx->checkpoint_file);
+	if (!ckpt_stale_file) {
+		/* Without a name to remove, don't leave it behind */
+		(void) unlink(ctx->checkpoint_file);
+		return;
+	}
+
+	ckpt_orig_manager = channel->manager;
+	ckpt_io_manager = *ckpt_orig_manager;
+	ckpt_io_manager.write_blk = ckpt_write_blk;
+	if (ckpt_orig_manager->write_blk64)
+		ckpt_io_manager.write_blk64 = ckpt_write_blk64;
+	if (ckpt_orig_manager->write_byte)
+		ckpt_io_manager.write_byte = ckpt_write_byte;
+	if (ckpt_orig_manager->discard)
+		ckpt_io_manager.discard = ckpt_discard;
+	if (ckpt_orig_manager->zeroout)
+		ckpt_io_manager.zeroout = ckpt_zeroout;
+	channel->manager = &ckpt_io_manager;
+}
+
+static void ckpt_write(struct ckpt_file *cf, const void *buf, size_t size)
+{
+	if (cf->err)
+		return;
+	if (fwrite(buf, size, 1, cf->f) != 1) {
+		cf->err = errno ? errno : EIO;
+		return;
+	}
+	cf->crc = ext2fs_crc32c_le(cf->crc, buf, size);
+}
+
+static void ckpt_read(struct ckpt_file *cf, void *buf, size_t size)
+{
+	if (cf->err)
+		return;
+	if (fread(buf, size, 1, cf->f) != 1) {
+		cf->err = EXT2_ET_SHORT_READ;
+		memset(buf, 0, size);
+		return;
+	}
+	cf->crc = ext2fs_crc32c_le(cf->crc, buf, size);
+}
+
+/*
+ * Sections are written with a placeholder record count which is
+ * filled in once all of the records have been written.  The checksum
+ * is only updated with the final section header.
+ */
+static void ckpt_begin_section(struct ckpt_file *cf)
+{
+	struct ckpt_section	sec;
+
+	if (cf->err)
+		return;
+	cf->section_pos = ftello(cf->f);
+	cf->section_count = 0;
+	memset(&sec, 0, sizeof(sec));
+	if (fwrite(&sec, sizeof(sec), 1, cf->f) != 1)
+		cf->err = errno ? errno : EIO;
+}
+
+static void ckpt_end_section(struct ckpt_file *cf, __u32 tag, __u32 id)
+{
+	struct ckpt_section	sec;
+	off_t			end;
+
+	if (cf->err)
+		return;
+	sec.tag = tag;
+	sec.id = id;
+	sec.count = cf->section_count;
+	end = ftello(cf->f);
+	if (fseeko(cf->f, cf->section_pos, SEEK_SET) ||
+	    fwrite(&sec, sizeof(sec), 1, cf->f) != 1 ||
+	    fseeko(cf->f, end, SEEK_SET)) {
+		cf->err = errno ? errno : EIO;
+		return;
+	}
+	cf->crc = ext2fs_crc32c_le(cf->crc, (unsigned char *) &sec,
+				   sizeof(sec));
+}
+
+static void ckpt_write_record(struct ckpt_file *cf, const void *buf,
+			      size_t size)
+{
+	ckpt_write(cf, buf, size);
+	cf->section_count++;
+}
+
+static void write_bitmap(struct ckpt_file *cf, ext2fs_generic_bitmap map)
+{
+	struct ckpt_run	run;
+	__u64		pos, last, first_set, first_zero;
+	int		bits;
+
+	bits = ext2fs_get_bitmap_granularity(map);
+	pos = ext2fs_get_generic_bmap_start(map) << bits;
+	last = ((ext2fs_get_generic_bmap_end(map) + 1) << bits) - 1;
+
+	while (pos <= last && !cf->err) {
+		if (ext2fs_find_first_set_generic_bmap(map, pos, last,
+						       &first_set))
+			break;
+		if (ext2fs_find_first_zero_generic_bmap(map, first_set, last,
+							&first_zero))
+			first_zero = last + 1;
+		run.start = first_set;
+		run.len = first_zero - first_set;
+		ckpt_write_record(cf, &run, sizeof(run));
+		pos = first_zero;
+	}
+}
+
+static void write_icount(struct ckpt_file *cf, e2fsck_t ctx,
+			 ext2_icount_t icount)
+{
+	struct ckpt_icount	rec;
+	ext2_ino_t		ino = 0, last = ctx->fs->super->s_inodes_count;
+	__u16			count;
+
+	while (!cf->err && ino < last) {
+		if (ext2fs_find_first_set_inode_bitmap2(ctx->inode_used_map,
+							ino + 1, last, &ino))
+			break;
+		if (ext2fs_icount_fetch(icount, ino, &count) || !count)
+			continue;
+		rec.ino = ino;
+		rec.count = count;
+		ckpt_write_record(cf, &rec, sizeof(rec));
+	}
+}
+
+static int write_dblist_proc(ext2_filsys fs EXT2FS_ATTR((unused)),
+			     struct ext2_db_entry2 *db, void *priv_data)
+{
+	struct ckpt_file *cf = (struct ckpt_file *) priv_data;
+
+	ckpt_write_record(cf, db, sizeof(*db));
+	return cf->err ? DBLIST_ABORT : 0;
+}
+
+static void write_u32_list(struct ckpt_file *cf, ext2_u32_list list)
+{
+	ext2_u32_iterate	iter;
+	__u32			val;
+
+	if (ext2fs_u32_list_iterate_begin(list, &iter)) {
+		cf->err = ENOMEM;
+		return;
+	}
+	while (ext2fs_u32_list_iterate(iter, &val))
+		ckpt_write_record(cf, &val, sizeof(val));
+	ext2fs_u32_list_iterate_end(iter);
+}
+
+static void fill_stats(e2fsck_t ctx, struct ckpt_stats *st, int restore)
+{
+#define CKPT_STAT(field)			\
+	do {					\
+		if (restore)			\
+			ctx->field = st->field;	\
+		else				\
+			st->field = ctx->field;	\
+	} while (0)
+	int	i;
+
+	CKPT_STAT(fs_directory_count);
+	CKPT_STAT(fs_regular_count);
+	CKPT_STAT(fs_blockdev_count);
+	CKPT_STAT(fs_chardev_count);
+	CKPT_STAT(fs_links_count);
+	CKPT_STAT(fs_symlinks_count);
+	CKPT_STAT(fs_fast_symlinks_count);
+	CKPT_STAT(fs_fifo_count);
+	CKPT_STAT(fs_total_count);
+	CKPT_STAT(fs_badblocks_count);
+	CKPT_STAT(fs_sockets_count);
+	CKPT_STAT(fs_ind_count);
+	CKPT_STAT(fs_dind_count);
+	CKPT_STAT(fs_tind_count);
+	CKPT_STAT(fs_fragmented);
+	CKPT_STAT(fs_fragmented_dir);
+	CKPT_STAT(large_files);
+	CKPT_STAT(fs_ext_attr_inodes);
+	CKPT_STAT(fs_ext_attr_blocks);
+	for (i = 0; i < MAX_EXTENT_DEPTH_COUNT; i++)
+		CKPT_STAT(extent_depth_count[i]);
+#undef CKPT_STAT
+}
+
+static void fill_header(e2fsck_t ctx, struct ckpt_header *hdr,
+			__u32 fingerprint)
+{
+	ext2_filsys fs = ctx->fs;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = E2FSCK_CKPT_MAGIC;
+	hdr->version = E2FSCK_CKPT_VERSION;
+	hdr->passes_done = E2FSCK_CKPT_PASSES;
+	hdr->sb_fingerprint = fingerprint;
+	hdr->options = ctx->options & E2FSCK_CKPT_OPTIONS;
+	hdr->flags = ctx->flags & E2FSCK_CKPT_FLAGS;
+	hdr->fs_flags = fs->flags & E2FSCK_CKPT_FS_FLAGS;
+	hdr->group_desc_count = fs->group_desc_count;
+	hdr->blocks_count = ext2fs_blocks_count(fs->super);
+	hdr->inodes_count = fs->super->s_inodes_count;
+	hdr->invalid_bitmaps = ctx->invalid_bitmaps;
+	memcpy(hdr->uuid, fs->super->s_uuid, sizeof(hdr->uuid));
+	hdr->root_repair_block = ctx->root_repair_block;
+	hdr->lnf_repair_block = ctx->lnf_repair_block;
+}
+
+static errcode_t write_checkpoint_file(e2fsck_t ctx, FILE *f,
+				       __u32 fingerprint)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct ckpt_file	cf;
+	struct ckpt_header	hdr;
+	struct ckpt_stats	st;
+	struct ckpt_dx_dir	dx;
+	struct dir_info_iter	*dirinfo_iter;
+	struct dir_info		*dir;
+	ext2fs_generic_bitmap	map;
+	unsigned int		i;
+	int			*flag_arrays[3];
+
+	memset(&cf, 0, sizeof(cf));
+	cf.f = f;
+	cf.crc = ~0;
+
+	fill_header(ctx, &hdr, fingerprint);
+	ckpt_write(&cf, &hdr, sizeof(hdr));
+	memset(&st, 0, sizeof(st));
+	fill_stats(ctx, &st, 0);
+	ckpt_write(&cf, &st, sizeof(st));
+
+	for (i = 0; i < CKPT_NUM_BITMAPS; i++) {
+		map = *(ext2fs_generic_bitmap *)
+			((char *) ctx + ckpt_bitmaps[i].offset);
+		if (!map)
+			continue;
+		ckpt_begin_section(&cf);
+		write_bitmap(&cf, map);
+		ckpt_end_section(&cf, CKPT_BITMAP, i);
+	}
+
+	if (ctx->inode_link_info) {
+		ckpt_begin_section(&cf);
+		write_icount(&cf, ctx, ctx->inode_link_info);
+		ckpt_end_section(&cf, CKPT_ICOUNT, 0);
+	}
+
+	if (ctx->dir_info) {
+		ckpt_begin_section(&cf);
+		dirinfo_iter = e2fsck_dir_info_iter_begin(ctx);
+		while ((dir = e2fsck_dir_info_iter(ctx, dirinfo_iter)) != 0)
+			ckpt_write_record(&cf, dir, sizeof(*dir));
+		e2fsck_dir_info_iter_end(ctx, dirinfo_iter);
+		ckpt_end_section(&cf, CKPT_DIRINFO, 0);
+	}
+
+	if (ctx->dx_dir_info) {
+		ckpt_begin_section(&cf);
+		for (i = 0; i < (unsigned) ctx->dx_dir_info_count; i++) {
+			dx.ino = ctx->dx_dir_info[i].ino;
+			dx.numblocks = ctx->dx_dir_info[i].numblocks;
+			dx.hashversion = ctx->dx_dir_info[i].hashversion;
+			dx.depth = ctx->dx_dir_info[i].depth;
+			ckpt_write_record(&cf, &dx, sizeof(dx));
+		}
+		ckpt_end_section(&cf, CKPT_DX_DIRINFO, 0);
+	}
+
+	if (fs->dblist) {
+		ckpt_begin_section(&cf);
+		ext2fs_dblist_iterate2(fs->dblist, write_dblist_proc, &cf);
+		ckpt_end_section(&cf, CKPT_DBLIST, 0);
+	}
+
+	if (ctx->dirs_to_hash) {
+		ckpt_begin_section(&cf);
+		write_u32_list(&cf, ctx->dirs_to_hash);
+		ckpt_end_section(&cf, CKPT_U32_LIST, 0);
+	}
+	if (ctx->encrypted_dirs) {
+		ckpt_begin_section(&cf);
+		write_u32_list(&cf, ctx->encrypted_dirs);
+		ckpt_end_section(&cf, CKPT_U32_LIST, 1);
+	}
+
+	flag_arrays[0] = ctx->invalid_inode_bitmap_flag;
+	flag_arrays[1] = ctx->invalid_block_bitmap_flag;
+	flag_arrays[2] = ctx->invalid_inode_table_flag;
+	for (i = 0; i < 3; i++) {
+		if (!flag_arrays[i])
+			continue;
+		ckpt_begin_section(&cf);
+		ckpt_write(&cf, flag_arrays[i],
+			   sizeof(int) * fs->group_desc_count);
+		cf.section_count = fs->group_desc_count;
+		ckpt_end_section(&cf, CKPT_INVALID, i);
+	}
+
+	ckpt_begin_section(&cf);
+	ckpt_end_section(&cf, CKPT_END, 0);
+	ckpt_write(&cf, &cf.crc, sizeof(cf.crc));
+	return cf.err;
+}
+
+/*
+ * Write out the state built up by pass 1.  Failing to write the
+ * checkpoint is not fatal; the check simply continues without one.
+ */
+void e2fsck_write_checkpoint(e2fsck_t ctx)
+{
+	ext2_filsys	fs = ctx->fs;
+	errcode_t	retval;
+	__u32		fingerprint;
+	__u16		state;
+	char		*tmp_name = 0;
+	FILE		*f = 0;
+
+	if (ctx->qctx) {
+		log_out(ctx, _("%s: quota accounting can not be "
+			       "checkpointed; not writing %s\n"),
+			ctx->device_name, ctx->checkpoint_file);
+		return;
+	}
+
+	if (ctx->options & E2F_OPT_READONLY)
+		fingerprint = ctx->sb_fingerprint;
+	else {
+		state = fs->super->s_state;
+		fs->super->s_state &= ~EXT2_VALID_FS;
+		ext2fs_mark_super_dirty(fs);
+		retval = ext2fs_flush(fs);
+		fingerprint = e2fsck_sb_fingerprint(fs);
+		fs->super->s_state = state;
+		if (retval)
+			goto errout;
+	}
+
+	retval = ext2fs_get_mem(strlen(ctx->checkpoint_file) + 5, &tmp_name);
+	if (retval)
+		goto errout;
+	sprintf(tmp_name, "%s.new", ctx->checkpoint_file);
+
+	f = fopen(tmp_name, "w");
+	if (!f) {
+		retval = errno;
+		goto errout;
+	}
+	retval = write_checkpoint_file(ctx, f, fingerprint);
+	if (!retval && (fflush(f) || fsync(fileno(f))))
+		retval = errno;
+	if (fclose(f) && !retval)
+		retval = errno;
+	f = 0;
+	if (!retval && rename(tmp_name, ctx->checkpoint_file))
+		retval = errno;
+	if (!retval)
+		ckpt_watch_writes(ctx);
+errout:
+	if (retval) {
+		com_err(ctx->program_name, retval,
+			_("while writing checkpoint %s"), ctx->checkpoint_file);
+		if (tmp_name)
+			(void) unlink(tmp_name);
+	}
+	if (tmp_name)
+		ext2fs_free_mem(&tmp_name);
+}
+
+static errcode_t read_bitmap(e2fsck_t ctx, struct ckpt_file *cf, __u32 id,
+			     __u64 count)
+{
+	struct ckpt_bitmap	*cb;
+	ext2fs_generic_bitmap	*map;
+	struct ckpt_run		run;
+	unsigned int		chunk;
+	errcode_t		retval;
+
+	if (id >= CKPT_NUM_BITMAPS)
+		return EXT2_ET_INVALID_ARGUMENT;
+	cb = &ckpt_bitmaps[id];
+	map = (ext2fs_generic_bitmap *) ((char *) ctx + cb->offset);
+	if (*map)
+		return EXT2_ET_INVALID_ARGUMENT;
+	if (cb->kind == CKPT_INODE_MAP)
+		retval = e2fsck_allocate_inode_bitmap(ctx->fs, _(cb->descr),
+						      cb->type, cb->name, map);
+	else if (cb->kind == CKPT_SUBCLUSTER_MAP)
+		retval = e2fsck_allocate_subcluster_bitmap(ctx->fs,
+				_(cb->descr), cb->type, cb->name, map);
+	else
+		retval = e2fsck_allocate_block_bitmap(ctx->fs, _(cb->descr),
+						      cb->type, cb->name, map);
+	if (retval)
+		return retval;
+
+	while (count-- && !cf->err) {
+		ckpt_read(cf, &run, sizeof(run));
+		while (run.len && !cf->err) {
+			chunk = run.len > 0x40000000ULL ? 0x40000000U :
+				(unsigned int) run.len;
+			ext2fs_mark_block_bitmap_range2(*map, run.start, chunk);
+			run.start += chunk;
+			run.len -= chunk;
+		}
+	}
+	return 0;
+}
+
+static errcode_t read_u32_list(struct ckpt_file *cf, __u64 count,
+			       ext2_u32_list *ret)
+{
+	errcode_t	retval;
+	__u32		val;
+
+	if (*ret)
+		return EXT2_ET_INVALID_ARGUMENT;
+	retval = ext2fs_u32_list_create(ret, count ? count : 10);
+	if (retval)
+		return retval;
+	while (count-- && !cf->err) {
+		ckpt_read(cf, &val, sizeof(val));
+		retval = ext2fs_u32_list_add(*ret, val);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
+static errcode_t read_sections(e2fsck_t ctx, struct ckpt_file *cf)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct ckpt_section	sec, hdr;
+	struct ckpt_icount	ic;
+	struct ckpt_dx_dir	dx;
+	struct dx_dir_info	*dx_dir;
+	struct dir_info		dir;
+	struct ext2_db_entry2	db;
+	int			*flags;
+	errcode_t		retval;
+
+	while (!cf->err) {
+		/*
+		 * The section header is added to the checksum after its
+		 * records, in the same order as it was written.
+		 */
+		if (fread(&sec, sizeof(sec), 1, cf->f) != 1) {
+			cf->err = EXT2_ET_SHORT_READ;
+			break;
+		}
+		hdr = sec;
+		retval = 0;
+		switch (sec.tag) {
+		case CKPT_BITMAP:
+			retval = read_bitmap(ctx, cf, sec.id, sec.count);
+			break;
+		case CKPT_ICOUNT:
+			retval = e2fsck_setup_icount(ctx, "inode_link_info", 0,
+						NULL, &ctx->inode_link_info);
+			while (!retval && sec.count-- && !cf->err) {
+				ckpt_read(cf, &ic, sizeof(ic));
+				retval = ext2fs_icount_store(
+					ctx->inode_link_info, ic.ino,
+					ic.count);
+			}
+			break;
+		case CKPT_DIRINFO:
+			while (sec.count-- && !cf->err) {
+				ckpt_read(cf, &dir, sizeof(dir));
+				e2fsck_add_dir_info(ctx, dir.ino, dir.parent);
+				e2fsck_dir_info_set_dotdot(ctx, dir.ino,
+							   dir.dotdot);
+				e2fsck_dir_info_set_parent(ctx, dir.ino,
+							   dir.parent);
+			}
+			break;
+		case CKPT_DX_DIRINFO:
+			while (sec.count-- && !cf->err) {
+				ckpt_read(cf, &dx, sizeof(dx));
+				e2fsck_add_dx_dir(ctx, dx.ino, dx.numblocks);
+				dx_dir = e2fsck_get_dx_dir_info(ctx, dx.ino);
+				if (dx_dir) {
+					dx_dir->hashversion = dx.hashversion;
+					dx_dir->depth = dx.depth;
+				}
+			}
+			break;
+		case CKPT_DBLIST:
+			if (!fs->dblist)
+				retval = ext2fs_init_dblist(fs, 0);
+			while (!retval && sec.count-- && !cf->err) {
+				ckpt_read(cf, &db, sizeof(db));
+				retval = ext2fs_add_dir_block2(fs->dblist,
+						db.ino, db.blk, db.blockcnt);
+			}
+			break;
+		case CKPT_U32_LIST:
+			if (sec.id == 0)
+				retval = read_u32_list(cf, sec.count,
+						       &ctx->dirs_to_hash);
+			else if (sec.id == 1)
+				retval = read_u32_list(cf, sec.count,
+						       &ctx->encrypted_dirs);
+			else
+				retval = EXT2_ET_INVALID_ARGUMENT;
+			break;
+		case CKPT_INVALID:
+			if (sec.id == 0)
+				flags = ctx->invalid_inode_bitmap_flag;
+			else if (sec.id == 1)
+				flags = ctx->invalid_block_bitmap_flag;
+			else if (sec.id == 2)
+				flags = ctx->invalid_inode_table_flag;
+			else
+				flags = 0;
+			if (!flags || sec.count != fs->group_desc_count) {
+				retval = EXT2_ET_INVALID_ARGUMENT;
+				break;
+			}
+			ckpt_read(cf, flags, sizeof(int) * sec.count);
+			break;
+		case CKPT_END:
+			break;
+		default:
+			retval = EXT2_ET_INVALID_ARGUMENT;
+			break;
+		}
+		if (retval)
+			return retval;
+		cf->crc = ext2fs_crc32c_le(cf->crc, (unsigned char *) &hdr,
+					   sizeof(hdr));
+		if (hdr.tag == CKPT_END)
+			return 0;
+	}
+	return cf->err;
+}
+
+/*
+ * Load the checkpoint named by -E checkpoint=<file> if it was taken on
+ * this filesystem in its current state.  Returns the number of passes
+ * which can be skipped; zero means the check has to start over.  Once
+ * the checkpoint's state has started to be loaded any error is fatal,
+ * since e2fsck's context would be only half initialized.
+ */
+int e2fsck_read_checkpoint(e2fsck_t ctx)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct ckpt_file	cf;
+	struct ckpt_header	hdr;
+	struct ckpt_stats	st;
+	errcode_t		retval;
+	__u32			crc, file_crc;
+
+	memset(&cf, 0, sizeof(cf));
+	cf.crc = ~0;
+	cf.f = fopen(ctx->checkpoint_file, "r");
+	if (!cf.f) {
+		log_out(ctx, _("%s: can not open checkpoint %s: %s; "
+			       "checking from the start\n"),
+			ctx->device_name, ctx->checkpoint_file,
+			error_message(errno));
+		return 0;
+	}
+
+	ckpt_read(&cf, &hdr, sizeof(hdr));
+	if (cf.err || hdr.magic != E2FSCK_CKPT_MAGIC ||
+	    hdr.version != E2FSCK_CKPT_VERSION ||
+	    hdr.passes_done != E2FSCK_CKPT_PASSES ||
+	    hdr.group_desc_count != fs->group_desc_count ||
+	    hdr.blocks_count != ext2fs_blocks_count(fs->super) ||
+	    hdr.inodes_count != fs->super->s_inodes_count ||
+	    memcmp(hdr.uuid, fs->super->s_uuid, sizeof(hdr.uuid))) {
+		log_out(ctx, _("%s: %s is not a checkpoint of this "
+			       "filesystem; checking from the start\n"),
+			ctx->device_name, ctx->checkpoint_file);
+		goto out;
+	}
+	if (hdr.sb_fingerprint != ctx->sb_fingerprint) {
+		log_out(ctx, _("%s: filesystem has changed since checkpoint "
+			       "%s was written; checking from the start\n"),
+			ctx->device_name, ctx->checkpoint_file);
+		goto out;
+	}
+	if (hdr.options != (ctx->options & E2FSCK_CKPT_OPTIONS)) {
+		log_out(ctx, _("%s: checkpoint %s was written with different "
+			       "options; checking from the start\n"),
+			ctx->device_name, ctx->checkpoint_file);
+		goto out;
+	}
+	if (ctx->qctx) {
+		log_out(ctx, _("%s: quota accounting can not be resumed; "
+			       "checking from the start\n"),
+			ctx->device_name);
+		goto out;
+	}
+
+	ckpt_read(&cf, &st, sizeof(st));
+	retval = read_sections(ctx, &cf);
+	crc = cf.crc;
+	ckpt_read(&cf, &file_crc, sizeof(file_crc));
+	if (!retval)
+		retval = cf.err;
+	if (!retval && crc != file_crc)
+		retval = EXT2_ET_BAD_CRC;
+	if (retval) {
+		com_err(ctx->program_name, retval,
+			_("while reading checkpoint %s"), ctx->checkpoint_file);
+		fatal_error(ctx, _("Please run e2fsck without the resume "
+				   "option"));
+	}
+
+	fill_stats(ctx, &st, 1);
+	ctx->flags |= hdr.flags & E2FSCK_CKPT_FLAGS;
+	fs->flags = (fs->flags & ~E2FSCK_CKPT_FS_FLAGS) |
+		(hdr.fs_flags & E2FSCK_CKPT_FS_FLAGS);
+	ctx->invalid_bitmaps = hdr.invalid_bitmaps;
+	ctx->root_repair_block = hdr.root_repair_block;
+	ctx->lnf_repair_block = hdr.lnf_repair_block;
+	fclose(cf.f);
+	ckpt_watch_writes(ctx);
+
+	log_out(ctx, _("%s: resuming from checkpoint after pass 1\n"),
+		ctx->device_name);
+	return hdr.passes_done;
+out:
+	fclose(cf.f);
+	return 0;
+}
@@ -46,29 +46,25 @@ static void e2fsck_put_dir_info(e2fsck_t ctx, struct dir_info *dir);
 static void setup_tdb(e2fsck_t ctx, ext2_ino_t num_dirs)
 {
 	struct dir_info_db	*db = ctx->dir_info;
-	unsigned int		threshold;
 	errcode_t		retval;
 	mode_t			save_umask;
 	char			*tdb_dir, uuid[40];
-	int			fd, enable;
+	int			fd;
 
-	profile_get_string(ctx->profile, "scratch_files", "directory", 0, 0,
-			   &tdb_dir);
-	profile_get_uint(ctx->profile, "scratch_files",
-			 "numdirs_threshold", 0, 0, &threshold);
-	profile_get_boolean(ctx->profile, "scratch_files",
-			    "dirinfo", 0, 1, &enable);
-
-	if (!enable || !tdb_dir || access(tdb_dir, W_OK) ||
-	    (threshold && num_dirs <= threshold))
+	tdb_dir = e2fsck_scratch_dir(ctx, "dirinfo", E2F_SPILL_DIRINFO,
+				     num_dirs);
+	if (!tdb_dir)
 		return;
 
 	retval = ext2fs_get_mem(strlen(tdb_dir) + 64, &db->tdb_fn);
-	if (retval)
+	if (retval) {
+		free(tdb_dir);
 		return;
+	}
 
 	uuid_unparse(ctx->fs->super->s_uuid, uuid);
 	sprintf(db->tdb_fn, "%s/%s-dirinfo-XXXXXX", tdb_dir, uuid);
+	free(tdb_dir);
 	save_umask = umask(077);
 	fd = mkstemp(db->tdb_fn);
 	umask(save_umask);
@@ -72,9 +72,13 @@ void e2fsck_add_dx_dir(e2fsck_t ctx, ext2_ino_t ino, int num_blocks)
 	dir->ino = ino;
 	dir->numblocks = num_blocks;
 	dir->hashversion = 0;
-	dir->dx_block = e2fsck_allocate_memory(ctx, num_blocks
-				       * sizeof (struct dx_dirblock_info),
-				       "dx_block info array");
+	dir->dx_block = arena_alloc(&ctx->dx_block_arena, num_blocks *
+				    sizeof (struct dx_dirblock_info));
+	if (!dir->dx_block) {
+		fprintf(stderr, "Couldn't allocate dx_block info array "
+			"of %d entries\n", num_blocks);
+		fatal_error(ctx, 0);
+	}
 
 }
 
@@ -114,20 +118,11 @@ struct dx_dir_info *e2fsck_get_dx_dir_info(e2fsck_t ctx, ext2_ino_t ino)
  */
 void e2fsck_free_dx_dir_info(e2fsck_t ctx)
 {
-	int	i;
-	struct dx_dir_info *dir;
-
 	if (ctx->dx_dir_info) {
-		dir = ctx->dx_dir_info;
-		for (i=0; i < ctx->dx_dir_info_count; i++,dir++) {
-			if (dir->dx_block) {
-				ext2fs_free_mem(&dir->dx_block);
-				dir->dx_block = 0;
-			}
-		}
 		ext2fs_free_mem(&ctx->dx_dir_info);
 		ctx->dx_dir_info = 0;
 	}
+	arena_release(&ctx->dx_block_arena);
 	ctx->dx_dir_info_size = 0;
 	ctx->dx_dir_info_count = 0;
 }
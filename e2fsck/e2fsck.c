@@ -176,6 +176,8 @@ errcode_t e2fsck_reset_context(e2fsck_t ctx)
 	/* Reset the superblock to the user's requested value */
 	ctx->superblock = ctx->use_superblock;
 
+	ctx->checkpoint_pass = 0;
+
 	return 0;
 }
 
@@ -200,6 +202,9 @@ void e2fsck_free_context(e2fsck_t ctx)
 	if (ctx->log_fn)
 		free(ctx->log_fn);
 
+	if (ctx->checkpoint_file)
+		free(ctx->checkpoint_file);
+
 	if (ctx->logf)
 		fclose(ctx->logf);
 
@@ -229,7 +234,7 @@ int e2fsck_run(e2fsck_t ctx)
 	ctx->flags |= E2F_FLAG_SETJMP_OK;
 #endif
 
-	for (i=0; (e2fsck_pass = e2fsck_passes[i]); i++) {
+	for (i = ctx->checkpoint_pass; (e2fsck_pass = e2fsck_passes[i]); i++) {
 		if (ctx->flags & E2F_FLAG_RUN_RETURN)
 			break;
 		if (e2fsck_mmp_update(ctx->fs))
@@ -237,6 +242,9 @@ int e2fsck_run(e2fsck_t ctx)
 		e2fsck_pass(ctx);
 		if (ctx->progress)
 			(void) (ctx->progress)(ctx, 0, 0, 0);
+		if (e2fsck_pass == e2fsck_pass1 && ctx->checkpoint_file &&
+		    !(ctx->flags & E2F_FLAG_RUN_RETURN))
+			e2fsck_write_checkpoint(ctx);
 	}
 	ctx->flags &= ~E2F_FLAG_SETJMP_OK;
 
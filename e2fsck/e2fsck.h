@@ -68,6 +68,7 @@
 #endif
 
 #include "support/quotaio.h"
+#include "support/arena.h"
 
 /*
  * Exit codes used by fsck-type programs
@@ -171,6 +172,14 @@ struct resource_track {
 #define E2F_OPT_FIXES_ONLY	0x8000 /* skip all optimizations */
 #define E2F_OPT_NOOPT_EXTENTS	0x10000 /* don't optimize extents */
 #define E2F_OPT_ICOUNT_FULLMAP	0x20000 /* use an array for inode counts */
+#define E2F_OPT_RESUME		0x40000 /* resume from the checkpoint file */
+#define E2F_OPT_INCREMENTAL	0x80000 /* only check modified groups */
+
+/*
+ * Structures kept in scratch files to stay within -E mem_budget
+ */
+#define E2F_SPILL_ICOUNT	0x0001
+#define E2F_SPILL_DIRINFO	0x0002
 
 /*
  * E2fsck flags
@@ -305,6 +314,7 @@ struct e2fsck_struct {
 	int		dx_dir_info_count;
 	int		dx_dir_info_size;
 	struct dx_dir_info *dx_dir_info;
+	struct arena	dx_block_arena;	/* dx_block arrays */
 
 	/*
 	 * Directories to hash
@@ -323,6 +333,8 @@ struct e2fsck_struct {
 	 */
 	io_channel	journal_io;
 	char	*journal_name;
+	struct replay_cache *replay_cache;
+	struct journal_window *journal_window;
 
 	/*
 	 * Ext4 quota support
@@ -388,6 +400,14 @@ struct e2fsck_struct {
 	/* How much are we allowed to readahead? */
 	unsigned long long readahead_kb;
 
+	/*
+	 * Memory budget in bytes (0 if none), and the backends picked
+	 * to stay within it
+	 */
+	unsigned long long mem_budget;
+	unsigned int	budget_bitmap_type;
+	int		scratch_spill;
+
 	/*
 	 * Inodes to rebuild extent trees
 	 */
@@ -395,6 +415,11 @@ struct e2fsck_struct {
 
 	/* Undo file */
 	char *undo_file;
+
+	/* Checkpoint file, passes already completed, superblock checksum */
+	char *checkpoint_file;
+	int checkpoint_pass;
+	__u32 sb_fingerprint;
 };
 
 /* Data structures to evaluate whether an extent tree needs rebuilding. */
@@ -440,6 +465,11 @@ extern int e2fsck_run(e2fsck_t ctx);
 extern void read_bad_blocks_file(e2fsck_t ctx, const char *bad_blocks_file,
 				 int replace_bad_blocks);
 
+/* checkpoint.c */
+extern __u32 e2fsck_sb_fingerprint(ext2_filsys fs);
+extern void e2fsck_write_checkpoint(e2fsck_t ctx);
+extern int e2fsck_read_checkpoint(e2fsck_t ctx);
+
 /* dirinfo.c */
 extern void e2fsck_add_dir_info(e2fsck_t ctx, ext2_ino_t ino, ext2_ino_t parent);
 extern void e2fsck_free_dir_info(e2fsck_t ctx);
@@ -495,6 +525,9 @@ errcode_t e2fsck_should_rebuild_extents(e2fsck_t ctx,
 					struct extent_tree_info *eti,
 					struct ext2_extent_info *info);
 
+/* incremental.c */
+extern const char *e2fsck_check_incremental(e2fsck_t ctx);
+
 /* journal.c */
 extern errcode_t e2fsck_check_ext3_journal(e2fsck_t ctx);
 extern errcode_t e2fsck_run_ext3_journal(e2fsck_t ctx);
@@ -643,6 +676,9 @@ extern errcode_t e2fsck_allocate_subcluster_bitmap(ext2_filsys fs,
 						   int default_type,
 						   const char *profile_name,
 						   ext2fs_block_bitmap *ret);
+extern void e2fsck_plan_memory(e2fsck_t ctx);
+extern char *e2fsck_scratch_dir(e2fsck_t ctx, const char *name, int spill,
+				ext2_ino_t num_dirs);
 unsigned long long get_memory_size(void);
 
 /* unix.c */
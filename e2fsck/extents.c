@@ -211,9 +211,6 @@ static errcode_t rebuild_extent_tree(e2fsck_t ctx, struct extent_list *list,
 {
 	struct ext2_inode_large	inode;
 	errcode_t		retval;
-	ext2_extent_handle_t	handle;
-	unsigned int		i, ext_written;
-	struct ext2fs_extent	*ex, extent;
 	blk64_t			start_val, delta;
 
 	list->count = 0;
@@ -258,50 +255,13 @@ extents_loaded:
 	if (retval)
 		goto err;
 
-	/* Now stuff extents into the file */
-	retval = ext2fs_extent_open2(ctx->fs, ino, EXT2_INODE(&inode), &handle);
+	/* Now write the new tree in one go */
+	start_val = ext2fs_inode_i_blocks(ctx->fs, EXT2_INODE(&inode));
+	retval = ext2fs_extent_build_tree(ctx->fs, ino, EXT2_INODE(&inode),
+					  list->extents, list->count);
 	if (retval)
 		goto err;
 
-	ext_written = 0;
-	start_val = ext2fs_inode_i_blocks(ctx->fs, EXT2_INODE(&inode));
-	for (i = 0, ex = list->extents; i < list->count; i++, ex++) {
-		memcpy(&extent, ex, sizeof(struct ext2fs_extent));
-		extent.e_flags &= EXT2_EXTENT_FLAGS_UNINIT;
-		if (extent.e_flags & EXT2_EXTENT_FLAGS_UNINIT) {
-			if (extent.e_len > EXT_UNINIT_MAX_LEN) {
-				extent.e_len = EXT_UNINIT_MAX_LEN;
-				ex->e_pblk += EXT_UNINIT_MAX_LEN;
-				ex->e_lblk += EXT_UNINIT_MAX_LEN;
-				ex->e_len -= EXT_UNINIT_MAX_LEN;
-				ex--;
-				i--;
-			}
-		} else {
-			if (extent.e_len > EXT_INIT_MAX_LEN) {
-				extent.e_len = EXT_INIT_MAX_LEN;
-				ex->e_pblk += EXT_INIT_MAX_LEN;
-				ex->e_lblk += EXT_INIT_MAX_LEN;
-				ex->e_len -= EXT_INIT_MAX_LEN;
-				ex--;
-				i--;
-			}
-		}
-
-#ifdef DEBUG
-		printf("W: ino=%d pblk=%llu lblk=%llu len=%u\n", ino,
-				extent.e_pblk, extent.e_lblk, extent.e_len);
-#endif
-		retval = ext2fs_extent_insert(handle, EXT2_EXTENT_INSERT_AFTER,
-					      &extent);
-		if (retval)
-			goto err2;
-		retval = ext2fs_extent_fix_parents(handle);
-		if (retval)
-			goto err2;
-		ext_written++;
-	}
-
 	delta = ext2fs_inode_i_blocks(ctx->fs, EXT2_INODE(&inode)) - start_val;
 	if (delta) {
 		if (!ext2fs_has_feature_huge_file(ctx->fs->super) ||
@@ -314,12 +274,10 @@ extents_loaded:
 
 #if defined(DEBUG) || defined(DEBUG_SUMMARY)
 	printf("rebuild: ino=%d extents=%d->%d\n", ino, list->ext_read,
-	       ext_written);
+	       list->count);
 #endif
 	e2fsck_write_inode(ctx, ino, EXT2_INODE(&inode), "rebuild_extents");
 
-err2:
-	ext2fs_extent_free(handle);
 err:
 	return retval;
 }
@@ -0,0 +1,359 @@
+/*
+ * incremental.c --- check only the block groups modified since the
+ * last full check
+ *
+ * When the superblock has EXT2_FLAGS_TRACK_DIRTY set, programs using
+ * libext2fs set EXT2_BG_DIRTY in the descriptor of every group they
+ * modify, and a full e2fsck run clears those flags again.  If the file
+ * system has not been mounted by the kernel since (which would not
+ * record its changes), "e2fsck -E incremental" only verifies the dirty
+ * groups instead of running all of the passes:
+ *
+ *	- the free block, free inode and directory counts of the group
+ *	  agree with its bitmaps,
+ *	- every in-use inode in the group passes its checksum, is linked
+ *	  and not deleted, and only refers to blocks that are inside the
+ *	  file system and marked in use,
+ *	- the extended attribute block of each such inode is valid, and
+ *	- every entry of each directory in the group is well formed, has
+ *	  a legal name and points to an in-use inode,
+ *	- the link count of each directory in the group matches its
+ *	  subdirectories, and
+ *	- no inode in a modified group has more names in the directories
+ *	  of the modified groups than its link count.  Changing a name
+ *	  marks both the directory's and the inode's group, so only names
+ *	  which were there at the last full check can be left out.
+ *
+ * Any problem found makes e2fsck fall back to a full check, which then
+ * reports and repairs it; nothing is fixed here.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include <string.h>
+
+#include "e2fsck.h"
+
+struct incr_check {
+	e2fsck_t	ctx;
+	ext2_ino_t	ino;
+	errcode_t	errcode;
+	const char	*problem;
+	ext2_icount_t	refs;		/* names found in modified dirs */
+	ext2_icount_t	links;		/* link counts of non-directories */
+	__u32		subdirs;	/* of the directory being checked */
+};
+
+static int check_block_proc(ext2_filsys fs, blk64_t *block_nr,
+			    e2_blkcnt_t blockcnt EXT2FS_ATTR((unused)),
+			    blk64_t ref_block EXT2FS_ATTR((unused)),
+			    int ref_offset EXT2FS_ATTR((unused)),
+			    void *priv_data)
+{
+	struct incr_check *ic = (struct incr_check *) priv_data;
+	blk64_t blk = *block_nr;
+
+	if (blk < fs->super->s_first_data_block ||
+	    blk >= ext2fs_blocks_count(fs->super)) {
+		ic->problem = _("block out of range");
+		return BLOCK_ABORT;
+	}
+	if (!ext2fs_test_block_bitmap2(fs->block_map, blk)) {
+		ic->problem = _("block in use but marked free");
+		return BLOCK_ABORT;
+	}
+	return 0;
+}
+
+static int check_bmpt_block_proc(ext2_filsys fs,
+				 int dup_on EXT2FS_ATTR((unused)),
+				 struct ext2_bmptirec *block_irec,
+				 e2_blkcnt_t blockcnt,
+				 struct ext2_bmptirec *ref_block EXT2FS_ATTR((unused)),
+				 int ref_offset, void *priv_data)
+{
+	blk64_t blk;
+	int i, ret = 0;
+
+	for (i = 0; i < EXT2_BMPT_N_DUPS && !(ret & BLOCK_ABORT); i++) {
+		blk = block_irec->b_blocks[i];
+		if (blk)
+			ret = check_block_proc(fs, &blk, blockcnt, 0,
+					       ref_offset, priv_data);
+	}
+	return ret;
+}
+
+static int check_dirent_proc(ext2_ino_t dir EXT2FS_ATTR((unused)),
+			     int entry EXT2FS_ATTR((unused)),
+			     struct ext2_dir_entry *dirent,
+			     int offset EXT2FS_ATTR((unused)),
+			     int blocksize EXT2FS_ATTR((unused)),
+			     char *buf EXT2FS_ATTR((unused)),
+			     void *priv_data)
+{
+	struct incr_check *ic = (struct incr_check *) priv_data;
+	ext2_filsys fs = ic->ctx->fs;
+	ext2_ino_t ino = dirent->inode;
+	int len = ext2fs_dirent_name_len(dirent);
+	struct ext2_inode inode;
+	int is_dir;
+
+	if (ino == 0)
+		return 0;
+	if (ino > fs->super->s_inodes_count ||
+	    !ext2fs_test_inode_bitmap2(fs->inode_map, ino)) {
+		ic->problem = _("directory entry refers to an unused inode");
+		return DIRENT_ABORT;
+	}
+	if (len == 0 || memchr(dirent->name, '/', len) ||
+	    memchr(dirent->name, '\0', len)) {
+		ic->problem = _("directory entry has an illegal name");
+		return DIRENT_ABORT;
+	}
+	if ((len == 1 && dirent->name[0] == '.') ||
+	    (len == 2 && dirent->name[0] == '.' && dirent->name[1] == '.'))
+		return 0;
+
+	if (ext2fs_has_feature_filetype(fs->super))
+		is_dir = ext2fs_dirent_file_type(dirent) == EXT2_FT_DIR;
+	else {
+		ic->errcode = ext2fs_read_inode(fs, ino, &inode);
+		if (ic->errcode)
+			return DIRENT_ABORT;
+		is_dir = LINUX_S_ISDIR(inode.i_mode);
+	}
+	if (is_dir)
+		ic->subdirs++;
+	else if (ext2fs_bg_flags_test(fs, ext2fs_group_of_ino(fs, ino),
+				      EXT2_BG_DIRTY)) {
+		ic->errcode = ext2fs_icount_increment(ic->refs, ino, 0);
+		if (ic->errcode)
+			return DIRENT_ABORT;
+	}
+	return 0;
+}
+
+static void check_inode(struct incr_check *ic, ext2_ino_t ino,
+			struct ext2_inode_large *inode, char *block_buf)
+{
+	ext2_filsys fs = ic->ctx->fs;
+	blk64_t blk;
+
+	ic->ino = ino;
+	if (ino != EXT2_ROOT_INO && ino < EXT2_FIRST_INODE(fs->super))
+		return;
+	if (inode->i_links_count == 0 || inode->i_dtime) {
+		ic->problem = _("in-use inode is deleted");
+		return;
+	}
+
+	blk = ext2fs_file_acl_block(fs, EXT2_INODE(inode));
+	if (blk) {
+		if (blk < fs->super->s_first_data_block ||
+		    blk >= ext2fs_blocks_count(fs->super) ||
+		    !ext2fs_test_block_bitmap2(fs->block_map, blk)) {
+			ic->problem = _("bad extended attribute block");
+			return;
+		}
+		ic->errcode = ext2fs_read_ext_attr3(fs, blk, block_buf, ino);
+		if (ic->errcode)
+			return;
+	}
+
+	if ((LINUX_S_ISREG(inode->i_mode) || LINUX_S_ISDIR(inode->i_mode) ||
+	     LINUX_S_ISLNK(inode->i_mode)) &&
+	    ext2fs_inode_has_valid_blocks2(fs, EXT2_INODE(inode))) {
+		if (inode->i_flags & EXT2_FYP_BMPT_FL)
+			ic->errcode = ext2fs_bmpt_block_iterate(fs, ino,
+					BLOCK_FLAG_READ_ONLY, block_buf,
+					check_bmpt_block_proc, ic);
+		else
+			ic->errcode = ext2fs_block_iterate3(fs, ino,
+					BLOCK_FLAG_READ_ONLY, block_buf,
+					check_block_proc, ic);
+		if (ic->errcode || ic->problem)
+			return;
+	}
+
+	if (!LINUX_S_ISDIR(inode->i_mode)) {
+		ic->errcode = ext2fs_icount_store(ic->links, ino,
+						  inode->i_links_count);
+		return;
+	}
+
+	ic->subdirs = 0;
+	ic->errcode = ext2fs_dir_iterate2(fs, ino, 0, block_buf,
+					  check_dirent_proc, ic);
+	if (ic->errcode || ic->problem)
+		return;
+	/* With dir_nlink, a count of 1 means "too many to count" */
+	if (inode->i_links_count == 1 && ext2fs_has_feature_dir_nlink(fs->super))
+		return;
+	if (inode->i_links_count != ic->subdirs + 2)
+		ic->problem = _("directory link count wrong");
+}
+
+/*
+ * Now that every modified directory has been read, make sure that no
+ * inode of the group has more names than links.
+ */
+static void check_group_links(struct incr_check *ic, dgrp_t group)
+{
+	ext2_filsys fs = ic->ctx->fs;
+	ext2_ino_t ino, first_ino, last_ino;
+	__u16 refs, links;
+
+	first_ino = group * fs->super->s_inodes_per_group + 1;
+	last_ino = first_ino + fs->super->s_inodes_per_group - 1;
+	for (ino = first_ino; ino <= last_ino; ino++) {
+		if (ext2fs_icount_fetch(ic->refs, ino, &refs) || !refs)
+			continue;
+		ic->ino = ino;
+		if (ext2fs_icount_fetch(ic->links, ino, &links) ||
+		    refs > links) {
+			ic->problem = _("more directory entries than links");
+			return;
+		}
+	}
+	ic->ino = 0;
+}
+
+static void check_group(struct incr_check *ic, dgrp_t group,
+			struct ext2_inode_large *inode, char *block_buf)
+{
+	ext2_filsys fs = ic->ctx->fs;
+	ext2_ino_t ino, first_ino, last_ino;
+	blk64_t blk, first_blk, last_blk;
+	__u32 free_clusters = 0, free_inodes = 0, dirs = 0;
+	int ratio = EXT2FS_CLUSTER_RATIO(fs);
+
+	first_blk = ext2fs_group_first_block2(fs, group);
+	last_blk = ext2fs_group_last_block2(fs, group);
+	for (blk = first_blk; blk <= last_blk; blk += ratio)
+		if (!ext2fs_fast_test_block_bitmap2(fs->block_map, blk))
+			free_clusters++;
+	if (free_clusters != ext2fs_bg_free_blocks_count(fs, group)) {
+		ic->problem = _("free blocks count wrong");
+		return;
+	}
+
+	first_ino = group * fs->super->s_inodes_per_group + 1;
+	last_ino = first_ino + fs->super->s_inodes_per_group - 1;
+	for (ino = first_ino; ino <= last_ino; ino++) {
+		if (!ext2fs_fast_test_inode_bitmap2(fs->inode_map, ino)) {
+			free_inodes++;
+			continue;
+		}
+		ic->ino = ino;
+		ic->errcode = ext2fs_read_inode_full(fs, ino,
+					EXT2_INODE(inode),
+					EXT2_INODE_SIZE(fs->super));
+		if (ic->errcode)
+			return;
+		if (LINUX_S_ISDIR(inode->i_mode))
+			dirs++;
+		check_inode(ic, ino, inode, block_buf);
+		if (ic->errcode || ic->problem)
+			return;
+	}
+	ic->ino = 0;
+	if (free_inodes != ext2fs_bg_free_inodes_count(fs, group))
+		ic->problem = _("free inodes count wrong");
+	else if (dirs != ext2fs_bg_used_dirs_count(fs, group))
+		ic->problem = _("directories count wrong");
+}
+
+/*
+ * Check the groups modified since the last full check.  Returns NULL
+ * if they are all consistent, or the reason why a full check is
+ * needed, in the form expected by check_if_skip().
+ */
+const char *e2fsck_check_incremental(e2fsck_t ctx)
+{
+	ext2_filsys fs = ctx->fs;
+	struct incr_check ic;
+	struct ext2_inode_large *inode = 0;
+	char *block_buf = 0;
+	dgrp_t group, checked = 0;
+	const char *reason = 0;
+
+	if (!(fs->super->s_flags & EXT2_FLAGS_TRACK_DIRTY))
+		return _(" does not track modified block groups");
+	if (fs->super->s_mnt_count)
+		return _(" has been mounted since it was last checked");
+	if (fs->super->s_last_orphan)
+		return _(" has orphan inodes");
+
+	memset(&ic, 0, sizeof(ic));
+	ic.ctx = ctx;
+	ic.errcode = ext2fs_read_bitmaps(fs);
+	if (ic.errcode) {
+		log_out(ctx, _("%s: %s while reading bitmaps\n"),
+			ctx->device_name, error_message(ic.errcode));
+		return _(" failed the incremental check");
+	}
+	inode = e2fsck_allocate_memory(ctx, EXT2_INODE_SIZE(fs->super),
+				       "incremental inode buffer");
+	block_buf = e2fsck_allocate_memory(ctx, fs->blocksize * 3,
+					   "incremental block buffer");
+	ic.errcode = ext2fs_create_icount2(fs, 0, 0, 0, &ic.refs);
+	if (!ic.errcode)
+		ic.errcode = ext2fs_create_icount2(fs, 0, 0, 0, &ic.links);
+	if (ic.errcode)
+		goto out;
+
+	for (group = 0; group < fs->group_desc_count; group++) {
+		if (!ext2fs_bg_flags_test(fs, group, EXT2_BG_DIRTY))
+			continue;
+		check_group(&ic, group, inode, block_buf);
+		if (ic.errcode || ic.problem)
+			goto out;
+		checked++;
+	}
+	for (group = 0; group < fs->group_desc_count; group++) {
+		if (!ext2fs_bg_flags_test(fs, group, EXT2_BG_DIRTY))
+			continue;
+		check_group_links(&ic, group);
+		if (ic.problem)
+			goto out;
+	}
+
+	if (!(ctx->options & E2F_OPT_READONLY)) {
+		for (group = 0; group < fs->group_desc_count; group++) {
+			if (!ext2fs_bg_flags_test(fs, group, EXT2_BG_DIRTY))
+				continue;
+			ext2fs_bg_flags_clear(fs, group, EXT2_BG_DIRTY);
+			ext2fs_group_desc_csum_set(fs, group);
+			ext2fs_mark_super_dirty(fs);
+		}
+	}
+	log_out(ctx, P_("%s: %u modified block group checked\n",
+			"%s: %u modified block groups checked\n", checked),
+		ctx->device_name, checked);
+out:
+	if (ic.errcode || ic.problem) {
+		if (ic.ino)
+			log_out(ctx, _("%s: inode %u: %s\n"), ctx->device_name,
+				ic.ino, ic.problem ? ic.problem :
+				error_message(ic.errcode));
+		else
+			log_out(ctx, _("%s: group %u: %s\n"),
+				ctx->device_name, group, ic.problem ?
+				ic.problem : error_message(ic.errcode));
+		reason = _(" failed the incremental check");
+	}
+	if (ic.refs)
+		ext2fs_free_icount(ic.refs);
+	if (ic.links)
+		ext2fs_free_icount(ic.links);
+	if (inode)
+		ext2fs_free_mem(&inode);
+	if (block_buf)
+		ext2fs_free_mem(&block_buf);
+	return reason;
+}
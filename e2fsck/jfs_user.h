@@ -41,6 +41,7 @@ struct buffer_head {
 	int		b_err;
 	unsigned int	b_dirty:1;
 	unsigned int	b_uptodate:1;
+	unsigned int	b_replay:1;
 	unsigned long long b_blocknr;
 	char		b_data[1024];
 };
@@ -140,20 +140,301 @@ struct buffer_head *getblk(kdev_t kdev, blk64_t blocknr, int blocksize)
 		bh->b_io = kdev->k_ctx->journal_io;
 	bh->b_size = blocksize;
 	bh->b_blocknr = blocknr;
+	if (kdev->k_dev == K_DEV_FS && kdev->k_ctx->replay_cache)
+		bh->b_replay = 1;
 
 	return bh;
 }
 
+/*
+ * Journal read window
+ *
+ * Recovery walks the log one block at a time, three times over (scan,
+ * revoke and replay passes).  Since the journal is normally contiguous
+ * on disk, a miss reads the next JOURNAL_WINDOW_BYTES of the device in
+ * one request and the following journal blocks are copied out of that
+ * window instead of each costing a separate read.  Any write to the
+ * journal device drops the window.
+ */
+#define JOURNAL_WINDOW_BYTES	(1024 * 1024)
+
+struct journal_window {
+	io_channel		io;
+	unsigned long long	start;
+	unsigned int		count;
+	unsigned int		max;
+	char			*buf;
+};
+
+static void journal_window_invalidate(e2fsck_t ctx, io_channel io,
+				      unsigned long long blk,
+				      unsigned int count)
+{
+	struct journal_window *w = ctx->journal_window;
+
+	if (w && w->io == io && blk < w->start + w->count &&
+	    blk + count > w->start)
+		w->count = 0;
+}
+
+static int journal_window_read(struct buffer_head *bh)
+{
+	e2fsck_t ctx = bh->b_ctx;
+	struct journal_window *w = ctx->journal_window;
+	unsigned long long blk = bh->b_blocknr;
+	unsigned int n;
+	errcode_t retval;
+	errcode_t (*read_error)(io_channel, unsigned long, int, void *,
+				size_t, int, errcode_t);
+
+	if (!w || bh->b_io != w->io || bh->b_size != (int) ctx->fs->blocksize)
+		return 0;
+
+	if (blk < w->start || blk >= w->start + w->count) {
+		n = w->max;
+		if (w->io == ctx->fs->io) {
+			if (blk >= ext2fs_blocks_count(ctx->fs->super))
+				return 0;
+			if (n > ext2fs_blocks_count(ctx->fs->super) - blk)
+				n = ext2fs_blocks_count(ctx->fs->super) - blk;
+		}
+		/*
+		 * The window may extend past the end of the journal, so
+		 * keep errors from the read-ahead out of the io error
+		 * handler and just fall back to reading the block alone.
+		 */
+		w->count = 0;
+		read_error = w->io->read_error;
+		w->io->read_error = 0;
+		retval = io_channel_read_blk64(w->io, blk, n, w->buf);
+		w->io->read_error = read_error;
+		if (retval) {
+			if (w->max > 1)
+				w->max /= 2;
+			return 0;
+		}
+		w->start = blk;
+		w->count = n;
+		jfs_debug(3, "read window %llu-%llu\n", blk, blk + n - 1);
+	}
+	memcpy(bh->b_data, w->buf + (blk - w->start) * bh->b_size,
+	       bh->b_size);
+	return 1;
+}
+
+static void e2fsck_journal_window_init(e2fsck_t ctx)
+{
+	struct journal_window *w;
+
+	if (ext2fs_get_memzero(sizeof(struct journal_window), &w))
+		return;
+	w->io = ctx->journal_io;
+	w->max = JOURNAL_WINDOW_BYTES / ctx->fs->blocksize;
+	if (ext2fs_get_array(w->max, ctx->fs->blocksize, &w->buf)) {
+		ext2fs_free_mem(&w);
+		return;
+	}
+	ctx->journal_window = w;
+}
+
+static void e2fsck_journal_window_release(e2fsck_t ctx)
+{
+	struct journal_window *w = ctx->journal_window;
+
+	if (!w)
+		return;
+	ext2fs_free_mem(&w->buf);
+	ext2fs_free_mem(&w);
+	ctx->journal_window = NULL;
+}
+
+/*
+ * Journal replay cache
+ *
+ * While the journal is being replayed, dirty file system blocks are
+ * not written out when they are released.  Instead they are kept in
+ * a hash table indexed by block number, where a copy from a later
+ * transaction simply replaces the earlier one.  When the replay is
+ * done (or the table fills up) the surviving blocks are sorted and
+ * written out with one write per run of consecutive blocks.  Blocks
+ * that are rewritten by many transactions, such as bitmaps and inode
+ * table blocks, therefore only hit the disk once, and the writes are
+ * issued in disk order.
+ */
+#define REPLAY_CACHE_BYTES	(32 * 1024 * 1024)
+#define REPLAY_MAX_RUN		256
+
+struct replay_cache {
+	struct buffer_head	**table;
+	struct buffer_head	**sorted;
+	char			*run_buf;
+	unsigned int		mask;
+	unsigned int		count;
+	unsigned int		max;
+	errcode_t		err;
+};
+
+static unsigned int replay_hash(struct replay_cache *rc,
+				unsigned long long blocknr)
+{
+	return (unsigned int) ((blocknr * 0x9E3779B97F4A7C15ULL) >> 32) &
+		rc->mask;
+}
+
+static int replay_cmp(const void *a, const void *b)
+{
+	const struct buffer_head *bh_a = *(const struct buffer_head **) a;
+	const struct buffer_head *bh_b = *(const struct buffer_head **) b;
+
+	if (bh_a->b_blocknr < bh_b->b_blocknr)
+		return -1;
+	return bh_a->b_blocknr > bh_b->b_blocknr;
+}
+
+static errcode_t replay_cache_flush(e2fsck_t ctx)
+{
+	struct replay_cache *rc = ctx->replay_cache;
+	struct buffer_head *bh;
+	unsigned int i, n = 0, run;
+	errcode_t retval;
+
+	if (!rc || !rc->count)
+		return rc ? rc->err : 0;
+
+	for (i = 0; i <= rc->mask; i++) {
+		if (rc->table[i]) {
+			rc->sorted[n++] = rc->table[i];
+			rc->table[i] = NULL;
+		}
+	}
+	qsort(rc->sorted, n, sizeof(struct buffer_head *), replay_cmp);
+
+	for (i = 0; i < n; i += run) {
+		bh = rc->sorted[i];
+		for (run = 1; i + run < n && run < REPLAY_MAX_RUN; run++)
+			if (rc->sorted[i + run]->b_blocknr !=
+			    bh->b_blocknr + run)
+				break;
+		jfs_debug(3, "writing blocks %llu-%llu\n", bh->b_blocknr,
+			  bh->b_blocknr + run - 1);
+		journal_window_invalidate(ctx, bh->b_io, bh->b_blocknr, run);
+		if (run == 1) {
+			retval = io_channel_write_blk64(bh->b_io, bh->b_blocknr,
+							1, bh->b_data);
+		} else {
+			unsigned int j;
+
+			for (j = 0; j < run; j++)
+				memcpy(rc->run_buf + j * bh->b_size,
+				       rc->sorted[i + j]->b_data, bh->b_size);
+			retval = io_channel_write_blk64(bh->b_io, bh->b_blocknr,
+							run, rc->run_buf);
+		}
+		if (retval) {
+			com_err(ctx->device_name, retval,
+				_("while writing blocks %llu-%llu"),
+				bh->b_blocknr, bh->b_blocknr + run - 1);
+			rc->err = retval;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		ext2fs_free_mem(&rc->sorted[i]);
+	rc->count = 0;
+	return rc->err;
+}
+
+/*
+ * Take over a dirty buffer being released during journal replay.
+ * Returns 0 if the buffer has to be written out directly.
+ */
+static int replay_cache_add(struct buffer_head *bh)
+{
+	e2fsck_t ctx = bh->b_ctx;
+	struct replay_cache *rc = ctx->replay_cache;
+	unsigned int i;
+
+	if (!rc || bh->b_io != ctx->fs->io ||
+	    bh->b_size != (int) ctx->fs->blocksize)
+		return 0;
+
+	for (i = replay_hash(rc, bh->b_blocknr); rc->table[i];
+	     i = (i + 1) & rc->mask) {
+		if (rc->table[i]->b_blocknr == bh->b_blocknr) {
+			ext2fs_free_mem(&rc->table[i]);
+			rc->table[i] = bh;
+			return 1;
+		}
+	}
+	if (rc->count >= rc->max) {
+		replay_cache_flush(ctx);
+		i = replay_hash(rc, bh->b_blocknr);
+	}
+	rc->table[i] = bh;
+	rc->count++;
+	return 1;
+}
+
+static void e2fsck_replay_cache_init(e2fsck_t ctx)
+{
+	struct replay_cache *rc;
+	unsigned int size;
+	errcode_t retval;
+
+	retval = ext2fs_get_memzero(sizeof(struct replay_cache), &rc);
+	if (retval)
+		return;
+	rc->max = REPLAY_CACHE_BYTES / ctx->fs->blocksize;
+	for (size = 1; size < 2 * rc->max; size <<= 1)
+		;
+	rc->mask = size - 1;
+	retval = ext2fs_get_array(size, sizeof(struct buffer_head *),
+				  &rc->table);
+	if (!retval)
+		retval = ext2fs_get_array(rc->max,
+					  sizeof(struct buffer_head *),
+					  &rc->sorted);
+	if (!retval)
+		retval = ext2fs_get_array(REPLAY_MAX_RUN, ctx->fs->blocksize,
+					  &rc->run_buf);
+	if (retval) {
+		ext2fs_free_mem(&rc->table);
+		ext2fs_free_mem(&rc->sorted);
+		ext2fs_free_mem(&rc);
+		return;
+	}
+	memset(rc->table, 0, size * sizeof(struct buffer_head *));
+	ctx->replay_cache = rc;
+}
+
+static errcode_t e2fsck_replay_cache_release(e2fsck_t ctx)
+{
+	struct replay_cache *rc = ctx->replay_cache;
+	errcode_t retval;
+
+	if (!rc)
+		return 0;
+	retval = replay_cache_flush(ctx);
+	ext2fs_free_mem(&rc->table);
+	ext2fs_free_mem(&rc->sorted);
+	ext2fs_free_mem(&rc->run_buf);
+	ext2fs_free_mem(&rc);
+	ctx->replay_cache = NULL;
+	return retval;
+}
+
 int sync_blockdev(kdev_t kdev)
 {
 	io_channel	io;
+	errcode_t	retval = 0;
 
-	if (kdev->k_dev == K_DEV_FS)
+	if (kdev->k_dev == K_DEV_FS) {
+		retval = replay_cache_flush(kdev->k_ctx);
 		io = kdev->k_ctx->fs->io;
-	else
+	} else
 		io = kdev->k_ctx->journal_io;
 
-	return io_channel_flush(io) ? EIO : 0;
+	return (io_channel_flush(io) || retval) ? EIO : 0;
 }
 
 void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
@@ -164,6 +445,10 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 	for (; nr > 0; --nr) {
 		bh = *bhp++;
 		if (rw == READ && !bh->b_uptodate) {
+			if (journal_window_read(bh)) {
+				bh->b_uptodate = 1;
+				continue;
+			}
 			jfs_debug(3, "reading block %llu/%p\n",
 				  bh->b_blocknr, (void *) bh);
 			retval = io_channel_read_blk64(bh->b_io,
@@ -181,6 +466,8 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 			jfs_debug(3, "writing block %llu/%p\n",
 				  bh->b_blocknr,
 				  (void *) bh);
+			journal_window_invalidate(bh->b_ctx, bh->b_io,
+						  bh->b_blocknr, 1);
 			retval = io_channel_write_blk64(bh->b_io,
 						      bh->b_blocknr,
 						      1, bh->b_data);
@@ -213,6 +500,11 @@ static void mark_buffer_clean(struct buffer_head * bh)
 
 void brelse(struct buffer_head *bh)
 {
+	if (bh->b_dirty && bh->b_replay && replay_cache_add(bh)) {
+		jfs_debug(3, "caching block %llu/%p (total %d)\n",
+			  bh->b_blocknr, (void *) bh, --bh_count);
+		return;
+	}
 	if (bh->b_dirty)
 		ll_rw_block(WRITE, 1, &bh);
 	jfs_debug(3, "freeing block %llu/%p (total %d)\n",
@@ -938,6 +1230,8 @@ static errcode_t recover_ext3_journal(e2fsck_t ctx)
 	if (retval)
 		goto errout;
 
+	e2fsck_journal_window_init(ctx);
+	e2fsck_replay_cache_init(ctx);
 	retval = -journal_recover(journal);
 	if (retval)
 		goto errout;
@@ -952,6 +1246,9 @@ static errcode_t recover_ext3_journal(e2fsck_t ctx)
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 
 errout:
+	/* Blocks replayed before an error still go out, as they used to */
+	e2fsck_replay_cache_release(ctx);
+	e2fsck_journal_window_release(ctx);
 	journal_destroy_revoke(journal);
 	journal_destroy_revoke_caches();
 	e2fsck_journal_release(ctx, journal, 1, 0);
@@ -705,31 +705,23 @@ extern errcode_t e2fsck_setup_icount(e2fsck_t ctx, const char *icount_name,
 				     int flags, ext2_icount_t hint,
 				     ext2_icount_t *ret)
 {
-	unsigned int		threshold;
 	unsigned int		save_type;
 	ext2_ino_t		num_dirs;
 	errcode_t		retval;
 	char			*tdb_dir;
-	int			enable;
-	int			full_map;
 
 	*ret = 0;
 
-	profile_get_string(ctx->profile, "scratch_files", "directory", 0, 0,
-			   &tdb_dir);
-	profile_get_uint(ctx->profile, "scratch_files",
-			 "numdirs_threshold", 0, 0, &threshold);
-	profile_get_boolean(ctx->profile, "scratch_files",
-			    "icount", 0, 1, &enable);
-
 	retval = ext2fs_get_num_dirs(ctx->fs, &num_dirs);
 	if (retval)
 		num_dirs = 1024;	/* Guess */
 
-	if (enable && tdb_dir && !access(tdb_dir, W_OK) &&
-	    (!threshold || num_dirs > threshold)) {
+	tdb_dir = e2fsck_scratch_dir(ctx, "icount", E2F_SPILL_ICOUNT,
+				     num_dirs);
+	if (tdb_dir) {
 		retval = ext2fs_create_icount_tdb(ctx->fs, tdb_dir,
 						  flags, ret);
+		free(tdb_dir);
 		if (retval == 0)
 			return 0;
 	}
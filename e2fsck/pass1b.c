@@ -65,10 +65,28 @@ struct inode_el {
 };
 
 struct dup_cluster {
+	blk64_t		cluster;
 	int		num_bad;
 	struct inode_el *inode_list;
+	struct dup_cluster *hash_next;
 };
 
+/*
+ * The duplicate clusters are kept in a hash table keyed by cluster
+ * number.  Heavily cross-linked filesystems can have millions of
+ * shared clusters, and a lookup is done for every one of them in
+ * pass1b, pass1d and while cloning, so this needs to be cheaper than
+ * a tree walk through a comparison callback.  The table doubles in
+ * size whenever the average chain length exceeds two.
+ */
+struct dup_cluster_hash {
+	struct dup_cluster	**buckets;
+	unsigned int		size_bits;
+	unsigned long		count;
+};
+
+#define DUP_CLUSTER_HASH_MIN_BITS	10
+
 /*
  * This structure stores information about a particular inode which
  * is sharing blocks with other inodes.  This information is collected
@@ -100,7 +118,23 @@ static void pass1d(e2fsck_t ctx, char *block_buf);
 static int dup_inode_count = 0;
 static int dup_inode_founddir = 0;
 
-static dict_t clstr_dict, ino_dict;
+static struct dup_cluster_hash clstr_hash;
+static dict_t ino_dict;
+
+/*
+ * All of the dup_cluster, inode_el, dup_inode and cluster_el records
+ * (and the ino_dict nodes) live until the end of pass 1D, so they are
+ * carved out of one arena and freed in bulk.
+ */
+static struct arena dup_arena;
+
+/*
+ * pass1b adds all duplicate clusters of one inode before moving on to
+ * the next, so remember the last dup_inode record to avoid looking it
+ * up in ino_dict for every cluster.
+ */
+static struct dup_inode *last_dup_inode;
+static ext2_ino_t last_dup_ino;
 
 static ext2fs_inode_bitmap inode_dup_map;
 
@@ -114,6 +148,119 @@ static int dict_int_cmp(const void *a, const void *b)
 	return (ia-ib);
 }
 
+static void *dup_alloc(e2fsck_t ctx, size_t size, const char *description)
+{
+	void *ret;
+
+	ret = arena_alloc(&dup_arena, size);
+	if (!ret) {
+		com_err("dup_alloc", 0,
+			_("Can't allocate %lu bytes for %s\n"),
+			(unsigned long) size, description);
+		fatal_error(ctx, 0);
+	}
+	return ret;
+}
+
+static dnode_t *inode_dnode_alloc(void *context)
+{
+	return dup_alloc((e2fsck_t) context, sizeof(dnode_t),
+			 "duplicate inode node");
+}
+
+static void inode_dnode_free(dnode_t *node,
+			     void *context EXT2FS_ATTR((unused)))
+{
+	arena_free(&dup_arena, node, sizeof(dnode_t));
+}
+
+static inline unsigned long dup_cluster_hashfn(blk64_t cluster,
+					       unsigned int bits)
+{
+	/* 64-bit golden ratio multiplicative hash */
+	return (unsigned long) ((cluster * 0x61C8864680B583EBULL) >>
+				(64 - bits));
+}
+
+static void dup_cluster_hash_init(e2fsck_t ctx)
+{
+	clstr_hash.size_bits = DUP_CLUSTER_HASH_MIN_BITS;
+	clstr_hash.count = 0;
+	clstr_hash.buckets = (struct dup_cluster **)
+		e2fsck_allocate_memory(ctx, sizeof(struct dup_cluster *) <<
+				       clstr_hash.size_bits,
+				       "duplicate cluster hash table");
+}
+
+static struct dup_cluster *dup_cluster_lookup(blk64_t cluster)
+{
+	struct dup_cluster *dc;
+
+	dc = clstr_hash.buckets[dup_cluster_hashfn(cluster,
+						   clstr_hash.size_bits)];
+	for (; dc; dc = dc->hash_next)
+		if (dc->cluster == cluster)
+			return dc;
+	return NULL;
+}
+
+static void dup_cluster_hash_grow(void)
+{
+	struct dup_cluster **new_buckets, *dc, *next;
+	unsigned int new_bits = clstr_hash.size_bits + 1;
+	unsigned long i, h;
+
+	/*
+	 * If we can't get the memory just keep using the current table;
+	 * the chains get longer but everything still works.
+	 */
+	if (ext2fs_get_memzero(sizeof(struct dup_cluster *) << new_bits,
+			       &new_buckets))
+		return;
+	for (i = 0; i < (1UL << clstr_hash.size_bits); i++) {
+		for (dc = clstr_hash.buckets[i]; dc; dc = next) {
+			next = dc->hash_next;
+			h = dup_cluster_hashfn(dc->cluster, new_bits);
+			dc->hash_next = new_buckets[h];
+			new_buckets[h] = dc;
+		}
+	}
+	ext2fs_free_mem(&clstr_hash.buckets);
+	clstr_hash.buckets = new_buckets;
+	clstr_hash.size_bits = new_bits;
+}
+
+static struct dup_cluster *dup_cluster_insert(e2fsck_t ctx, blk64_t cluster)
+{
+	struct dup_cluster *dc;
+	unsigned long h;
+
+	if (clstr_hash.count >= (2UL << clstr_hash.size_bits))
+		dup_cluster_hash_grow();
+
+	dc = (struct dup_cluster *) dup_alloc(ctx,
+		sizeof(struct dup_cluster), "duplicate cluster header");
+	dc->cluster = cluster;
+	dc->num_bad = 0;
+	dc->inode_list = 0;
+	h = dup_cluster_hashfn(cluster, clstr_hash.size_bits);
+	dc->hash_next = clstr_hash.buckets[h];
+	clstr_hash.buckets[h] = dc;
+	clstr_hash.count++;
+	return dc;
+}
+
+/*
+ * Free the duplicate cluster hash table; the records themselves are
+ * freed with the rest of dup_arena.
+ */
+static void dup_cluster_hash_free(void)
+{
+	if (clstr_hash.buckets)
+		ext2fs_free_mem(&clstr_hash.buckets);
+	clstr_hash.count = 0;
+}
+
 /*
  * Add a duplicate block record
  */
@@ -126,28 +273,22 @@ static void add_dupe(e2fsck_t ctx, ext2_ino_t ino, blk64_t cluster,
 	struct cluster_el	*cluster_el;
 	struct inode_el 	*ino_el;
 
-	n = dict_lookup(&clstr_dict, INT_TO_VOIDPTR(cluster));
-	if (n)
-		db = (struct dup_cluster *) dnode_get(n);
-	else {
-		db = (struct dup_cluster *) e2fsck_allocate_memory(ctx,
-			sizeof(struct dup_cluster), "duplicate cluster header");
-		db->num_bad = 0;
-		db->inode_list = 0;
-		dict_alloc_insert(&clstr_dict, INT_TO_VOIDPTR(cluster), db);
-	}
-	ino_el = (struct inode_el *) e2fsck_allocate_memory(ctx,
+	db = dup_cluster_lookup(cluster);
+	if (!db)
+		db = dup_cluster_insert(ctx, cluster);
+	ino_el = (struct inode_el *) dup_alloc(ctx,
 			 sizeof(struct inode_el), "inode element");
 	ino_el->inode = ino;
 	ino_el->next = db->inode_list;
 	db->inode_list = ino_el;
 	db->num_bad++;
 
-	n = dict_lookup(&ino_dict, INT_TO_VOIDPTR(ino));
-	if (n)
+	if (last_dup_inode && last_dup_ino == ino)
+		di = last_dup_inode;
+	else if ((n = dict_lookup(&ino_dict, INT_TO_VOIDPTR(ino))))
 		di = (struct dup_inode *) dnode_get(n);
 	else {
-		di = (struct dup_inode *) e2fsck_allocate_memory(ctx,
+		di = (struct dup_inode *) dup_alloc(ctx,
 			 sizeof(struct dup_inode), "duplicate inode header");
 		if (ino == EXT2_ROOT_INO) {
 			di->dir = EXT2_ROOT_INO;
@@ -160,7 +301,9 @@ static void add_dupe(e2fsck_t ctx, ext2_ino_t ino, blk64_t cluster,
 		di->inode = *inode;
 		dict_alloc_insert(&ino_dict, INT_TO_VOIDPTR(ino), di);
 	}
-	cluster_el = (struct cluster_el *) e2fsck_allocate_memory(ctx,
+	last_dup_inode = di;
+	last_dup_ino = ino;
+	cluster_el = (struct cluster_el *) dup_alloc(ctx,
 			 sizeof(struct cluster_el), "cluster element");
 	cluster_el->cluster = cluster;
 	cluster_el->next = di->cluster_list;
@@ -168,43 +311,6 @@ static void add_dupe(e2fsck_t ctx, ext2_ino_t ino, blk64_t cluster,
 	di->num_dupblocks++;
 }
 
-/*
- * Free a duplicate inode record
- */
-static void inode_dnode_free(dnode_t *node,
-			     void *context EXT2FS_ATTR((unused)))
-{
-	struct dup_inode	*di;
-	struct cluster_el		*p, *next;
-
-	di = (struct dup_inode *) dnode_get(node);
-	for (p = di->cluster_list; p; p = next) {
-		next = p->next;
-		free(p);
-	}
-	free(di);
-	free(node);
-}
-
-/*
- * Free a duplicate cluster record
- */
-static void cluster_dnode_free(dnode_t *node,
-			       void *context EXT2FS_ATTR((unused)))
-{
-	struct dup_cluster	*dc;
-	struct inode_el		*p, *next;
-
-	dc = (struct dup_cluster *) dnode_get(node);
-	for (p = dc->inode_list; p; p = next) {
-		next = p->next;
-		free(p);
-	}
-	free(dc);
-	free(node);
-}
-
-
 /*
  * Main procedure for handling duplicate blocks
  */
@@ -229,9 +335,10 @@ void e2fsck_pass1_dupblocks(e2fsck_t ctx, char *block_buf)
 	}
 
 	dict_init(&ino_dict, DICTCOUNT_T_MAX, dict_int_cmp);
-	dict_init(&clstr_dict, DICTCOUNT_T_MAX, dict_int_cmp);
-	dict_set_allocator(&ino_dict, NULL, inode_dnode_free, NULL);
-	dict_set_allocator(&clstr_dict, NULL, cluster_dnode_free, NULL);
+	dict_set_allocator(&ino_dict, inode_dnode_alloc, inode_dnode_free, ctx);
+	dup_cluster_hash_init(ctx);
+	last_dup_inode = NULL;
+	last_dup_ino = 0;
 
 	init_resource_track(&rtrack, ctx->fs->io);
 	pass1b(ctx, block_buf);
@@ -249,8 +356,10 @@ void e2fsck_pass1_dupblocks(e2fsck_t ctx, char *block_buf)
 	 * Time to free all of the accumulated data structures that we
 	 * don't need anymore.
 	 */
-	dict_free_nodes(&ino_dict);
-	dict_free_nodes(&clstr_dict);
+	dict_init(&ino_dict, DICTCOUNT_T_MAX, dict_int_cmp);
+	dup_cluster_hash_free();
+	arena_release(&dup_arena);
+	last_dup_inode = NULL;
 	ext2fs_free_inode_bitmap(inode_dup_map);
 }
 
@@ -516,11 +625,9 @@ static void pass1d(e2fsck_t ctx, char *block_buf)
 		 * get the list of inodes, and merge them together.
 		 */
 		for (s = p->cluster_list; s; s = s->next) {
-			m = dict_lookup(&clstr_dict,
-					INT_TO_VOIDPTR(s->cluster));
-			if (!m)
+			q = dup_cluster_lookup(s->cluster);
+			if (!q)
 				continue; /* Should never happen... */
-			q = (struct dup_cluster *) dnode_get(m);
 			if (q->num_bad > 1)
 				file_ok = 0;
 			if (check_if_fs_cluster(ctx, s->cluster)) {
@@ -622,7 +729,6 @@ static int delete_file_block(ext2_filsys fs,
 {
 	struct process_block_struct *pb;
 	struct dup_cluster *p;
-	dnode_t	*n;
 	e2fsck_t ctx;
 	blk64_t c, lc;
 
@@ -635,10 +741,9 @@ static int delete_file_block(ext2_filsys fs,
 	c = EXT2FS_B2C(fs, *block_nr);
 	lc = EXT2FS_B2C(fs, blockcnt);
 	if (ext2fs_test_block_bitmap2(ctx->block_dup_map, *block_nr)) {
-		n = dict_lookup(&clstr_dict, INT_TO_VOIDPTR(c));
-		if (n) {
+		p = dup_cluster_lookup(c);
+		if (p) {
 			if (lc != pb->cur_cluster) {
-				p = (struct dup_cluster *) dnode_get(n);
 				decrement_badcount(ctx, *block_nr, p);
 				pb->dup_blocks++;
 			}
@@ -767,7 +872,6 @@ static int clone_file_block(ext2_filsys fs,
 	blk64_t	new_block;
 	errcode_t	retval;
 	struct clone_struct *cs = (struct clone_struct *) priv_data;
-	dnode_t *n;
 	e2fsck_t ctx;
 	blk64_t c;
 	int is_meta = 0;
@@ -788,17 +892,14 @@ static int clone_file_block(ext2_filsys fs,
 	}
 
 	if (ext2fs_test_block_bitmap2(ctx->block_dup_map, *block_nr)) {
-		n = dict_lookup(&clstr_dict,
-				INT_TO_VOIDPTR(EXT2FS_B2C(fs, *block_nr)));
-		if (!n) {
+		p = dup_cluster_lookup(EXT2FS_B2C(fs, *block_nr));
+		if (!p) {
 			com_err("clone_file_block", 0,
 			    _("internal error: can't find dup_blk for %llu\n"),
 				*block_nr);
 			return 0;
 		}
 
-		p = (struct dup_cluster *) dnode_get(n);
-
 		cs->dup_cluster = c;
 		/*
 		 * Let's try an implied cluster allocation.  If we get the same
@@ -922,16 +1023,14 @@ static errcode_t clone_file(e2fsck_t ctx, ext2_ino_t ino,
 		 * which referred to that EA block, and modify
 		 * them to point to the new EA block.
 		 */
-		n = dict_lookup(&clstr_dict,
-				INT_TO_VOIDPTR(EXT2FS_B2C(fs, blk)));
-		if (!n) {
+		dc = dup_cluster_lookup(EXT2FS_B2C(fs, blk));
+		if (!dc) {
 			com_err("clone_file", 0,
 				_("internal error: couldn't lookup EA "
 				  "block record for %llu"), blk);
 			retval = 0; /* OK to stumble on... */
 			goto errout;
 		}
-		dc = (struct dup_cluster *) dnode_get(n);
 		for (ino_el = dc->inode_list; ino_el; ino_el = ino_el->next) {
 			if (ino_el->inode == ino)
 				continue;
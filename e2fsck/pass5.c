@@ -308,6 +308,59 @@ static void print_bitmap_problem(e2fsck_t ctx, problem_t problem,
 #define LE_CLSTR(x, y) (B2C(x) <= B2C(y))
 #define GE_CLSTR(x, y) (B2C(x) >= B2C(y))
 
+/*
+ * Return the number of bytes, starting at byte offset 'off', for which
+ * the two bitmap buffers are identical.  This compares a word at a time
+ * so that pass 5 only needs to look at the individual bits in the parts
+ * of a group that actually differ.
+ */
+static unsigned int bitmap_same_bytes(const char *a, const char *b,
+				      unsigned int off, unsigned int nbytes)
+{
+	unsigned int	i = off;
+	uint64_t	wa, wb;
+
+	while (i < nbytes && (i & 7)) {
+		if (a[i] != b[i])
+			return i - off;
+		i++;
+	}
+	while (i + sizeof(uint64_t) <= nbytes) {
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		if (wa != wb)
+			break;
+		i += sizeof(uint64_t);
+	}
+	while (i < nbytes && a[i] == b[i])
+		i++;
+	return i - off;
+}
+
+/*
+ * Count the bits set in both buffers over nbytes bytes.
+ */
+static unsigned int bitmap_count_and(const char *a, const char *b,
+				     unsigned int nbytes)
+{
+	unsigned int	i, count = 0;
+	uint64_t	wa, wb;
+	unsigned char	c;
+
+	for (i = 0; i + sizeof(uint64_t) <= nbytes; i += sizeof(uint64_t)) {
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		wa &= wb;
+		if (wa)
+			count += ext2fs_bitcount(&wa, sizeof(wa));
+	}
+	for (; i < nbytes; i++) {
+		c = a[i] & b[i];
+		count += ext2fs_bitcount(&c, 1);
+	}
+	return count;
+}
+
 static void check_block_bitmaps(e2fsck_t ctx)
 {
 	ext2_filsys fs = ctx->fs;
@@ -324,6 +377,7 @@ static void check_block_bitmaps(e2fsck_t ctx)
 	int		fixit, had_problem;
 	errcode_t	retval;
 	int	redo_flag = 0;
+	int	cmp_valid = 0;
 	char *actual_buf, *bitmap_buf;
 
 	actual_buf = (char *) e2fsck_allocate_memory(ctx, fs->blocksize,
@@ -372,10 +426,33 @@ redo_counts:
 	for (i = B2C(fs->super->s_first_data_block);
 	     i < ext2fs_blocks_count(fs->super);
 	     i += EXT2FS_CLUSTER_RATIO(fs)) {
-		int first_block_in_bg = (B2C(i) -
-					 B2C(fs->super->s_first_data_block)) %
-			fs->super->s_clusters_per_group == 0;
+		unsigned int bg_off = (B2C(i) -
+				       B2C(fs->super->s_first_data_block)) %
+			fs->super->s_clusters_per_group;
+		int first_block_in_bg = (bg_off == 0);
 		int n, nbytes = fs->super->s_clusters_per_group / 8;
+		unsigned int same;
+
+		/*
+		 * If this group's bitmaps differ somewhere, skip over
+		 * the byte ranges which are identical in both of them.
+		 * The last byte of the group is always checked bit by
+		 * bit, so that the end of group processing below is
+		 * done as usual.
+		 */
+		if (cmp_valid && !first_block_in_bg && (bg_off & 7) == 0) {
+			same = bitmap_same_bytes(actual_buf, bitmap_buf,
+						 bg_off >> 3, nbytes - 1);
+			if (same) {
+				n = ext2fs_bitcount(actual_buf + (bg_off >> 3),
+						    same);
+				group_free += same * 8 - n;
+				free_blocks += same * 8 - n;
+				blocks += same * 8;
+				i += EXT2FS_C2B(fs, same * 8 - 1);
+				continue;
+			}
+		}
 
 		actual = ext2fs_fast_test_block_bitmap2(ctx->block_found_map, i);
 
@@ -389,8 +466,10 @@ redo_counts:
 		 * is that this doesn't work if we are asking e2fsck
 		 * to do a discard operation.
 		 */
-		if (!first_block_in_bg ||
-		    (group == fs->group_desc_count - 1) ||
+		if (!first_block_in_bg)
+			goto no_optimize;
+		cmp_valid = 0;
+		if ((group == fs->group_desc_count - 1) ||
 		    (ctx->options & E2F_OPT_DISCARD))
 			goto no_optimize;
 
@@ -404,8 +483,10 @@ redo_counts:
 				bitmap_buf);
 		if (retval)
 			goto no_optimize;
-		if (memcmp(actual_buf, bitmap_buf, nbytes) != 0)
+		if (memcmp(actual_buf, bitmap_buf, nbytes) != 0) {
+			cmp_valid = 1;
 			goto no_optimize;
+		}
 		n = ext2fs_bitcount(actual_buf, nbytes);
 		group_free = fs->super->s_clusters_per_group - n;
 		free_blocks += group_free;
@@ -523,6 +604,7 @@ redo_counts:
 
 		/* Redo the counts */
 		blocks = 0; free_blocks = 0; group_free = 0; group = 0;
+		cmp_valid = 0;
 		memset(free_array, 0, fs->group_desc_count * sizeof(int));
 		redo_flag++;
 		goto redo_counts;
@@ -579,7 +661,18 @@ static void check_inode_bitmaps(e2fsck_t ctx)
 	int		csum_flag;
 	int		skip_group = 0;
 	int		redo_flag = 0;
+	int		cmp_valid = 0;
 	ext2_ino_t		first_free = fs->super->s_inodes_per_group + 1;
+	unsigned int	nbytes = fs->super->s_inodes_per_group / 8;
+	unsigned int	ino_off, same;
+	char		*actual_buf, *bitmap_buf, *dir_buf;
+
+	actual_buf = (char *) e2fsck_allocate_memory(ctx, nbytes,
+						     "actual bitmap buffer");
+	bitmap_buf = (char *) e2fsck_allocate_memory(ctx, nbytes,
+						     "bitmap block buffer");
+	dir_buf = (char *) e2fsck_allocate_memory(ctx, nbytes,
+						  "directory bitmap buffer");
 
 	clear_problem_context(&pctx);
 	free_array = (ext2_ino_t *) e2fsck_allocate_memory(ctx,
@@ -651,6 +744,47 @@ redo_counts:
 			}
 		}
 
+		/*
+		 * Fetch this group's part of the bitmaps so that the
+		 * ranges which agree can be skipped a word at a time.
+		 * The last byte of the group is always checked bit by
+		 * bit, so the end of group processing is done as usual.
+		 */
+		ino_off = (i - 1) % fs->super->s_inodes_per_group;
+		if (ino_off == 0) {
+			cmp_valid = 0;
+			if (!skip_group &&
+			    !(ctx->options & E2F_OPT_DISCARD) &&
+			    !ext2fs_get_inode_bitmap_range2(ctx->inode_used_map,
+					i, fs->super->s_inodes_per_group,
+					actual_buf) &&
+			    !ext2fs_get_inode_bitmap_range2(fs->inode_map,
+					i, fs->super->s_inodes_per_group,
+					bitmap_buf) &&
+			    !ext2fs_get_inode_bitmap_range2(ctx->inode_dir_map,
+					i, fs->super->s_inodes_per_group,
+					dir_buf))
+				cmp_valid = 1;
+		}
+		if (cmp_valid && !skip_group && (ino_off & 7) == 0) {
+			same = bitmap_same_bytes(actual_buf, bitmap_buf,
+						 ino_off >> 3, nbytes - 1);
+			if (same) {
+				int n;
+
+				n = ext2fs_bitcount(actual_buf + (ino_off >> 3),
+						    same);
+				dirs_count += bitmap_count_and(
+					actual_buf + (ino_off >> 3),
+					dir_buf + (ino_off >> 3), same);
+				group_free += same * 8 - n;
+				free_inodes += same * 8 - n;
+				inodes += same * 8;
+				i += same * 8 - 1;
+				continue;
+			}
+		}
+
 		actual = ext2fs_fast_test_inode_bitmap2(ctx->inode_used_map, i);
 		if (redo_flag)
 			bitmap = actual;
@@ -788,6 +922,7 @@ do_counts:
 		/* redo counts */
 		inodes = 0; free_inodes = 0; group_free = 0;
 		dirs_count = 0; group = 0;
+		cmp_valid = 0;
 		memset(free_array, 0, fs->group_desc_count * sizeof(int));
 		memset(dir_array, 0, fs->group_desc_count * sizeof(int));
 		redo_flag++;
@@ -833,6 +968,9 @@ do_counts:
 errout:
 	ext2fs_free_mem(&free_array);
 	ext2fs_free_mem(&dir_array);
+	ext2fs_free_mem(&actual_buf);
+	ext2fs_free_mem(&bitmap_buf);
+	ext2fs_free_mem(&dir_buf);
 }
 
 static void check_inode_end(e2fsck_t ctx)
@@ -31,6 +31,7 @@ struct region_struct {
 	region_addr_t	max;
 	struct region_el *allocated;
 	struct region_el *last;
+	struct arena	arena;		/* region_el structures */
 };
 
 region_t region_create(region_addr_t min, region_addr_t max)
@@ -44,17 +45,13 @@ region_t region_create(region_addr_t min, region_addr_t max)
 	region->min = min;
 	region->max = max;
 	region->last = NULL;
+	arena_init(&region->arena, 4096);
 	return region;
 }
 
 void region_free(region_t region)
 {
-	struct region_el	*r, *next;
-
-	for (r = region->allocated; r; r = next) {
-		next = r->next;
-		free(r);
-	}
+	arena_release(&region->arena);
 	memset(region, 0, sizeof(struct region_struct));
 	free(region);
 }
@@ -105,7 +102,8 @@ int region_allocate(region_t region, region_addr_t start, int n)
 				if (end == next->start) {
 					r->end = next->end;
 					r->next = next->next;
-					free(next);
+					arena_free(&region->arena, next,
+						   sizeof(struct region_el));
 					if (!r->next)
 						region->last = r;
 					return 0;
@@ -121,7 +119,7 @@ int region_allocate(region_t region, region_addr_t start, int n)
 	 * Insert a new region element structure into the linked list
 	 */
 append_to_list:
-	new_region = malloc(sizeof(struct region_el));
+	new_region = arena_alloc(&region->arena, sizeof(struct region_el));
 	if (!new_region)
 		return -1;
 	new_region->start = start;
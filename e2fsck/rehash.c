@@ -253,6 +253,80 @@ static EXT2_QSORT_TYPE hash_cmp(const void *a, const void *b)
 	return ret;
 }
 
+/*
+ * Directories with at least this many entries are sorted with a radix
+ * sort on the hash values instead of with qsort() and hash_cmp().
+ */
+#define HASH_RADIX_SORT_MIN	256
+
+static inline __u64 hash_entry_key(const struct hash_entry *ent)
+{
+	return ((__u64) ent->hash << 32) | ent->minor_hash;
+}
+
+/*
+ * Sort the hash entries of an indexed directory into the same order
+ * qsort() with hash_cmp() would produce.  Large directories are sorted
+ * with a byte-wise LSD radix sort on the (hash, minor_hash) pair, which
+ * skips the byte positions where all entries agree; runs of entries
+ * whose hashes collide are then put in name order.
+ */
+static void sort_hash_entries(struct hash_entry *harray, int num)
+{
+	unsigned int		count[8][256];
+	unsigned int		*cnt, sum, n;
+	struct hash_entry	*tmp, *src, *dst, *swap;
+	int			i, start, pass, shift, b;
+
+	if (num < HASH_RADIX_SORT_MIN ||
+	    ext2fs_get_array(num, sizeof(struct hash_entry), &tmp)) {
+		qsort(harray, num, sizeof(struct hash_entry), hash_cmp);
+		return;
+	}
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < num; i++) {
+		__u64 key = hash_entry_key(&harray[i]);
+
+		for (pass = 0; pass < 8; pass++)
+			count[pass][(key >> (pass * 8)) & 0xff]++;
+	}
+
+	src = harray;
+	dst = tmp;
+	for (pass = 0; pass < 8; pass++) {
+		shift = pass * 8;
+		cnt = count[pass];
+		if (cnt[(hash_entry_key(src) >> shift) & 0xff] == (unsigned) num)
+			continue;
+		for (b = 0, sum = 0; b < 256; b++) {
+			n = cnt[b];
+			cnt[b] = sum;
+			sum += n;
+		}
+		for (i = 0; i < num; i++) {
+			b = (hash_entry_key(&src[i]) >> shift) & 0xff;
+			dst[cnt[b]++] = src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != harray)
+		memcpy(harray, src, num * sizeof(struct hash_entry));
+	ext2fs_free_mem(&tmp);
+
+	for (start = 0; start < num; start = i) {
+		for (i = start + 1; i < num; i++)
+			if (harray[i].hash != harray[start].hash ||
+			    harray[i].minor_hash != harray[start].minor_hash)
+				break;
+		if (i - start > 1)
+			qsort(harray + start, i - start,
+			      sizeof(struct hash_entry), name_cmp);
+	}
+}
+
 static errcode_t alloc_size_dir(ext2_filsys fs, struct out_dir *outdir,
 				int blocks)
 {
@@ -852,8 +926,7 @@ resort:
 		qsort(fd.harray+2, fd.num_array-2, sizeof(struct hash_entry),
 		      hash_cmp);
 	else
-		qsort(fd.harray, fd.num_array, sizeof(struct hash_entry),
-		      hash_cmp);
+		sort_hash_entries(fd.harray, fd.num_array);
 
 	/*
 	 * Look for duplicates
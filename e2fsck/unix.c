@@ -397,6 +397,8 @@ static void check_if_skip(e2fsck_t ctx)
 			     fs->super->s_checkinterval*2))
 			reason = 0;
 	}
+	if (!reason && (ctx->options & E2F_OPT_INCREMENTAL))
+		reason = e2fsck_check_incremental(ctx);
 	if (reason) {
 		log_out(ctx, "%s", ctx->device_name);
 		log_out(ctx, reason, reason_arg);
@@ -654,7 +656,7 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 	char	*buf, *token, *next, *p, *arg;
 	int	ea_ver;
 	int	extended_usage = 0;
-	unsigned long long reada_kb;
+	unsigned long long reada_kb, budget;
 
 	buf = string_copy(ctx, opts, 0);
 	for (token = buf; token && *token; token = next) {
@@ -735,6 +737,46 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 		} else if (strcmp(token, "fixes_only") == 0) {
 			ctx->options |= E2F_OPT_FIXES_ONLY;
 			continue;
+		} else if (strcmp(token, "checkpoint") == 0) {
+			if (!arg)
+				extended_usage++;
+			else
+				ctx->checkpoint_file = string_copy(ctx, arg, 0);
+			continue;
+		} else if (strcmp(token, "resume") == 0) {
+			ctx->options |= E2F_OPT_RESUME;
+			continue;
+		} else if (strcmp(token, "incremental") == 0) {
+			ctx->options |= E2F_OPT_INCREMENTAL;
+			continue;
+		} else if (strcmp(token, "mem_budget") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			budget = strtoull(arg, &p, 0);
+			switch (*p) {
+			case 'k': case 'K':
+				budget <<= 10;
+				p++;
+				break;
+			case 'm': case 'M':
+				budget <<= 20;
+				p++;
+				break;
+			case 'g': case 'G':
+				budget <<= 30;
+				p++;
+				break;
+			}
+			if (*p || budget == 0) {
+				fprintf(stderr, "%s",
+					_("Invalid memory budget.\n"));
+				extended_usage++;
+				continue;
+			}
+			ctx->mem_budget = budget;
+			continue;
 		} else {
 			fprintf(stderr, _("Unknown extended option: %s\n"),
 				token);
@@ -743,6 +785,12 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 	}
 	free(buf);
 
+	if ((ctx->options & E2F_OPT_RESUME) && !ctx->checkpoint_file) {
+		fprintf(stderr, "%s", _("The resume option requires a "
+					"checkpoint file.\n"));
+		extended_usage++;
+	}
+
 	if (extended_usage) {
 		fputs(_("\nExtended options are separated by commas, "
 		       "and may take an argument which\n"
@@ -760,6 +808,10 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 		fputs(_("\treadahead_kb=<buffer size>\n"), stderr);
 		fputs("\tbmap2extent\n", stderr);
 		fputs("\tfixes_only\n", stderr);
+		fputs(_("\tcheckpoint=<checkpoint file>\n"), stderr);
+		fputs("\tresume\n", stderr);
+		fputs("\tincremental\n", stderr);
+		fputs(_("\tmem_budget=<bytes>[KMG]\n"), stderr);
 		fputc('\n', stderr);
 		exit(1);
 	}
@@ -1364,6 +1416,7 @@ int main (int argc, char *argv[])
 	int flags, run_result, was_changed;
 	int journal_size;
 	int sysval, sys_page_size = 4096;
+	dgrp_t group;
 	int old_bitmaps;
 	__u32 features[3];
 	char *cp;
@@ -1774,11 +1827,14 @@ print_unsupp_features:
 
 	if (ctx->superblock)
 		set_latch_flags(PR_LATCH_RELOC, PRL_LATCHED, 0);
+	if (ctx->checkpoint_file)
+		ctx->sb_fingerprint = e2fsck_sb_fingerprint(fs);
 	ext2fs_mark_valid(fs);
 	check_super_block(ctx);
 	if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 		fatal_error(ctx, 0);
 	check_if_skip(ctx);
+	e2fsck_plan_memory(ctx);
 	check_resize_inode(ctx);
 	if (bad_blocks_file)
 		read_bad_blocks_file(ctx, bad_blocks_file, replace_bad_blocks);
@@ -1822,6 +1878,12 @@ print_unsupp_features:
 		}
 	}
 
+	if (ctx->options & E2F_OPT_RESUME) {
+		ctx->checkpoint_pass = e2fsck_read_checkpoint(ctx);
+		/* The checkpoint is stale once the check restarts */
+		ctx->options &= ~E2F_OPT_RESUME;
+	}
+
 	run_result = e2fsck_run(ctx);
 	e2fsck_clear_progbar(ctx);
 
@@ -1912,6 +1974,11 @@ no_journal:
 		if (!(ctx->flags & E2F_FLAG_TIME_INSANE))
 			sb->s_lastcheck = ctx->now;
 		sb->s_mnt_count = 0;
+		if (ext2fs_test_valid(fs)) {
+			for (group = 0; group < fs->group_desc_count; group++)
+				ext2fs_bg_flags_clear(fs, group,
+						      EXT2_BG_DIRTY);
+		}
 		memset(((char *) sb) + EXT4_S_ERR_START, 0, EXT4_S_ERR_LEN);
 		pctx.errcode = ext2fs_set_gdt_csum(ctx->fs);
 		if (pctx.errcode)
@@ -379,6 +379,7 @@ void init_resource_track(struct resource_track *track, io_channel channel)
 #endif
 	io_stats io_start = 0;
 
+	arena_reset_peak();
 	track->brk_start = sbrk(0);
 	gettimeofday(&track->time_start, 0);
 #ifdef HAVE_GETRUSAGE
@@ -425,6 +426,7 @@ void print_resource_track(e2fsck_t ctx, const char *desc,
 	struct mallinfo	malloc_info;
 #endif
 	struct timeval time_end;
+	unsigned long long arena_peak, arena_max_peak;
 
 	if ((desc && !(ctx->options & E2F_OPT_TIME2)) ||
 	    (!desc && !(ctx->options & E2F_OPT_TIME)))
@@ -448,6 +450,14 @@ void print_resource_track(e2fsck_t ctx, const char *desc,
 		(unsigned long) (((char *) sbrk(0)) -
 				 ((char *) track->brk_start)));
 #endif
+	/*
+	 * For a pass this is the arena high water mark since the pass
+	 * started; the global track reports it for the whole run.
+	 */
+	arena_usage(NULL, &arena_peak, &arena_max_peak);
+	if (track == &ctx->global_rtrack)
+		arena_peak = arena_max_peak;
+	log_out(ctx, _("arena peak: %lluk, "), (arena_peak + 1023) / 1024);
 #ifdef HAVE_GETRUSAGE
 	getrusage(RUSAGE_SELF, &r);
 
@@ -782,6 +792,27 @@ errcode_t e2fsck_mmp_update(ext2_filsys fs)
 	return retval;
 }
 
+/*
+ * The bitmaps counted by e2fsck_plan_memory(); the memory budget only
+ * overrides the type of these.  The others (bad, dup, ea, ...) are
+ * usually sparse, so they keep their default type.
+ */
+static const char *budget_bitmaps[] = {
+	"fs_bitmaps", "block_found_map", "block_metadata_map",
+	"inode_used_map", "inode_dir_map", "inode_reg_map",
+	"inode_link_info", "inode_count", NULL
+};
+
+static int budget_bitmap(const char *profile_name)
+{
+	const char **cpp;
+
+	for (cpp = budget_bitmaps; *cpp; cpp++)
+		if (!strcmp(*cpp, profile_name))
+			return 1;
+	return 0;
+}
+
 void e2fsck_set_bitmap_type(ext2_filsys fs, unsigned int default_type,
 			    const char *profile_name, unsigned int *old_type)
 {
@@ -791,8 +822,10 @@ void e2fsck_set_bitmap_type(ext2_filsys fs, unsigned int default_type,
 	if (old_type)
 		*old_type = fs->default_bitmap_type;
 	profile_get_uint(ctx->profile, "bitmaps", profile_name, 0,
-			 default_type, &type);
+			 0, &type);
 	profile_get_uint(ctx->profile, "bitmaps", "all", 0, type, &type);
+	if (!type && ctx->budget_bitmap_type && budget_bitmap(profile_name))
+		type = ctx->budget_bitmap_type;
 	fs->default_bitmap_type = type ? type : default_type;
 }
 
@@ -838,6 +871,223 @@ errcode_t e2fsck_allocate_subcluster_bitmap(ext2_filsys fs, const char *descr,
 	return retval;
 }
 
+/*
+ * Return the directory in which to keep the scratch file for the
+ * "icount" or "dirinfo" structure, or NULL if it should be kept in
+ * memory.  The caller must free the returned string.  When the memory
+ * budget made us spill the structure and e2fsck.conf does not name a
+ * scratch directory, $TMPDIR or /var/tmp is used.
+ */
+char *e2fsck_scratch_dir(e2fsck_t ctx, const char *name, int spill,
+			 ext2_ino_t num_dirs)
+{
+	unsigned int	threshold;
+	char		*tdb_dir, *tmp;
+	int		enable;
+
+	profile_get_string(ctx->profile, "scratch_files", "directory", 0, 0,
+			   &tdb_dir);
+	profile_get_uint(ctx->profile, "scratch_files",
+			 "numdirs_threshold", 0, 0, &threshold);
+	profile_get_boolean(ctx->profile, "scratch_files",
+			    name, 0, 1, &enable);
+
+	if (ctx->scratch_spill & spill) {
+		threshold = 0;
+		if (!tdb_dir) {
+			tmp = getenv("TMPDIR");
+			tdb_dir = strdup(tmp && *tmp ? tmp : "/var/tmp");
+		}
+	}
+	if (!enable || !tdb_dir || access(tdb_dir, W_OK) ||
+	    (threshold && num_dirs <= threshold)) {
+		free(tdb_dir);
+		return NULL;
+	}
+	return tdb_dir;
+}
+
+/*
+ * Bitmaps allocated for the whole run: fs->block_map, block_found_map
+ * and block_metadata_map; fs->inode_map, inode_used_map, inode_dir_map,
+ * inode_reg_map and the bitmaps of the two inode count structures.
+ */
+#define BUDGET_BLOCK_BITMAPS	3
+#define BUDGET_INODE_BITMAPS	6
+
+/*
+ * The roaring bitmaps keep each 64k bit chunk in a container which
+ * takes nothing when it is empty or full, up to four bytes per set bit
+ * as an array or run list, and 8k as a bit array.  Bit arrays are
+ * never converted back while bits are only being set, so that is what
+ * a chunk with more than 2048 bits set has to be budgeted for.
+ */
+#define BUDGET_RR_CHUNK_BITS	16
+#define BUDGET_RR_HEADER	16
+#define BUDGET_RR_SMALL		2048
+
+/*
+ * Upper bound of the size of a roaring bitmap of nbits bits, whose
+ * groups of per_group bits have the number of bits set given by the
+ * group descriptors.  None of the counted bitmaps has more bits set
+ * than the in-use blocks or inodes.
+ */
+static unsigned long long budget_roaring(ext2_filsys fs, __u64 nbits,
+					 __u64 per_group, int inodes)
+{
+	unsigned long long	size = 0;
+	__u64			*used, first, last, n, c, nchunks;
+	char			*full;
+	dgrp_t			g;
+
+	nchunks = (nbits >> BUDGET_RR_CHUNK_BITS) + 1;
+	if (ext2fs_get_arrayzero(nchunks, sizeof(__u64), &used))
+		return nbits / 8;
+	if (ext2fs_get_array(nchunks, 1, &full)) {
+		ext2fs_free_mem(&used);
+		return nbits / 8;
+	}
+	memset(full, 1, nchunks);
+
+	for (g = 0; g < fs->group_desc_count; g++) {
+		first = g * per_group;
+		if (first >= nbits)
+			break;
+		last = first + per_group - 1;
+		if (last >= nbits)
+			last = nbits - 1;
+		n = inodes ? ext2fs_bg_free_inodes_count(fs, g) :
+			ext2fs_bg_free_blocks_count(fs, g);
+		n = n < last - first + 1 ? last - first + 1 - n : 0;
+		/* A group which straddles two chunks counts in both */
+		for (c = first >> BUDGET_RR_CHUNK_BITS;
+		     c <= last >> BUDGET_RR_CHUNK_BITS; c++) {
+			used[c] += n;
+			if (n < last - first + 1)
+				full[c] = 0;
+		}
+	}
+	/* The last chunk is partial, so it can never be full */
+	full[nbits >> BUDGET_RR_CHUNK_BITS] = 0;
+
+	for (c = 0; c < nchunks; c++) {
+		size += BUDGET_RR_HEADER;
+		if (used[c] == 0 || full[c])
+			continue;
+		if (used[c] <= BUDGET_RR_SMALL)
+			size += 4 * used[c];
+		else
+			size += 1 << (BUDGET_RR_CHUNK_BITS - 3);
+	}
+	ext2fs_free_mem(&full);
+	ext2fs_free_mem(&used);
+	return size;
+}
+
+/*
+ * Pick the bitmap, inode count and directory information backends so
+ * that e2fsck stays within -E mem_budget.  The estimate only uses the
+ * superblock and group descriptor counts, so it is available before
+ * pass 1 allocates anything:
+ *
+ *	- if everything fits as plain bit arrays, use those since they
+ *	  are the fastest;
+ *	- otherwise use the roaring bitmaps if the in-use counts say
+ *	  they will be smaller, drop the inode count full map, and if
+ *	  that still is not enough, move the directory information and
+ *	  then the inode counts to tdb scratch files.
+ *
+ * Only the bitmaps listed in budget_bitmaps[] are counted, and only
+ * their type is changed.
+ */
+void e2fsck_plan_memory(e2fsck_t ctx)
+{
+	ext2_filsys		fs = ctx->fs;
+	unsigned long long	bitmaps, rr_bitmaps, icount, dirinfo, total;
+	ext2_ino_t		num_dirs;
+	__u64			nclusters;
+	char			*dir;
+
+	if (!ctx->mem_budget)
+		return;
+	if (ext2fs_get_num_dirs(fs, &num_dirs))
+		num_dirs = 1024;	/* Guess */
+
+	bitmaps = BUDGET_BLOCK_BITMAPS *
+		(EXT2FS_B2C(fs, ext2fs_blocks_count(fs->super)) / 8) +
+		BUDGET_INODE_BITMAPS * (fs->super->s_inodes_count / 8);
+	/* Directories and hard linked files need a count list entry */
+	icount = 2ULL * num_dirs * 2 * (sizeof(ext2_ino_t) + sizeof(__u32));
+	if (ctx->options & E2F_OPT_ICOUNT_FULLMAP)
+		icount += 2ULL * fs->super->s_inodes_count * sizeof(__u16);
+	dirinfo = (unsigned long long) num_dirs * sizeof(struct dir_info);
+	/* Plus at least one directory block list entry per directory */
+	total = (unsigned long long) num_dirs * sizeof(struct ext2_db_entry2) +
+		bitmaps + icount + dirinfo;
+
+	ctx->budget_bitmap_type = EXT2FS_BMAP64_BITARRAY;
+	if (total <= ctx->mem_budget)
+		return;
+
+	nclusters = EXT2FS_B2C(fs, ext2fs_blocks_count(fs->super) -
+			       fs->super->s_first_data_block);
+	rr_bitmaps = BUDGET_BLOCK_BITMAPS *
+		budget_roaring(fs, nclusters,
+			       fs->super->s_clusters_per_group, 0) +
+		BUDGET_INODE_BITMAPS *
+		budget_roaring(fs, fs->super->s_inodes_count,
+			       fs->super->s_inodes_per_group, 1);
+	if (rr_bitmaps < bitmaps) {
+		ctx->budget_bitmap_type = EXT2FS_BMAP64_ROARING;
+		total -= bitmaps - rr_bitmaps;
+	}
+
+	if (total > ctx->mem_budget &&
+	    (ctx->options & E2F_OPT_ICOUNT_FULLMAP)) {
+		log_out(ctx, _("%s: not using the inode count full map to "
+			       "stay within the memory budget\n"),
+			ctx->device_name);
+		ctx->options &= ~E2F_OPT_ICOUNT_FULLMAP;
+		icount -= 2ULL * fs->super->s_inodes_count * sizeof(__u16);
+		total -= 2ULL * fs->super->s_inodes_count * sizeof(__u16);
+	}
+#ifdef CONFIG_TDB
+	if (total > ctx->mem_budget) {
+		ctx->scratch_spill |= E2F_SPILL_DIRINFO;
+		dir = e2fsck_scratch_dir(ctx, "dirinfo", E2F_SPILL_DIRINFO,
+					 num_dirs);
+		if (dir)
+			total -= dirinfo;
+		else
+			ctx->scratch_spill &= ~E2F_SPILL_DIRINFO;
+		free(dir);
+	}
+	if (total > ctx->mem_budget) {
+		ctx->scratch_spill |= E2F_SPILL_ICOUNT;
+		dir = e2fsck_scratch_dir(ctx, "icount", E2F_SPILL_ICOUNT,
+					 num_dirs);
+		if (dir)
+			total -= icount;
+		else
+			ctx->scratch_spill &= ~E2F_SPILL_ICOUNT;
+		free(dir);
+	}
+	if (ctx->scratch_spill)
+		log_out(ctx, _("%s: keeping %s in scratch files to stay "
+			       "within the memory budget\n"),
+			ctx->device_name,
+			ctx->scratch_spill == E2F_SPILL_DIRINFO ?
+			_("directory information") :
+			ctx->scratch_spill == E2F_SPILL_ICOUNT ?
+			_("inode counts") :
+			_("inode counts and directory information"));
+#endif
+	if (total > ctx->mem_budget)
+		log_out(ctx, _("%s: estimated memory use of %llu bytes "
+			       "exceeds the memory budget of %llu bytes\n"),
+			ctx->device_name, total, ctx->mem_budget);
+}
+
 /* Return memory size in bytes */
 unsigned long long get_memory_size(void)
 {
@@ -13,9 +13,11 @@ libext2fs_src_files := \
 	bitops.c \
 	blkmap64_ba.c \
 	blkmap64_rb.c \
+	blkmap64_rr.c \
 	blknum.c \
 	block.c \
 	bmap.c \
+	bmap_summary.c \
 	check_desc.c \
 	crc16.c \
 	crc32c.c \
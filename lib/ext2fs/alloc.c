@@ -29,6 +29,13 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+/*
+ * Block bitmaps with at least this many clusters get a free space
+ * summary on their first allocation, so that searches can skip over
+ * full regions (see bmap_summary.c).
+ */
+#define ALLOC_SUMMARY_MIN_CLUSTERS	(1ULL << 18)
+
 #undef DEBUG
 
 #ifdef DEBUG
@@ -141,9 +148,16 @@ errcode_t ext2fs_new_inode(ext2_filsys fs, ext2_ino_t dir,
 	return 0;
 }
 
+static void alloc_summary_setup(ext2_filsys fs, ext2fs_block_bitmap map)
+{
+	if (EXT2FS_NUM_B2C(fs, ext2fs_blocks_count(fs->super)) >=
+	    ALLOC_SUMMARY_MIN_CLUSTERS)
+		(void) ext2fs_enable_generic_bmap_summary(map);
+}
+
 /*
  * Stupid algorithm --- we now just search forward starting from the
- * goal.  Should put in a smarter one someday....
+ * goal, skipping full regions of large bitmaps with their summary.
  */
 errcode_t ext2fs_new_block2(ext2_filsys fs, blk64_t goal,
 			   ext2fs_block_bitmap map, blk64_t *ret)
@@ -174,12 +188,13 @@ errcode_t ext2fs_new_block2(ext2_filsys fs, blk64_t goal,
 	if (!goal || (goal >= ext2fs_blocks_count(fs->super)))
 		goal = fs->super->s_first_data_block;
 	goal &= ~EXT2FS_CLUSTER_MASK(fs);
+	alloc_summary_setup(fs, map);
 
-	retval = ext2fs_find_first_zero_block_bitmap2(map,
-			goal, ext2fs_blocks_count(fs->super) - 1, &b);
+	retval = ext2fs_find_first_zero_run_generic_bmap(map,
+			goal, ext2fs_blocks_count(fs->super) - 1, 1, &b);
 	if ((retval == ENOENT) && (goal != fs->super->s_first_data_block))
-		retval = ext2fs_find_first_zero_block_bitmap2(map,
-			fs->super->s_first_data_block, goal - 1, &b);
+		retval = ext2fs_find_first_zero_run_generic_bmap(map,
+			fs->super->s_first_data_block, goal - 1, 1, &b);
 allocated:
 	if (retval == ENOENT)
 		return EXT2_ET_BLOCK_ALLOC_FAIL;
@@ -414,12 +429,14 @@ errcode_t ext2fs_new_range(ext2_filsys fs, int flags, blk64_t goal,
 		return EXT2_ET_NO_BLOCK_BITMAP;
 	if (!goal || goal >= ext2fs_blocks_count(fs->super))
 		goal = fs->super->s_first_data_block;
+	alloc_summary_setup(fs, map);
 
 	start = goal;
 	while (!looped || start <= goal) {
-		retval = ext2fs_find_first_zero_block_bitmap2(map, start,
-							      max_blocks - 1,
-							      &start);
+		retval = ext2fs_find_first_zero_run_generic_bmap(map, start,
+				max_blocks - 1,
+				(flags & EXT2_NEWRANGE_MIN_LENGTH) ? len : 1,
+				&start);
 		if (retval == ENOENT) {
 			/*
 			 * If there are no free blocks beyond the starting
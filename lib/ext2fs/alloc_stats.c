@@ -15,6 +15,38 @@
 #include "ext2_fs.h"
 #include "ext2fs.h"
 
+/*
+ * If the file system has asked for it, remember which block groups
+ * were modified since the last full check, so that "e2fsck -E
+ * incremental" only has to look at those groups.
+ */
+void ext2fs_mark_group_dirty(ext2_filsys fs, dgrp_t group)
+{
+	if (!(fs->super->s_flags & EXT2_FLAGS_TRACK_DIRTY) ||
+	    !(fs->flags & EXT2_FLAG_RW) || !fs->group_desc ||
+	    group >= fs->group_desc_count ||
+	    ext2fs_bg_flags_test(fs, group, EXT2_BG_DIRTY))
+		return;
+	ext2fs_bg_flags_set(fs, group, EXT2_BG_DIRTY);
+	ext2fs_group_desc_csum_set(fs, group);
+	ext2fs_mark_super_dirty(fs);
+}
+
+void ext2fs_mark_inode_group_dirty(ext2_filsys fs, ext2_ino_t ino)
+{
+	if (ino == 0 || ino > fs->super->s_inodes_count)
+		return;
+	ext2fs_mark_group_dirty(fs, ext2fs_group_of_ino(fs, ino));
+}
+
+void ext2fs_mark_block_group_dirty(ext2_filsys fs, blk64_t blk)
+{
+	if (blk < fs->super->s_first_data_block ||
+	    blk >= ext2fs_blocks_count(fs->super))
+		return;
+	ext2fs_mark_group_dirty(fs, ext2fs_group_of_blk2(fs, blk));
+}
+
 void ext2fs_inode_alloc_stats2(ext2_filsys fs, ext2_ino_t ino,
 			       int inuse, int isdir)
 {
@@ -49,6 +81,7 @@ void ext2fs_inode_alloc_stats2(ext2_filsys fs, ext2_ino_t ino,
 	}
 
 	fs->super->s_free_inodes_count -= inuse;
+	ext2fs_mark_group_dirty(fs, group);
 	ext2fs_mark_super_dirty(fs);
 	ext2fs_mark_ib_dirty(fs);
 }
@@ -76,6 +109,7 @@ void ext2fs_block_alloc_stats2(ext2_filsys fs, blk64_t blk, int inuse)
 	ext2fs_bg_free_blocks_count_set(fs, group, ext2fs_bg_free_blocks_count(fs, group) - inuse);
 	ext2fs_bg_flags_clear(fs, group, EXT2_BG_BLOCK_UNINIT);
 	ext2fs_group_desc_csum_set(fs, group);
+	ext2fs_mark_group_dirty(fs, group);
 
 	ext2fs_free_blocks_count_add(fs->super,
 			     -inuse * (blk64_t) EXT2FS_CLUSTER_RATIO(fs));
@@ -139,6 +173,7 @@ void ext2fs_block_alloc_stats_range(ext2_filsys fs, blk64_t blk,
 			inuse*n/EXT2FS_CLUSTER_RATIO(fs));
 		ext2fs_bg_flags_clear(fs, group, EXT2_BG_BLOCK_UNINIT);
 		ext2fs_group_desc_csum_set(fs, group);
+		ext2fs_mark_group_dirty(fs, group);
 		ext2fs_free_blocks_count_add(fs->super, -inuse * (blk64_t) n);
 		blk += n;
 		num -= n;
@@ -275,8 +275,9 @@ errcode_t ext2fs_allocate_dup_inode_tables(ext2_filsys fs, dgrp_t group, int whi
 	if (!ext2fs_has_feature_fyp(fs->super))
 		return 0;
 
+	/* The last group never holds duplicates, unless it is the only one */
 	last_grp = fs->group_desc_count - 1;
-	dup_grp = (group + which) % last_grp;
+	dup_grp = last_grp ? (group + which) % last_grp : 0;
 	group_blk_dup = ext2fs_group_first_block2(fs, dup_grp);
 	last_blk_dup = ext2fs_group_last_block2(fs, dup_grp);
 
@@ -329,6 +330,14 @@ errcode_t ext2fs_allocate_tables(ext2_filsys fs)
 								fs->block_map);
 				if (retval)
 					return retval;
+				/*
+				 * Unlike the primary tables, the duplicates
+				 * are not part of the group overhead that
+				 * ext2fs_initialize() subtracted.
+				 */
+				ext2fs_block_alloc_stats_range(fs,
+					ext2fs_dup_inode_table_loc(fs, i, j),
+					fs->inode_blocks_per_group, +1);
 			}
 		}
 	}
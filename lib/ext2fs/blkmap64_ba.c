@@ -16,6 +16,7 @@
 #include <unistd.h>
 #endif
 #include <fcntl.h>
+#include <stdlib.h>
 #include <time.h>
 #if HAVE_SYS_STAT_H
 #include <sys/stat.h>
@@ -323,152 +324,278 @@ static void ba_print_stats(ext2fs_generic_bitmap bitmap EXT2FS_ATTR((unused)))
 }
 #endif
 
-/* Find the first zero bit between start and end, inclusive. */
-static errcode_t ba_find_first_zero(ext2fs_generic_bitmap bitmap,
-				    __u64 start, __u64 end, __u64 *out)
+/*
+ * Return the number of leading bytes of p[0..nbytes) that are all
+ * equal to fill, stopping at the first 32-byte block that isn't
+ * uniform.  The caller finishes the job byte by byte, so the result
+ * only needs to be a multiple of 32 that doesn't overshoot.
+ */
+static size_t ba_skip_generic(const unsigned char *p, size_t nbytes,
+			      unsigned char fill)
 {
-	ext2fs_ba_private bp = (ext2fs_ba_private)bitmap->private;
-	unsigned long bitpos = start - bitmap->start;
-	unsigned long count = end - start + 1;
-	int byte_found = 0; /* whether a != 0xff byte has been found */
-	const unsigned char *pos;
-	unsigned long max_loop_count, i;
+	const unsigned char *start = p;
+	__u64 w = fill ? ~0ULL : 0;
+
+	while (nbytes && ((uintptr_t) p & 7)) {
+		if (*p != fill)
+			return p - start;
+		p++;
+		nbytes--;
+	}
+	while (nbytes >= 32) {
+		if (((const __u64 *) p)[0] != w ||
+		    ((const __u64 *) p)[1] != w ||
+		    ((const __u64 *) p)[2] != w ||
+		    ((const __u64 *) p)[3] != w)
+			break;
+		p += 32;
+		nbytes -= 32;
+	}
+	return p - start;
+}
 
-	/* scan bits until we hit a byte boundary */
-	while ((bitpos & 0x7) != 0 && count > 0) {
-		if (!ext2fs_test_bit64(bitpos, bp->bitarray)) {
-			*out = bitpos + bitmap->start;
-			return 0;
-		}
-		bitpos++;
-		count--;
+/* Count the bits set in p[0..nbytes) */
+static __u64 ba_count_generic(const unsigned char *p, size_t nbytes)
+{
+	__u64 count = 0;
+
+	while (nbytes && ((uintptr_t) p & 3)) {
+		count += ext2fs_bitcount(p++, 1);
+		nbytes--;
 	}
+	/* ext2fs_bitcount() takes an unsigned int length */
+	while (nbytes) {
+		size_t n = nbytes > (1U << 30) ? (1U << 30) : nbytes;
 
-	if (!count)
-		return ENOENT;
+		count += ext2fs_bitcount(p, n);
+		p += n;
+		nbytes -= n;
+	}
+	return count;
+}
 
-	pos = ((unsigned char *)bp->bitarray) + (bitpos >> 3);
-	/* scan bytes until 8-byte (64-bit) aligned */
-	while (count >= 8 && (((uintptr_t)pos) & 0x07)) {
-		if (*pos != 0xff) {
-			byte_found = 1;
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_BA_SIMD
+#include <immintrin.h>
+
+/* SSE2 is part of the x86_64 baseline, so this needs no check */
+static size_t ba_skip_sse2(const unsigned char *p, size_t nbytes,
+			   unsigned char fill)
+{
+	const unsigned char *start = p;
+	__m128i f = _mm_set1_epi8((char) fill);
+	__m128i a, b;
+
+	while (nbytes >= 32) {
+		a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), f);
+		b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 16)),
+				   f);
+		if (_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xffff)
 			break;
-		}
-		pos++;
-		count -= 8;
-		bitpos += 8;
+		p += 32;
+		nbytes -= 32;
 	}
+	return p - start;
+}
 
-	if (!byte_found) {
-		max_loop_count = count >> 6; /* 8-byte blocks */
-		i = max_loop_count;
-		while (i) {
-			if (*((const __u64 *)pos) != ((__u64)-1))
-				break;
-			pos += 8;
-			i--;
-		}
-		count -= 64 * (max_loop_count - i);
-		bitpos += 64 * (max_loop_count - i);
-
-		max_loop_count = count >> 3;
-		i = max_loop_count;
-		while (i) {
-			if (*pos != 0xff) {
-				byte_found = 1;
-				break;
-			}
-			pos++;
-			i--;
-		}
-		count -= 8 * (max_loop_count - i);
-		bitpos += 8 * (max_loop_count - i);
+__attribute__((target("avx2")))
+static size_t ba_skip_avx2(const unsigned char *p, size_t nbytes,
+			   unsigned char fill)
+{
+	const unsigned char *start = p;
+	__m256i f = _mm256_set1_epi8((char) fill);
+	__m256i a;
+
+	while (nbytes >= 128) {
+		/* Four vectors per step to keep the loads in flight */
+		a = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(
+					(const __m256i *) p), f),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(
+					(const __m256i *) (p + 32)), f)),
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(
+					(const __m256i *) (p + 64)), f),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(
+					(const __m256i *) (p + 96)), f)));
+		if (_mm256_movemask_epi8(a) != -1)
+			break;
+		p += 128;
+		nbytes -= 128;
 	}
+	while (nbytes >= 32) {
+		a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p),
+				      f);
+		if (_mm256_movemask_epi8(a) != -1)
+			break;
+		p += 32;
+		nbytes -= 32;
+	}
+	return p - start;
+}
 
-	/* Here either count < 8 or byte_found == 1. */
-	while (count-- > 0) {
-		if (!ext2fs_test_bit64(bitpos, bp->bitarray)) {
-			*out = bitpos + bitmap->start;
-			return 0;
-		}
-		bitpos++;
+__attribute__((target("popcnt")))
+static __u64 ba_count_popcnt(const unsigned char *p, size_t nbytes)
+{
+	__u64 c0 = 0, c1 = 0, c2 = 0, c3 = 0, w;
+
+	while (nbytes && ((uintptr_t) p & 7)) {
+		c0 += __builtin_popcount(*p++);
+		nbytes--;
+	}
+	while (nbytes >= 32) {
+		c0 += __builtin_popcountll(((const __u64 *) p)[0]);
+		c1 += __builtin_popcountll(((const __u64 *) p)[1]);
+		c2 += __builtin_popcountll(((const __u64 *) p)[2]);
+		c3 += __builtin_popcountll(((const __u64 *) p)[3]);
+		p += 32;
+		nbytes -= 32;
 	}
+	while (nbytes >= 8) {
+		memcpy(&w, p, 8);
+		c0 += __builtin_popcountll(w);
+		p += 8;
+		nbytes -= 8;
+	}
+	while (nbytes--)
+		c0 += __builtin_popcount(*p++);
+	return c0 + c1 + c2 + c3;
+}
 
-	return ENOENT;
+static size_t ba_skip_select(const unsigned char *p, size_t nbytes,
+			     unsigned char fill);
+static __u64 ba_count_select(const unsigned char *p, size_t nbytes);
+
+static size_t (*ba_skip)(const unsigned char *, size_t, unsigned char) =
+	ba_skip_select;
+static __u64 (*ba_count)(const unsigned char *, size_t) = ba_count_select;
+
+/* Pick the scanning kernels on the first call */
+static void ba_select_kernels(void)
+{
+	int nosimd = getenv("E2FS_BITMAP_NO_SIMD") != NULL;
+
+	__builtin_cpu_init();
+	if (nosimd)
+		ba_skip = ba_skip_generic;
+	else if (__builtin_cpu_supports("avx2"))
+		ba_skip = ba_skip_avx2;
+	else
+		ba_skip = ba_skip_sse2;
+	if (!nosimd && __builtin_cpu_supports("popcnt"))
+		ba_count = ba_count_popcnt;
+	else
+		ba_count = ba_count_generic;
 }
 
-/* Find the first one bit between start and end, inclusive. */
-static errcode_t ba_find_first_set(ext2fs_generic_bitmap bitmap,
-				    __u64 start, __u64 end, __u64 *out)
+static size_t ba_skip_select(const unsigned char *p, size_t nbytes,
+			     unsigned char fill)
+{
+	ba_select_kernels();
+	return ba_skip(p, nbytes, fill);
+}
+
+static __u64 ba_count_select(const unsigned char *p, size_t nbytes)
+{
+	ba_select_kernels();
+	return ba_count(p, nbytes);
+}
+#else
+#define ba_skip		ba_skip_generic
+#define ba_count	ba_count_generic
+#endif
+
+/*
+ * Find the first bit between start and end, inclusive, which is set
+ * (or clear).  Long runs of clear (or set) bits are skipped with the
+ * kernels above.
+ */
+static errcode_t ba_find_first(ext2fs_generic_bitmap bitmap,
+			       __u64 start, __u64 end, int set, __u64 *out)
 {
 	ext2fs_ba_private bp = (ext2fs_ba_private)bitmap->private;
-	unsigned long bitpos = start - bitmap->start;
-	unsigned long count = end - start + 1;
-	int byte_found = 0; /* whether a != 0xff byte has been found */
+	__u64 bitpos = start - bitmap->start;
+	__u64 count = end - start + 1;
+	unsigned char fill = set ? 0 : 0xff;
 	const unsigned char *pos;
-	unsigned long max_loop_count, i;
+	size_t skipped;
 
 	/* scan bits until we hit a byte boundary */
 	while ((bitpos & 0x7) != 0 && count > 0) {
-		if (ext2fs_test_bit64(bitpos, bp->bitarray)) {
-			*out = bitpos + bitmap->start;
-			return 0;
-		}
+		if (!ext2fs_test_bit64(bitpos, bp->bitarray) != set)
+			goto found;
 		bitpos++;
 		count--;
 	}
 
-	if (!count)
-		return ENOENT;
-
 	pos = ((unsigned char *)bp->bitarray) + (bitpos >> 3);
-	/* scan bytes until 8-byte (64-bit) aligned */
-	while (count >= 8 && (((uintptr_t)pos) & 0x07)) {
-		if (*pos != 0) {
-			byte_found = 1;
-			break;
-		}
+	if (count >= 8) {
+		skipped = ba_skip(pos, count >> 3, fill);
+		pos += skipped;
+		bitpos += (__u64) skipped << 3;
+		count -= (__u64) skipped << 3;
+	}
+	while (count >= 8 && *pos == fill) {
 		pos++;
-		count -= 8;
 		bitpos += 8;
+		count -= 8;
 	}
 
-	if (!byte_found) {
-		max_loop_count = count >> 6; /* 8-byte blocks */
-		i = max_loop_count;
-		while (i) {
-			if (*((const __u64 *)pos) != 0)
-				break;
-			pos += 8;
-			i--;
-		}
-		count -= 64 * (max_loop_count - i);
-		bitpos += 64 * (max_loop_count - i);
-
-		max_loop_count = count >> 3;
-		i = max_loop_count;
-		while (i) {
-			if (*pos != 0) {
-				byte_found = 1;
-				break;
-			}
-			pos++;
-			i--;
-		}
-		count -= 8 * (max_loop_count - i);
-		bitpos += 8 * (max_loop_count - i);
+	/* Here either count < 8 or the byte at pos has our bit. */
+	while (count-- > 0) {
+		if (!ext2fs_test_bit64(bitpos, bp->bitarray) != set)
+			goto found;
+		bitpos++;
 	}
+	return ENOENT;
+
+found:
+	*out = bitpos + bitmap->start;
+	return 0;
+}
 
-	/* Here either count < 8 or byte_found == 1. */
+/* Find the first zero bit between start and end, inclusive. */
+static errcode_t ba_find_first_zero(ext2fs_generic_bitmap bitmap,
+				    __u64 start, __u64 end, __u64 *out)
+{
+	return ba_find_first(bitmap, start, end, 0, out);
+}
+
+/* Find the first one bit between start and end, inclusive. */
+static errcode_t ba_find_first_set(ext2fs_generic_bitmap bitmap,
+				   __u64 start, __u64 end, __u64 *out)
+{
+	return ba_find_first(bitmap, start, end, 1, out);
+}
+
+/* Count the one bits between start and end, inclusive. */
+static errcode_t ba_count_set(ext2fs_generic_bitmap bitmap,
+			      __u64 start, __u64 end, __u64 *out)
+{
+	ext2fs_ba_private bp = (ext2fs_ba_private)bitmap->private;
+	__u64 bitpos = start - bitmap->start;
+	__u64 count = end - start + 1;
+	__u64 found = 0;
+
+	while ((bitpos & 0x7) != 0 && count > 0) {
+		if (ext2fs_test_bit64(bitpos, bp->bitarray))
+			found++;
+		bitpos++;
+		count--;
+	}
+	found += ba_count((unsigned char *) bp->bitarray + (bitpos >> 3),
+			  count >> 3);
+	bitpos += count & ~7ULL;
+	count &= 7;
 	while (count-- > 0) {
-		if (ext2fs_test_bit64(bitpos, bp->bitarray)) {
-			*out = bitpos + bitmap->start;
-			return 0;
-		}
+		if (ext2fs_test_bit64(bitpos, bp->bitarray))
+			found++;
 		bitpos++;
 	}
-
-	return ENOENT;
+	*out = found;
+	return 0;
 }
 
 struct ext2_bitmap_ops ext2fs_blkmap64_bitarray = {
@@ -488,5 +615,6 @@ struct ext2_bitmap_ops ext2fs_blkmap64_bitarray = {
 	.clear_bmap = ba_clear_bmap,
 	.print_stats = ba_print_stats,
 	.find_first_zero = ba_find_first_zero,
-	.find_first_set = ba_find_first_set
+	.find_first_set = ba_find_first_set,
+	.count_set = ba_count_set
 };
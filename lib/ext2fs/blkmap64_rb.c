@@ -740,6 +740,8 @@ static errcode_t rb_get_bmap_range(ext2fs_generic_bitmap bitmap,
 	n = &bp->root.rb_node;
 	start -= bitmap->start;
 
+	memset(out, 0, (num + 7) >> 3);
+
 	if (ext2fs_rb_empty_root(&bp->root))
 		return 0;
 
@@ -754,8 +756,6 @@ static errcode_t rb_get_bmap_range(ext2fs_generic_bitmap bitmap,
 			break;
 	}
 
-	memset(out, 0, (num + 7) >> 3);
-
 	for (; parent != NULL; parent = next) {
 		next = ext2fs_rb_next(parent);
 		ext = node_to_extent(parent);
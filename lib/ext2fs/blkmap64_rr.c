@@ -0,0 +1,1089 @@
+/*
+ * blkmap64_rr.c --- Roaring-style compressed bitmap implementation
+ *
+ * The bitmap is split into chunks of 65536 bits, and each chunk is
+ * kept in whichever container is the smallest for its contents:
+ *
+ *	- empty or full, which take no memory at all;
+ *	- a sorted array of the 16-bit offsets of the set bits, for
+ *	  sparse chunks (at most 4096 bits set);
+ *	- a sorted array of runs of set bits, for chunks made up of a
+ *	  few long extents (at most 2048 runs);
+ *	- a plain 8k bit array for everything else.
+ *
+ * Finding the container of a bit is an array lookup, so fragmented
+ * bitmaps don't suffer from the pointer chasing of the rbtree, while
+ * sparse or mostly allocated regions take much less memory than with
+ * the bitarray backend.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <fcntl.h>
+#include <time.h>
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include "ext2_fs.h"
+#include "ext2fsP.h"
+#include "bmap64.h"
+
+#define RR_CHUNK_BITS	16
+#define RR_CHUNK_SIZE	(1U << RR_CHUNK_BITS)
+#define RR_CHUNK_MASK	(RR_CHUNK_SIZE - 1)
+#define RR_WORDS	(RR_CHUNK_SIZE / 64)
+#define RR_BITMAP_BYTES	(RR_WORDS * sizeof(__u64))
+
+/* Past these sizes the array and run containers are bigger than 8k */
+#define RR_ARRAY_MAX	4096
+#define RR_RUN_MAX	2048
+
+/* Ranges longer than this are not worth adding to an array one by one */
+#define RR_ARRAY_RANGE	16
+
+enum rr_type {
+	RR_EMPTY = 0,
+	RR_FULL,
+	RR_ARRAY,
+	RR_RUN,
+	RR_BITMAP
+};
+
+struct rr_run {
+	__u16	start;
+	__u16	last;		/* inclusive */
+};
+
+struct rr_container {
+	unsigned char	type;
+	__u16		n;	/* entries used in array or runs */
+	__u16		size;	/* entries allocated */
+	__u32		card;	/* number of bits set */
+	union {
+		__u16		*array;
+		struct rr_run	*runs;
+		__u64		*words;
+	} u;
+};
+
+struct ext2fs_rr_private {
+	__u64			nchunks;
+	struct rr_container	*chunks;
+};
+
+static inline unsigned int rr_popcount64(__u64 w)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (w * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/* w must not be zero */
+static inline unsigned int rr_ctz64(__u64 w)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(w);
+#else
+	unsigned int n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Set or clear bits lo..hi of a bit array; returns the change in the
+ * number of bits set.
+ */
+static int rr_words_fill(__u64 *words, unsigned int lo, unsigned int hi,
+			 int set)
+{
+	unsigned int	i, first = lo >> 6, last = hi >> 6;
+	__u64		mask, old;
+	int		delta = 0;
+
+	for (i = first; i <= last; i++) {
+		mask = ~0ULL;
+		if (i == first)
+			mask &= ~0ULL << (lo & 63);
+		if (i == last)
+			mask &= ~0ULL >> (63 - (hi & 63));
+		old = words[i];
+		if (set)
+			words[i] |= mask;
+		else
+			words[i] &= ~mask;
+		delta += (int) rr_popcount64(words[i]) -
+			 (int) rr_popcount64(old);
+	}
+	return delta;
+}
+
+/*
+ * Return the first bit at or after pos which is set (or clear), or
+ * RR_CHUNK_SIZE if there is none.
+ */
+static unsigned int rr_words_next(const __u64 *words, unsigned int pos,
+				  int set)
+{
+	unsigned int	i = pos >> 6;
+	__u64		w;
+
+	if (pos >= RR_CHUNK_SIZE)
+		return RR_CHUNK_SIZE;
+	w = (set ? words[i] : ~words[i]) & (~0ULL << (pos & 63));
+	while (!w) {
+		if (++i >= RR_WORDS)
+			return RR_CHUNK_SIZE;
+		w = set ? words[i] : ~words[i];
+	}
+	return (i << 6) + rr_ctz64(w);
+}
+
+/* Index of the first array entry >= val */
+static unsigned int rr_array_search(const __u16 *array, unsigned int n,
+				    unsigned int val)
+{
+	unsigned int	low = 0, high = n, mid;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (array[mid] < val)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Index of the first run ending at or after val */
+static unsigned int rr_run_search(const struct rr_run *runs, unsigned int n,
+				  unsigned int val)
+{
+	unsigned int	low = 0, high = n, mid;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (runs[mid].last < val)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static void rr_free_container(struct rr_container *c)
+{
+	if (c->type == RR_ARRAY || c->type == RR_RUN || c->type == RR_BITMAP)
+		ext2fs_free_mem(&c->u.array);
+	memset(c, 0, sizeof(struct rr_container));
+}
+
+/* Make room for at least want entries in an array or run container */
+static errcode_t rr_reserve(struct rr_container *c, unsigned int want,
+			    size_t entsize, unsigned int max)
+{
+	unsigned int	new_size;
+	errcode_t	retval;
+
+	if (want <= c->size)
+		return 0;
+	new_size = c->size ? c->size : 4;
+	while (new_size < want)
+		new_size *= 2;
+	if (new_size > max)
+		new_size = max;
+	retval = ext2fs_resize_mem(c->size * entsize, new_size * entsize,
+				   &c->u.array);
+	if (retval)
+		return retval;
+	c->size = new_size;
+	return 0;
+}
+
+static errcode_t rr_to_bitmap(struct rr_container *c)
+{
+	__u64		*words;
+	unsigned int	i, card;
+	errcode_t	retval;
+
+	if (c->type == RR_BITMAP)
+		return 0;
+	retval = ext2fs_get_memzero(RR_BITMAP_BYTES, &words);
+	if (retval)
+		return retval;
+
+	switch (c->type) {
+	case RR_FULL:
+		memset(words, 0xff, RR_BITMAP_BYTES);
+		break;
+	case RR_ARRAY:
+		for (i = 0; i < c->n; i++)
+			words[c->u.array[i] >> 6] |=
+				1ULL << (c->u.array[i] & 63);
+		break;
+	case RR_RUN:
+		for (i = 0; i < c->n; i++)
+			rr_words_fill(words, c->u.runs[i].start,
+				      c->u.runs[i].last, 1);
+		break;
+	}
+	card = c->card;
+	rr_free_container(c);
+	c->type = RR_BITMAP;
+	c->card = card;
+	c->u.words = words;
+	return 0;
+}
+
+/*
+ * Switch a bit array container to the smallest representation of its
+ * contents.
+ */
+static void rr_shrink(struct rr_container *c)
+{
+	__u64		*words = c->u.words, w, carry = 0;
+	unsigned int	i, k, pos, end, card = 0, nruns = 0;
+	unsigned int	array_cost, run_cost;
+	struct rr_run	*runs;
+	__u16		*array;
+
+	for (i = 0; i < RR_WORDS; i++) {
+		w = words[i];
+		card += rr_popcount64(w);
+		nruns += rr_popcount64(w & ~((w << 1) | carry));
+		carry = w >> 63;
+	}
+	c->card = card;
+	if (card == 0 || card == RR_CHUNK_SIZE) {
+		rr_free_container(c);
+		c->type = card ? RR_FULL : RR_EMPTY;
+		c->card = card;
+		return;
+	}
+
+	array_cost = card <= RR_ARRAY_MAX ? card * sizeof(__u16) : ~0U;
+	run_cost = nruns <= RR_RUN_MAX ? nruns * sizeof(struct rr_run) : ~0U;
+	if (run_cost < RR_BITMAP_BYTES && run_cost <= array_cost) {
+		if (ext2fs_get_array(nruns, sizeof(struct rr_run), &runs))
+			return;
+		for (pos = 0, k = 0;
+		     (pos = rr_words_next(words, pos, 1)) < RR_CHUNK_SIZE;
+		     pos = end, k++) {
+			end = rr_words_next(words, pos, 0);
+			runs[k].start = pos;
+			runs[k].last = end - 1;
+		}
+		ext2fs_free_mem(&c->u.words);
+		c->type = RR_RUN;
+		c->u.runs = runs;
+	} else if (array_cost < RR_BITMAP_BYTES) {
+		if (ext2fs_get_array(card, sizeof(__u16), &array))
+			return;
+		for (i = 0, k = 0; i < RR_WORDS; i++)
+			for (w = words[i]; w; w &= w - 1)
+				array[k++] = (i << 6) + rr_ctz64(w);
+		ext2fs_free_mem(&c->u.words);
+		c->type = RR_ARRAY;
+		c->u.array = array;
+		nruns = card;
+	} else
+		return;
+	c->n = c->size = nruns;
+}
+
+/* Set or clear a range the slow way, through a bit array */
+static errcode_t rr_bitmap_range(struct rr_container *c, unsigned int lo,
+				 unsigned int hi, int set)
+{
+	errcode_t	retval;
+
+	retval = rr_to_bitmap(c);
+	if (retval)
+		return retval;
+	c->card += rr_words_fill(c->u.words, lo, hi, set);
+	rr_shrink(c);
+	return 0;
+}
+
+static int rr_test(struct rr_container *c, unsigned int bit)
+{
+	unsigned int	i;
+
+	switch (c->type) {
+	case RR_FULL:
+		return 1;
+	case RR_ARRAY:
+		i = rr_array_search(c->u.array, c->n, bit);
+		return i < c->n && c->u.array[i] == bit;
+	case RR_RUN:
+		i = rr_run_search(c->u.runs, c->n, bit);
+		return i < c->n && c->u.runs[i].start <= bit;
+	case RR_BITMAP:
+		return (c->u.words[bit >> 6] >> (bit & 63)) & 1;
+	}
+	return 0;
+}
+
+static errcode_t rr_run_add(struct rr_container *c, unsigned int lo,
+			    unsigned int hi)
+{
+	struct rr_run	*runs;
+	unsigned int	i, j, merged = 0, start, last;
+	errcode_t	retval;
+
+	/* Runs overlapping or adjacent to lo..hi are merged into one */
+	i = rr_run_search(c->u.runs, c->n, lo ? lo - 1 : 0);
+	for (j = i; j < c->n && c->u.runs[j].start <= hi + 1; j++)
+		merged += c->u.runs[j].last - c->u.runs[j].start + 1;
+
+	if (j == i) {
+		if (c->n == RR_RUN_MAX)
+			return rr_bitmap_range(c, lo, hi, 1);
+		retval = rr_reserve(c, c->n + 1, sizeof(struct rr_run),
+				    RR_RUN_MAX);
+		if (retval)
+			return retval;
+		runs = c->u.runs;
+		memmove(&runs[i + 1], &runs[i],
+			(c->n - i) * sizeof(struct rr_run));
+		runs[i].start = lo;
+		runs[i].last = hi;
+		c->n++;
+		c->card += hi - lo + 1;
+		return 0;
+	}
+
+	runs = c->u.runs;
+	start = runs[i].start < lo ? runs[i].start : lo;
+	last = runs[j - 1].last > hi ? runs[j - 1].last : hi;
+	runs[i].start = start;
+	runs[i].last = last;
+	memmove(&runs[i + 1], &runs[j], (c->n - j) * sizeof(struct rr_run));
+	c->n -= j - i - 1;
+	c->card += (last - start + 1) - merged;
+	if (c->card == RR_CHUNK_SIZE) {
+		rr_free_container(c);
+		c->type = RR_FULL;
+		c->card = RR_CHUNK_SIZE;
+	}
+	return 0;
+}
+
+static errcode_t rr_run_remove(struct rr_container *c, unsigned int lo,
+			       unsigned int hi)
+{
+	struct rr_run	*runs = c->u.runs;
+	unsigned int	i, j;
+	errcode_t	retval;
+
+	i = rr_run_search(runs, c->n, lo);
+	if (i == c->n || runs[i].start > hi)
+		return 0;
+
+	if (runs[i].start < lo && runs[i].last > hi) {
+		/* Punch a hole in the middle of a run */
+		if (c->n == RR_RUN_MAX)
+			return rr_bitmap_range(c, lo, hi, 0);
+		retval = rr_reserve(c, c->n + 1, sizeof(struct rr_run),
+				    RR_RUN_MAX);
+		if (retval)
+			return retval;
+		runs = c->u.runs;
+		memmove(&runs[i + 2], &runs[i + 1],
+			(c->n - i - 1) * sizeof(struct rr_run));
+		runs[i + 1].start = hi + 1;
+		runs[i + 1].last = runs[i].last;
+		runs[i].last = lo - 1;
+		c->n++;
+		c->card -= hi - lo + 1;
+		return 0;
+	}
+
+	if (runs[i].start < lo) {
+		c->card -= runs[i].last - lo + 1;
+		runs[i].last = lo - 1;
+		i++;
+	}
+	for (j = i; j < c->n && runs[j].last <= hi; j++)
+		c->card -= runs[j].last - runs[j].start + 1;
+	if (j < c->n && runs[j].start <= hi) {
+		c->card -= hi - runs[j].start + 1;
+		runs[j].start = hi + 1;
+	}
+	memmove(&runs[i], &runs[j], (c->n - j) * sizeof(struct rr_run));
+	c->n -= j - i;
+	if (c->n == 0)
+		rr_free_container(c);
+	return 0;
+}
+
+static errcode_t rr_set_range(struct rr_container *c, unsigned int lo,
+			      unsigned int hi)
+{
+	unsigned int	i, j, k, len = hi - lo + 1, added;
+	__u16		*array;
+	errcode_t	retval;
+
+	if (lo == 0 && hi == RR_CHUNK_MASK) {
+		rr_free_container(c);
+		c->type = RR_FULL;
+		c->card = RR_CHUNK_SIZE;
+		return 0;
+	}
+
+	switch (c->type) {
+	case RR_FULL:
+		return 0;
+	case RR_EMPTY:
+		c->type = (len == 1) ? RR_ARRAY : RR_RUN;
+		return rr_set_range(c, lo, hi);
+	case RR_ARRAY:
+		i = rr_array_search(c->u.array, c->n, lo);
+		j = rr_array_search(c->u.array, c->n, hi + 1);
+		added = len - (j - i);
+		if (!added)
+			return 0;
+		if (len > RR_ARRAY_RANGE || c->n + added > RR_ARRAY_MAX)
+			return rr_bitmap_range(c, lo, hi, 1);
+		retval = rr_reserve(c, c->n + added, sizeof(__u16),
+				    RR_ARRAY_MAX);
+		if (retval)
+			return retval;
+		array = c->u.array;
+		memmove(&array[i + len], &array[j],
+			(c->n - j) * sizeof(__u16));
+		for (k = 0; k < len; k++)
+			array[i + k] = lo + k;
+		c->n += added;
+		c->card = c->n;
+		return 0;
+	case RR_RUN:
+		return rr_run_add(c, lo, hi);
+	case RR_BITMAP:
+		c->card += rr_words_fill(c->u.words, lo, hi, 1);
+		if (c->card == RR_CHUNK_SIZE) {
+			rr_free_container(c);
+			c->type = RR_FULL;
+			c->card = RR_CHUNK_SIZE;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+static errcode_t rr_clear_range(struct rr_container *c, unsigned int lo,
+				unsigned int hi)
+{
+	unsigned int	i, j;
+	errcode_t	retval;
+
+	if (c->type == RR_EMPTY)
+		return 0;
+	if (lo == 0 && hi == RR_CHUNK_MASK) {
+		rr_free_container(c);
+		return 0;
+	}
+
+	switch (c->type) {
+	case RR_FULL:
+		retval = ext2fs_get_mem(4 * sizeof(struct rr_run),
+					&c->u.runs);
+		if (retval)
+			return retval;
+		c->type = RR_RUN;
+		c->n = 1;
+		c->size = 4;
+		c->u.runs[0].start = 0;
+		c->u.runs[0].last = RR_CHUNK_MASK;
+		return rr_run_remove(c, lo, hi);
+	case RR_ARRAY:
+		i = rr_array_search(c->u.array, c->n, lo);
+		j = rr_array_search(c->u.array, c->n, hi + 1);
+		memmove(&c->u.array[i], &c->u.array[j],
+			(c->n - j) * sizeof(__u16));
+		c->n -= j - i;
+		c->card = c->n;
+		if (c->n == 0)
+			rr_free_container(c);
+		return 0;
+	case RR_RUN:
+		return rr_run_remove(c, lo, hi);
+	case RR_BITMAP:
+		c->card += rr_words_fill(c->u.words, lo, hi, 0);
+		/* Halfway to the array limit, so we don't flip-flop */
+		if (c->card < RR_ARRAY_MAX / 2)
+			rr_shrink(c);
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * Return the first bit at or after lo which is set (or clear), or
+ * RR_CHUNK_SIZE if there is none.
+ */
+static unsigned int rr_find(struct rr_container *c, unsigned int lo, int set)
+{
+	unsigned int	i, bit;
+
+	switch (c->type) {
+	case RR_EMPTY:
+		return set ? RR_CHUNK_SIZE : lo;
+	case RR_FULL:
+		return set ? lo : RR_CHUNK_SIZE;
+	case RR_ARRAY:
+		i = rr_array_search(c->u.array, c->n, lo);
+		if (set)
+			return i < c->n ? c->u.array[i] : RR_CHUNK_SIZE;
+		for (bit = lo; i < c->n && c->u.array[i] == bit; i++)
+			bit++;
+		return bit;
+	case RR_RUN:
+		i = rr_run_search(c->u.runs, c->n, lo);
+		if (set) {
+			if (i == c->n)
+				return RR_CHUNK_SIZE;
+			return c->u.runs[i].start > lo ?
+				c->u.runs[i].start : lo;
+		}
+		if (i < c->n && c->u.runs[i].start <= lo)
+			return c->u.runs[i].last + 1;
+		return lo;
+	case RR_BITMAP:
+		return rr_words_next(c->u.words, lo, set);
+	}
+	return RR_CHUNK_SIZE;
+}
+
+/* Apply a set or clear to bits first .. first + count - 1 */
+static errcode_t rr_range_op(struct ext2fs_rr_private *bp, __u64 first,
+			     __u64 count, int set)
+{
+	struct rr_container *c;
+	unsigned int	lo, hi;
+	errcode_t	retval;
+
+	while (count) {
+		c = &bp->chunks[first >> RR_CHUNK_BITS];
+		lo = first & RR_CHUNK_MASK;
+		hi = (count > RR_CHUNK_SIZE - lo) ? RR_CHUNK_MASK :
+			lo + count - 1;
+		if (set)
+			retval = rr_set_range(c, lo, hi);
+		else
+			retval = rr_clear_range(c, lo, hi);
+		if (retval)
+			return retval;
+		first += hi - lo + 1;
+		count -= hi - lo + 1;
+	}
+	return 0;
+}
+
+static errcode_t rr_find_first(struct ext2fs_rr_private *bp, __u64 first,
+			       __u64 last, int set, __u64 *out)
+{
+	unsigned int	lo, hi, bit;
+
+	while (first <= last) {
+		lo = first & RR_CHUNK_MASK;
+		hi = (last - first > RR_CHUNK_MASK - lo) ? RR_CHUNK_MASK :
+			lo + (last - first);
+		bit = rr_find(&bp->chunks[first >> RR_CHUNK_BITS], lo, set);
+		if (bit <= hi) {
+			*out = (first & ~((__u64) RR_CHUNK_MASK)) + bit;
+			return 0;
+		}
+		first += hi - lo + 1;
+	}
+	return ENOENT;
+}
+
+static errcode_t rr_new_bmap(ext2_filsys fs EXT2FS_ATTR((unused)),
+			     ext2fs_generic_bitmap bitmap)
+{
+	struct ext2fs_rr_private *bp;
+	errcode_t	retval;
+
+	retval = ext2fs_get_mem(sizeof(struct ext2fs_rr_private), &bp);
+	if (retval)
+		return retval;
+	bp->nchunks = ((bitmap->real_end - bitmap->start) >>
+		       RR_CHUNK_BITS) + 1;
+	retval = ext2fs_get_arrayzero(bp->nchunks,
+				      sizeof(struct rr_container),
+				      &bp->chunks);
+	if (retval) {
+		ext2fs_free_mem(&bp);
+		return retval;
+	}
+	bitmap->private = (void *) bp;
+	return 0;
+}
+
+static void rr_free_bmap(ext2fs_generic_bitmap bitmap)
+{
+	struct ext2fs_rr_private *bp;
+	__u64		i;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	if (!bp)
+		return;
+	for (i = 0; i < bp->nchunks; i++)
+		rr_free_container(&bp->chunks[i]);
+	ext2fs_free_mem(&bp->chunks);
+	ext2fs_free_mem(&bp);
+	bitmap->private = NULL;
+}
+
+static errcode_t rr_copy_bmap(ext2fs_generic_bitmap src,
+			      ext2fs_generic_bitmap dest)
+{
+	struct ext2fs_rr_private *src_bp, *dest_bp;
+	struct rr_container *s, *d;
+	size_t		size;
+	errcode_t	retval;
+	__u64		i;
+
+	retval = rr_new_bmap(NULL, dest);
+	if (retval)
+		return retval;
+	src_bp = (struct ext2fs_rr_private *) src->private;
+	dest_bp = (struct ext2fs_rr_private *) dest->private;
+
+	for (i = 0; i < src_bp->nchunks; i++) {
+		s = &src_bp->chunks[i];
+		d = &dest_bp->chunks[i];
+		switch (s->type) {
+		case RR_ARRAY:
+			size = s->n * sizeof(__u16);
+			break;
+		case RR_RUN:
+			size = s->n * sizeof(struct rr_run);
+			break;
+		case RR_BITMAP:
+			size = RR_BITMAP_BYTES;
+			break;
+		default:
+			*d = *s;
+			continue;
+		}
+		retval = ext2fs_get_mem(size, &d->u.array);
+		if (retval) {
+			rr_free_bmap(dest);
+			return retval;
+		}
+		memcpy(d->u.array, s->u.array, size);
+		d->type = s->type;
+		d->n = d->size = s->n;
+		d->card = s->card;
+	}
+	return 0;
+}
+
+static errcode_t rr_resize_bmap(ext2fs_generic_bitmap bmap,
+				__u64 new_end, __u64 new_real_end)
+{
+	struct ext2fs_rr_private *bp;
+	__u64		nchunks, i, last;
+	errcode_t	retval;
+
+	bp = (struct ext2fs_rr_private *) bmap->private;
+
+	/*
+	 * If we're expanding the bitmap, make sure all of the new
+	 * parts of the bitmap are zero.
+	 */
+	if (new_end > bmap->end) {
+		last = new_end < bmap->real_end ? new_end : bmap->real_end;
+		if (last > bmap->end) {
+			retval = rr_range_op(bp, bmap->end + 1 - bmap->start,
+					     last - bmap->end, 0);
+			if (retval)
+				return retval;
+		}
+	}
+
+	nchunks = ((new_real_end - bmap->start) >> RR_CHUNK_BITS) + 1;
+	if (new_real_end < bmap->real_end) {
+		for (i = nchunks; i < bp->nchunks; i++)
+			rr_free_container(&bp->chunks[i]);
+		i = new_real_end - bmap->start + 1;
+		if (i & RR_CHUNK_MASK) {
+			retval = rr_clear_range(&bp->chunks[i >> RR_CHUNK_BITS],
+						i & RR_CHUNK_MASK,
+						RR_CHUNK_MASK);
+			if (retval)
+				return retval;
+		}
+	}
+	if (nchunks != bp->nchunks) {
+		retval = ext2fs_resize_mem(bp->nchunks *
+					   sizeof(struct rr_container),
+					   nchunks *
+					   sizeof(struct rr_container),
+					   &bp->chunks);
+		if (retval)
+			return retval;
+		if (nchunks > bp->nchunks)
+			memset(&bp->chunks[bp->nchunks], 0,
+			       (nchunks - bp->nchunks) *
+			       sizeof(struct rr_container));
+		bp->nchunks = nchunks;
+	}
+
+	bmap->end = new_end;
+	bmap->real_end = new_real_end;
+	return 0;
+}
+
+static int rr_mark_bmap(ext2fs_generic_bitmap bitmap, __u64 arg)
+{
+	struct ext2fs_rr_private *bp;
+	struct rr_container *c;
+	unsigned int	bit;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	arg -= bitmap->start;
+	c = &bp->chunks[arg >> RR_CHUNK_BITS];
+	bit = arg & RR_CHUNK_MASK;
+
+	if (rr_test(c, bit))
+		return 1;
+	/* Like the rbtree backend, there is no way to report the error */
+	if (rr_set_range(c, bit, bit))
+		abort();
+	return 0;
+}
+
+static int rr_unmark_bmap(ext2fs_generic_bitmap bitmap, __u64 arg)
+{
+	struct ext2fs_rr_private *bp;
+	struct rr_container *c;
+	unsigned int	bit;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	arg -= bitmap->start;
+	c = &bp->chunks[arg >> RR_CHUNK_BITS];
+	bit = arg & RR_CHUNK_MASK;
+
+	if (!rr_test(c, bit))
+		return 0;
+	if (rr_clear_range(c, bit, bit))
+		abort();
+	return 1;
+}
+
+static int rr_test_bmap(ext2fs_generic_bitmap bitmap, __u64 arg)
+{
+	struct ext2fs_rr_private *bp;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	arg -= bitmap->start;
+	return rr_test(&bp->chunks[arg >> RR_CHUNK_BITS],
+		       arg & RR_CHUNK_MASK);
+}
+
+static void rr_mark_bmap_extent(ext2fs_generic_bitmap bitmap, __u64 arg,
+				unsigned int num)
+{
+	if (rr_range_op((struct ext2fs_rr_private *) bitmap->private,
+			arg - bitmap->start, num, 1))
+		abort();
+}
+
+static void rr_unmark_bmap_extent(ext2fs_generic_bitmap bitmap, __u64 arg,
+				  unsigned int num)
+{
+	if (rr_range_op((struct ext2fs_rr_private *) bitmap->private,
+			arg - bitmap->start, num, 0))
+		abort();
+}
+
+static int rr_test_clear_bmap_extent(ext2fs_generic_bitmap bitmap,
+				     __u64 start, unsigned int len)
+{
+	__u64	out;
+
+	if (len == 0)
+		return 1;
+	start -= bitmap->start;
+	return rr_find_first((struct ext2fs_rr_private *) bitmap->private,
+			     start, start + len - 1, 1, &out) == ENOENT;
+}
+
+/* Set count bits of out starting at bit pos */
+static void rr_fill_out(unsigned char *out, __u64 pos, __u64 count)
+{
+	while (count && (pos & 7)) {
+		ext2fs_fast_set_bit64(pos++, out);
+		count--;
+	}
+	memset(out + (pos >> 3), 0xff, count >> 3);
+	pos += count & ~7ULL;
+	count &= 7;
+	while (count--)
+		ext2fs_fast_set_bit64(pos++, out);
+}
+
+static errcode_t rr_set_bmap_range(ext2fs_generic_bitmap bitmap,
+				   __u64 start, size_t num, void *in)
+{
+	struct ext2fs_rr_private *bp;
+	struct rr_container *c;
+	unsigned int	lo, hi, bit;
+	__u64		first, pos = 0;
+	errcode_t	retval;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	first = start - bitmap->start;
+
+	while (pos < num) {
+		c = &bp->chunks[(first + pos) >> RR_CHUNK_BITS];
+		lo = (first + pos) & RR_CHUNK_MASK;
+		hi = (num - pos > RR_CHUNK_SIZE - lo) ? RR_CHUNK_MASK :
+			lo + (num - pos) - 1;
+
+		if (c->type == RR_EMPTY &&
+		    ((pos | lo) & 7) == 0 && ((hi + 1) & 7) == 0 &&
+		    ext2fs_mem_is_zero((char *) in + (pos >> 3),
+				       (hi - lo + 1) >> 3)) {
+			pos += hi - lo + 1;
+			continue;
+		}
+		retval = rr_to_bitmap(c);
+		if (retval)
+			return retval;
+		for (bit = lo; bit <= hi; bit++, pos++) {
+			if (ext2fs_test_bit64(pos, in))
+				c->u.words[bit >> 6] |= 1ULL << (bit & 63);
+			else
+				c->u.words[bit >> 6] &= ~(1ULL << (bit & 63));
+		}
+		rr_shrink(c);
+	}
+	return 0;
+}
+
+static errcode_t rr_get_bmap_range(ext2fs_generic_bitmap bitmap,
+				   __u64 start, size_t num, void *out)
+{
+	struct ext2fs_rr_private *bp;
+	struct rr_container *c;
+	unsigned int	lo, hi, i, s, e;
+	__u64		first, pos = 0;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	first = start - bitmap->start;
+	memset(out, 0, (num + 7) >> 3);
+
+	while (pos < num) {
+		c = &bp->chunks[(first + pos) >> RR_CHUNK_BITS];
+		lo = (first + pos) & RR_CHUNK_MASK;
+		hi = (num - pos > RR_CHUNK_SIZE - lo) ? RR_CHUNK_MASK :
+			lo + (num - pos) - 1;
+
+		switch (c->type) {
+		case RR_FULL:
+			rr_fill_out(out, pos, hi - lo + 1);
+			break;
+		case RR_ARRAY:
+			for (i = rr_array_search(c->u.array, c->n, lo);
+			     i < c->n && c->u.array[i] <= hi; i++)
+				ext2fs_fast_set_bit64(pos + c->u.array[i] - lo,
+						      out);
+			break;
+		case RR_RUN:
+			for (i = rr_run_search(c->u.runs, c->n, lo);
+			     i < c->n && c->u.runs[i].start <= hi; i++) {
+				s = c->u.runs[i].start > lo ?
+					c->u.runs[i].start : lo;
+				e = c->u.runs[i].last < hi ?
+					c->u.runs[i].last : hi;
+				rr_fill_out(out, pos + s - lo, e - s + 1);
+			}
+			break;
+		case RR_BITMAP:
+			for (s = rr_words_next(c->u.words, lo, 1); s <= hi;
+			     s = rr_words_next(c->u.words, s + 1, 1))
+				ext2fs_fast_set_bit64(pos + s - lo, out);
+			break;
+		}
+		pos += hi - lo + 1;
+	}
+	return 0;
+}
+
+static void rr_clear_bmap(ext2fs_generic_bitmap bitmap)
+{
+	struct ext2fs_rr_private *bp;
+	__u64		i;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	for (i = 0; i < bp->nchunks; i++)
+		rr_free_container(&bp->chunks[i]);
+}
+
+static errcode_t rr_find_first_zero(ext2fs_generic_bitmap bitmap,
+				    __u64 start, __u64 end, __u64 *out)
+{
+	errcode_t	retval;
+
+	retval = rr_find_first((struct ext2fs_rr_private *) bitmap->private,
+			       start - bitmap->start, end - bitmap->start,
+			       0, out);
+	if (!retval)
+		*out += bitmap->start;
+	return retval;
+}
+
+static errcode_t rr_find_first_set(ext2fs_generic_bitmap bitmap,
+				   __u64 start, __u64 end, __u64 *out)
+{
+	errcode_t	retval;
+
+	retval = rr_find_first((struct ext2fs_rr_private *) bitmap->private,
+			       start - bitmap->start, end - bitmap->start,
+			       1, out);
+	if (!retval)
+		*out += bitmap->start;
+	return retval;
+}
+
+/* Number of bits set in lo..hi of a container */
+static unsigned int rr_count(struct rr_container *c, unsigned int lo,
+			     unsigned int hi)
+{
+	unsigned int	i, s, e, count = 0, first, last;
+	__u64		mask;
+
+	if (lo == 0 && hi == RR_CHUNK_MASK)
+		return c->card;
+
+	switch (c->type) {
+	case RR_FULL:
+		return hi - lo + 1;
+	case RR_ARRAY:
+		return rr_array_search(c->u.array, c->n, hi + 1) -
+			rr_array_search(c->u.array, c->n, lo);
+	case RR_RUN:
+		for (i = rr_run_search(c->u.runs, c->n, lo);
+		     i < c->n && c->u.runs[i].start <= hi; i++) {
+			s = c->u.runs[i].start > lo ? c->u.runs[i].start : lo;
+			e = c->u.runs[i].last < hi ? c->u.runs[i].last : hi;
+			count += e - s + 1;
+		}
+		return count;
+	case RR_BITMAP:
+		first = lo >> 6;
+		last = hi >> 6;
+		for (i = first; i <= last; i++) {
+			mask = ~0ULL;
+			if (i == first)
+				mask &= ~0ULL << (lo & 63);
+			if (i == last)
+				mask &= ~0ULL >> (63 - (hi & 63));
+			count += rr_popcount64(c->u.words[i] & mask);
+		}
+		return count;
+	}
+	return 0;
+}
+
+static errcode_t rr_count_set(ext2fs_generic_bitmap bitmap,
+			      __u64 start, __u64 end, __u64 *out)
+{
+	struct ext2fs_rr_private *bp;
+	unsigned int	lo, hi;
+	__u64		first, last, count = 0;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	first = start - bitmap->start;
+	last = end - bitmap->start;
+	while (first <= last) {
+		lo = first & RR_CHUNK_MASK;
+		hi = (last - first > RR_CHUNK_MASK - lo) ? RR_CHUNK_MASK :
+			lo + (last - first);
+		count += rr_count(&bp->chunks[first >> RR_CHUNK_BITS], lo, hi);
+		first += hi - lo + 1;
+	}
+	*out = count;
+	return 0;
+}
+
+#ifdef ENABLE_BMAP_STATS
+static void rr_print_stats(ext2fs_generic_bitmap bitmap)
+{
+	struct ext2fs_rr_private *bp;
+	struct rr_container *c;
+	unsigned long	count[RR_BITMAP + 1];
+	__u64		bytes, i;
+
+	bp = (struct ext2fs_rr_private *) bitmap->private;
+	memset(count, 0, sizeof(count));
+	bytes = sizeof(struct ext2fs_rr_private) +
+		bp->nchunks * sizeof(struct rr_container);
+	for (i = 0; i < bp->nchunks; i++) {
+		c = &bp->chunks[i];
+		count[c->type]++;
+		if (c->type == RR_ARRAY)
+			bytes += c->size * sizeof(__u16);
+		else if (c->type == RR_RUN)
+			bytes += c->size * sizeof(struct rr_run);
+		else if (c->type == RR_BITMAP)
+			bytes += RR_BITMAP_BYTES;
+	}
+	fprintf(stderr, "%16lu empty, %lu full, %lu array, %lu run and "
+		"%lu bitarray chunks\n", count[RR_EMPTY], count[RR_FULL],
+		count[RR_ARRAY], count[RR_RUN], count[RR_BITMAP]);
+	fprintf(stderr, "%16llu Bytes used by roaring bitmap\n",
+		(unsigned long long) bytes);
+}
+#else
+static void rr_print_stats(ext2fs_generic_bitmap bitmap EXT2FS_ATTR((unused)))
+{
+}
+#endif
+
+struct ext2_bitmap_ops ext2fs_blkmap64_roaring = {
+	.type = EXT2FS_BMAP64_ROARING,
+	.new_bmap = rr_new_bmap,
+	.free_bmap = rr_free_bmap,
+	.copy_bmap = rr_copy_bmap,
+	.resize_bmap = rr_resize_bmap,
+	.mark_bmap = rr_mark_bmap,
+	.unmark_bmap = rr_unmark_bmap,
+	.test_bmap = rr_test_bmap,
+	.test_clear_bmap_extent = rr_test_clear_bmap_extent,
+	.mark_bmap_extent = rr_mark_bmap_extent,
+	.unmark_bmap_extent = rr_unmark_bmap_extent,
+	.set_bmap_range = rr_set_bmap_range,
+	.get_bmap_range = rr_get_bmap_range,
+	.clear_bmap = rr_clear_bmap,
+	.print_stats = rr_print_stats,
+	.find_first_zero = rr_find_first_zero,
+	.find_first_set = rr_find_first_set,
+	.count_set = rr_count_set
+};
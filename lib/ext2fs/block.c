@@ -21,6 +21,7 @@
 
 struct block_context {
 	ext2_filsys	fs;
+	ext2_ino_t	ino;
 	int (*func)(ext2_filsys	fs,
 		    blk64_t	*blocknr,
 		    e2_blkcnt_t	bcount,
@@ -39,6 +40,7 @@ struct block_context {
 
 struct bmpt_block_context {
 	ext2_filsys	fs;
+	ext2_ino_t	ino;
 	int dup_on;
 	int (*func)(ext2_filsys	fs,
 		    int dup_on,
@@ -149,6 +151,8 @@ static int block_iterate_ind(blk_t *ind_block, blk_t ref_block,
 						      ctx->ind_buf);
 		if (ctx->errcode)
 			ret |= BLOCK_ERROR | BLOCK_ABORT;
+		else
+			ext2fs_mark_inode_group_dirty(ctx->fs, ctx->ino);
 	}
 	if ((ctx->flags & BLOCK_FLAG_DEPTH_TRAVERSE) &&
 	    !(ctx->flags & BLOCK_FLAG_DATA_ONLY) &&
@@ -235,6 +239,8 @@ static int block_iterate_dind(blk_t *dind_block, blk_t ref_block,
 						      ctx->dind_buf);
 		if (ctx->errcode)
 			ret |= BLOCK_ERROR | BLOCK_ABORT;
+		else
+			ext2fs_mark_inode_group_dirty(ctx->fs, ctx->ino);
 	}
 	if ((ctx->flags & BLOCK_FLAG_DEPTH_TRAVERSE) &&
 	    !(ctx->flags & BLOCK_FLAG_DATA_ONLY) &&
@@ -321,6 +327,8 @@ static int block_iterate_tind(blk_t *tind_block, blk_t ref_block,
 						      ctx->tind_buf);
 		if (ctx->errcode)
 			ret |= BLOCK_ERROR | BLOCK_ABORT;
+		else
+			ext2fs_mark_inode_group_dirty(ctx->fs, ctx->ino);
 	}
 	if ((ctx->flags & BLOCK_FLAG_DEPTH_TRAVERSE) &&
 	    !(ctx->flags & BLOCK_FLAG_DATA_ONLY) &&
@@ -380,6 +388,7 @@ errcode_t ext2fs_block_iterate3(ext2_filsys fs,
 	limit = fs->blocksize >> 2;
 
 	ctx.fs = fs;
+	ctx.ino = ino;
 	ctx.func = func;
 	ctx.priv_data = priv_data;
 	ctx.flags = flags;
@@ -705,6 +714,8 @@ static int bmpt_block_recursive_visit(int level, struct ext2_bmptrec *ind_irec,
 			ctx->fs->io, blks, 1, EXT2_BMPT_N_DUPS, block_buf);
 		if (ctx->errcode)
 			ret |= BLOCK_ERROR | BLOCK_ABORT;
+		else
+			ext2fs_mark_inode_group_dirty(ctx->fs, ctx->ino);
 	}
 	if ((ctx->flags & BLOCK_FLAG_DEPTH_TRAVERSE) &&
 	    !(ctx->flags & BLOCK_FLAG_DATA_ONLY) && !(ret & BLOCK_ABORT)) {
@@ -764,6 +775,7 @@ errcode_t ext2fs_bmpt_block_iterate(
 	hdr = (struct ext2_bmpthdr *)&inode.i_block[0];
 
 	ctx.fs = fs;
+	ctx.ino = ino;
 	ctx.dup_on = ext2fs_le32_to_cpu(hdr->h_flags) & EXT2_BMPT_HDR_FLAGS_DUP;
 	ctx.func = func;
 	ctx.priv_data = priv_data;
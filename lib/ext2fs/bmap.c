@@ -464,6 +464,8 @@ done:
 		ext2fs_iblk_add_blocks(fs, inode, blocks_alloc);
 		retval = ext2fs_write_inode(fs, ino, inode);
 	}
+	if ((retval == 0) && (bmap_flags & BMAP_SET))
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	return retval;
 }
 
@@ -48,6 +48,7 @@ struct ext2fs_struct_generic_bitmap {
 	char			*description;
 	void			*private;
 	errcode_t		base_error_code;
+	struct ext2fs_bmap_summary *summary;	/* see bmap_summary.c */
 #ifdef ENABLE_BMAP_STATS
 	struct ext2_bmap_statistics	stats;
 #endif
@@ -98,7 +99,17 @@ struct ext2_bitmap_ops {
 	 * May be NULL, in which case a generic function is used. */
 	errcode_t (*find_first_set)(ext2fs_generic_bitmap bitmap,
 				    __u64 start, __u64 end, __u64 *out);
+	/* Count the set bits between start and end, inclusive.
+	 * May be NULL, in which case a generic function is used. */
+	errcode_t (*count_set)(ext2fs_generic_bitmap bitmap,
+			       __u64 start, __u64 end, __u64 *out);
 };
 
+/* bmap_summary.c */
+extern void ext2fs_bmap_summary_free(ext2fs_generic_bitmap bmap);
+extern void ext2fs_bmap_summary_dirty(ext2fs_generic_bitmap bmap,
+				      __u64 start, __u64 num);
+
 extern struct ext2_bitmap_ops ext2fs_blkmap64_bitarray;
 extern struct ext2_bitmap_ops ext2fs_blkmap64_rbtree;
+extern struct ext2_bitmap_ops ext2fs_blkmap64_roaring;
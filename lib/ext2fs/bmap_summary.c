@@ -0,0 +1,303 @@
+/*
+ * bmap_summary.c --- free space summary over 64-bit bitmaps
+ *
+ * Searching a block bitmap for free space is linear in the size of the
+ * bitmap, which hurts on large, nearly full file systems.  A bitmap can
+ * optionally carry a summary tree: every chunk of SUM_LEAF_BITS bits
+ * has a leaf recording how many bits are clear, the longest run of
+ * clear bits inside the chunk and whether its last bit is clear (so a
+ * run may continue into the next chunk).  Interior nodes aggregate 64
+ * children each, so finding the next chunk that can hold a free run of
+ * a given length takes O(log n) steps.
+ *
+ * The generic bitmap code marks the leaves covering every modified
+ * range dirty, together with their ancestors; dirty nodes are only
+ * recomputed when a search walks over them, so mark and unmark stay
+ * cheap.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include "ext2_fs.h"
+#include "ext2fsP.h"
+#include "bmap64.h"
+
+#define SUM_LEAF_BITS	12	/* bits per leaf chunk */
+#define SUM_FAN_BITS	6	/* children per interior node */
+#define SUM_FAN		(1 << SUM_FAN_BITS)
+#define SUM_MAX_LEVELS	8
+
+struct sum_node {
+	__u32		free;	/* clear bits, saturated in interior nodes */
+	__u32		best;	/* longest run of clear bits in one leaf */
+	unsigned char	tail;	/* some leaf ends with a clear bit */
+	unsigned char	dirty;
+};
+
+struct ext2fs_bmap_summary {
+	int		levels;
+	__u64		count[SUM_MAX_LEVELS];
+	struct sum_node	*node[SUM_MAX_LEVELS];
+};
+
+static void sum_free(struct ext2fs_bmap_summary *sum)
+{
+	int	i;
+
+	for (i = 0; i < sum->levels; i++)
+		ext2fs_free_mem(&sum->node[i]);
+	ext2fs_free_mem(&sum);
+}
+
+void ext2fs_bmap_summary_free(ext2fs_generic_bitmap bmap)
+{
+	if (bmap->summary) {
+		sum_free(bmap->summary);
+		bmap->summary = NULL;
+	}
+}
+
+/*
+ * Mark the leaves covering clusters start .. start + num - 1 (absolute
+ * bitmap positions) as needing to be recomputed.
+ */
+void ext2fs_bmap_summary_dirty(ext2fs_generic_bitmap bmap, __u64 start,
+			       __u64 num)
+{
+	struct ext2fs_bmap_summary *sum = bmap->summary;
+	__u64	first, last, i;
+	int	l;
+
+	if (!num || start > bmap->end)
+		return;
+	if (start + num - 1 > bmap->end)
+		num = bmap->end - start + 1;
+	first = (start - bmap->start) >> SUM_LEAF_BITS;
+	last = (start + num - 1 - bmap->start) >> SUM_LEAF_BITS;
+
+	/* A dirty node's ancestors are always dirty too */
+	for (l = 0; l < sum->levels; l++) {
+		for (i = first; i <= last; i++)
+			sum->node[l][i].dirty = 1;
+		first >>= SUM_FAN_BITS;
+		last >>= SUM_FAN_BITS;
+	}
+}
+
+static void sum_refresh_leaf(ext2fs_generic_bitmap bmap,
+			     struct sum_node *leaf, __u64 idx)
+{
+	__u64	pos, end, zero, set;
+
+	pos = bmap->start + (idx << SUM_LEAF_BITS);
+	end = pos + (1ULL << SUM_LEAF_BITS) - 1;
+	if (end > bmap->end)
+		end = bmap->end;
+
+	memset(leaf, 0, sizeof(struct sum_node));
+	while (pos <= end) {
+		if (bmap->bitmap_ops->find_first_zero(bmap, pos, end, &zero))
+			break;
+		if (bmap->bitmap_ops->find_first_set(bmap, zero, end, &set)) {
+			set = end + 1;
+			leaf->tail = 1;
+		}
+		leaf->free += set - zero;
+		if (set - zero > leaf->best)
+			leaf->best = set - zero;
+		pos = set;
+	}
+}
+
+static void sum_refresh(ext2fs_generic_bitmap bmap, int level, __u64 idx)
+{
+	struct ext2fs_bmap_summary *sum = bmap->summary;
+	struct sum_node *node = &sum->node[level][idx], *child;
+	__u64	i, first, last;
+
+	if (!node->dirty)
+		return;
+	if (level == 0) {
+		sum_refresh_leaf(bmap, node, idx);
+		return;
+	}
+
+	first = idx << SUM_FAN_BITS;
+	last = first + SUM_FAN - 1;
+	if (last >= sum->count[level - 1])
+		last = sum->count[level - 1] - 1;
+	memset(node, 0, sizeof(struct sum_node));
+	for (i = first; i <= last; i++) {
+		sum_refresh(bmap, level - 1, i);
+		child = &sum->node[level - 1][i];
+		if (child->best > node->best)
+			node->best = child->best;
+		node->free = (node->free + child->free < node->free) ?
+			~0U : node->free + child->free;
+		node->tail |= child->tail;
+	}
+}
+
+/* Could a run of len clear bits start somewhere below this node? */
+static int sum_match(struct sum_node *node, __u64 len)
+{
+	if (len <= 1)
+		return node->free != 0;
+	return node->best >= len || node->tail;
+}
+
+/*
+ * Return the first leaf at or after leaf idx under which a run of len
+ * clear bits could start, or -1 if there is none.
+ */
+static __s64 sum_next_leaf(ext2fs_generic_bitmap bmap, __u64 idx, __u64 len)
+{
+	struct ext2fs_bmap_summary *sum = bmap->summary;
+	__u64	i, last;
+	int	l = 0;
+
+	/* Climb until a node to our right has a match... */
+	while (1) {
+		last = idx | (SUM_FAN - 1);
+		if (last >= sum->count[l])
+			last = sum->count[l] - 1;
+		for (i = idx; i <= last; i++) {
+			sum_refresh(bmap, l, i);
+			if (sum_match(&sum->node[l][i], len))
+				goto descend;
+		}
+		if (++l >= sum->levels)
+			return -1;
+		idx = (idx >> SUM_FAN_BITS) + 1;
+		if (idx >= sum->count[l])
+			return -1;
+	}
+
+descend:
+	/* ...then take the leftmost matching child down to a leaf */
+	while (l > 0) {
+		l--;
+		idx = i << SUM_FAN_BITS;
+		last = idx + SUM_FAN - 1;
+		if (last >= sum->count[l])
+			last = sum->count[l] - 1;
+		for (i = idx; i <= last; i++)
+			if (sum_match(&sum->node[l][i], len))
+				break;
+	}
+	return i;
+}
+
+/*
+ * Attach a summary to a 64-bit bitmap.  Doing so again is harmless.
+ */
+errcode_t ext2fs_enable_generic_bmap_summary(ext2fs_generic_bitmap bmap)
+{
+	struct ext2fs_bmap_summary *sum;
+	__u64		n;
+	errcode_t	retval;
+	int		l;
+
+	if (!bmap || !EXT2FS_IS_64_BITMAP(bmap))
+		return EINVAL;
+	if (bmap->summary)
+		return 0;
+	if (!bmap->bitmap_ops->find_first_zero ||
+	    !bmap->bitmap_ops->find_first_set)
+		return EXT2_ET_OP_NOT_SUPPORTED;
+
+	retval = ext2fs_get_memzero(sizeof(struct ext2fs_bmap_summary), &sum);
+	if (retval)
+		return retval;
+	n = ((bmap->end - bmap->start) >> SUM_LEAF_BITS) + 1;
+	for (l = 0; l < SUM_MAX_LEVELS; l++) {
+		retval = ext2fs_get_array(n, sizeof(struct sum_node),
+					  &sum->node[l]);
+		if (retval) {
+			sum_free(sum);
+			return retval;
+		}
+		memset(sum->node[l], 0, n * sizeof(struct sum_node));
+		sum->count[l] = n;
+		sum->levels++;
+		if (n == 1)
+			break;
+		n = (n + SUM_FAN - 1) >> SUM_FAN_BITS;
+	}
+	bmap->summary = sum;
+	ext2fs_bmap_summary_dirty(bmap, bmap->start,
+				  bmap->end - bmap->start + 1);
+	return 0;
+}
+
+void ext2fs_disable_generic_bmap_summary(ext2fs_generic_bitmap bmap)
+{
+	if (bmap && EXT2FS_IS_64_BITMAP(bmap))
+		ext2fs_bmap_summary_free(bmap);
+}
+
+/*
+ * Find the first clear bit between start and end, inclusive, at which
+ * a run of len clear bits could begin.  With a summary attached, whole
+ * chunks which can't hold such a run are skipped, so nothing before
+ * *out starts a long enough run, but the run at *out may still be too
+ * short and must be checked by the caller.  Without a summary, this is
+ * just ext2fs_find_first_zero_generic_bmap().
+ */
+errcode_t ext2fs_find_first_zero_run_generic_bmap(ext2fs_generic_bitmap bmap,
+						  __u64 start, __u64 end,
+						  __u64 len, __u64 *out)
+{
+	__u64		cstart, cend, clen, lo, hi, cout;
+	__s64		leaf;
+	errcode_t	retval;
+
+	if (!bmap || !EXT2FS_IS_64_BITMAP(bmap) || !bmap->summary)
+		return ext2fs_find_first_zero_generic_bmap(bmap, start, end,
+							   out);
+
+	cstart = start >> bmap->cluster_bits;
+	cend = end >> bmap->cluster_bits;
+	clen = (len + (1ULL << bmap->cluster_bits) - 1) >> bmap->cluster_bits;
+	if (cstart < bmap->start || cend > bmap->end || start > end)
+		return ext2fs_find_first_zero_generic_bmap(bmap, start, end,
+							   out);
+
+	lo = cstart;
+	while (lo <= cend) {
+		leaf = sum_next_leaf(bmap, (lo - bmap->start) >> SUM_LEAF_BITS,
+				     clen);
+		if (leaf < 0)
+			return ENOENT;
+		if (bmap->start + ((__u64) leaf << SUM_LEAF_BITS) > lo)
+			lo = bmap->start + ((__u64) leaf << SUM_LEAF_BITS);
+		if (lo > cend)
+			break;
+		hi = bmap->start + (((__u64) leaf + 1) << SUM_LEAF_BITS) - 1;
+		if (hi > cend)
+			hi = cend;
+		retval = bmap->bitmap_ops->find_first_zero(bmap, lo, hi, &cout);
+		if (retval == 0) {
+			cout <<= bmap->cluster_bits;
+			*out = (cout >= start) ? cout : start;
+			return 0;
+		}
+		if (retval != ENOENT)
+			return retval;
+		lo = hi + 1;
+	}
+	return ENOENT;
+}
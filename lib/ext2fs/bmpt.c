@@ -125,6 +125,7 @@ static errcode_t ext2fs_bmpt_build_branch(ext2_filsys fs, ext2_ino_t ino,
 			fs->io, blks, 1, EXT2_BMPT_N_DUPS, block_buf[i]);
 		if (retval)
 			goto done;
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	}
 
 done:
@@ -206,6 +207,7 @@ errcode_t ext2fs_increase_inds(ext2_filsys fs, ext2_ino_t ino,
 			fs->io, blks, 1, EXT2_BMPT_N_DUPS, block_buf[i]);
 		if (retval)
 			goto done;
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	}
 
 	/* Update the tree number of levels field */
@@ -431,6 +433,7 @@ errcode_t ext2fs_bmpt_bmap2(ext2_filsys fs, ext2_ino_t ino,
 			ind_blocks[nr_levels - 1]);
 		if (retval)
 			goto done;
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	} else if (ext2_bmpt_irec_is_null(&irec) && can_insert) {
 		blk64_t blks[EXT2_BMPT_N_DUPS];
 		blk_t goal[EXT2_BMPT_N_DUPS];
@@ -473,6 +476,7 @@ errcode_t ext2fs_bmpt_bmap2(ext2_filsys fs, ext2_ino_t ino,
 			ind_blocks[nr_levels - 1]);
 		if (retval)
 			goto done;
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	}
 
 	/*
@@ -492,6 +496,7 @@ errcode_t ext2fs_bmpt_bmap2(ext2_filsys fs, ext2_ino_t ino,
 			fs->io, blks, 1, EXT2_BMPT_N_DUPS, ind_blocks[ind_new]);
 		if (retval)
 			goto done;
+		ext2fs_mark_inode_group_dirty(fs, ino);
 	}
 
 	/* Return the BMPT records at the leaf node level */
@@ -544,8 +549,9 @@ static int check_zero_block(char *buf, int blocksize)
 /*
  * This is originally from ext2fs_punch_ind, modified to support bmpt
  */
-static errcode_t bmpt_punch(ext2_filsys fs, struct ext2_inode *inode,
-			    char *block_buf, struct ext2_bmptrec *p, int level,
+static errcode_t bmpt_punch(ext2_filsys fs, ext2_ino_t ino,
+			    struct ext2_inode *inode, char *block_buf,
+			    struct ext2_bmptrec *p, int level,
 			    blk64_t start, blk64_t count, int max)
 {
 	errcode_t retval;
@@ -582,7 +588,7 @@ static errcode_t bmpt_punch(ext2_filsys fs, struct ext2_inode *inode,
 				return retval;
 			start2 = (start > offset) ? start - offset : 0;
 			retval = bmpt_punch(
-				fs, inode, block_buf + fs->blocksize,
+				fs, ino, inode, block_buf + fs->blocksize,
 				(struct ext2_bmptrec *)block_buf, level - 1,
 				start2, count - offset,
 				fs->blocksize >> EXT2_BMPTREC_SZ_BITS);
@@ -594,6 +600,7 @@ static errcode_t bmpt_punch(ext2_filsys fs, struct ext2_inode *inode,
 				fs->io, blks, 1, EXT2_BMPT_N_DUPS, block_buf);
 			if (retval)
 				return retval;
+			ext2fs_mark_inode_group_dirty(fs, ino);
 			/* Skip the freeing of BMPT node if the BMPT node is not
 			 * empty yet */
 			if (!check_zero_block(block_buf, fs->blocksize))
@@ -666,7 +673,7 @@ errcode_t ext2fs_punch_bmpt(ext2_filsys fs, ext2_ino_t ino,
 		max *= addr_per_block;
 
 	/* We start from the top level */
-	retval = bmpt_punch(fs, inode, block_buf, &hdr->h_root, nr_levels,
+	retval = bmpt_punch(fs, ino, inode, block_buf, &hdr->h_root, nr_levels,
 			    start, count, max);
 	if (retval)
 		goto done;
@@ -183,11 +183,112 @@ static inline uint32_t crc32_le_generic(uint32_t crc, unsigned char const *p,
 	return crc;
 }
 
-uint32_t ext2fs_crc32c_le(uint32_t crc, unsigned char const *p, size_t len)
+static uint32_t crc32c_le_sw(uint32_t crc, unsigned char const *p,
+			     size_t len)
 {
 	return crc32_le_generic(crc, p, len, crc32ctable_le, CRC32C_POLY_LE);
 }
 
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_CRC32C_SSE42
+
+/*
+ * Hardware crc32c using the SSE4.2 crc32 instruction.
+ *
+ * The instruction has a latency of three cycles but can start a new
+ * one every cycle, so large buffers are cut into three streams that
+ * are checksummed in parallel.  The crcs of the second and third
+ * streams start at zero and are merged into the first by shifting it
+ * over the length of a stream (the crc32c_long and crc32c_short
+ * tables, generated by gen_crc32ctable) and xoring.
+ */
+static inline uint32_t crc32c_shift(const uint32_t (*zeros)[256],
+				    uint32_t crc)
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+		zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+#define CRC32C_INTERLEAVE(crc, next, end, size, zeros)			\
+	do {								\
+		uint64_t crc0 = (crc), crc1 = 0, crc2 = 0;		\
+									\
+		(end) = (next) + (size);				\
+		do {							\
+			crc0 = __builtin_ia32_crc32di(crc0,		\
+				*(const uint64_t *) (next));		\
+			crc1 = __builtin_ia32_crc32di(crc1,		\
+				*(const uint64_t *) ((next) + (size)));	\
+			crc2 = __builtin_ia32_crc32di(crc2,		\
+				*(const uint64_t *) ((next) + 2 * (size))); \
+			(next) += 8;					\
+		} while ((next) < (end));				\
+		(crc) = crc32c_shift(zeros, crc0) ^ crc1;		\
+		(crc) = crc32c_shift(zeros, crc) ^ crc2;		\
+		(next) += 2 * (size);					\
+	} while (0)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_le_sse42(uint32_t crc, unsigned char const *p,
+				size_t len)
+{
+	unsigned char const *end;
+	uint64_t crc64;
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+		len--;
+	}
+	while (len >= 3 * CRC32C_LONG) {
+		CRC32C_INTERLEAVE(crc, p, end, CRC32C_LONG, crc32c_long);
+		len -= 3 * CRC32C_LONG;
+	}
+	while (len >= 3 * CRC32C_SHORT) {
+		CRC32C_INTERLEAVE(crc, p, end, CRC32C_SHORT, crc32c_short);
+		len -= 3 * CRC32C_SHORT;
+	}
+	crc64 = crc;
+	while (len >= 8) {
+		crc64 = __builtin_ia32_crc32di(crc64, *(const uint64_t *) p);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	return crc;
+}
+
+static uint32_t crc32c_le_select(uint32_t crc, unsigned char const *p,
+				 size_t len);
+
+static uint32_t (*crc32c_le_impl)(uint32_t, unsigned char const *, size_t) =
+	crc32c_le_select;
+
+/* Pick an implementation on the first call */
+static uint32_t crc32c_le_select(uint32_t crc, unsigned char const *p,
+				 size_t len)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2") && !getenv("E2FS_CRC32C_SW"))
+		crc32c_le_impl = crc32c_le_sse42;
+	else
+		crc32c_le_impl = crc32c_le_sw;
+	return crc32c_le_impl(crc, p, len);
+}
+
+uint32_t ext2fs_crc32c_le(uint32_t crc, unsigned char const *p, size_t len)
+{
+	return crc32c_le_impl(crc, p, len);
+}
+#else
+uint32_t ext2fs_crc32c_le(uint32_t crc, unsigned char const *p, size_t len)
+{
+	return crc32c_le_sw(crc, p, len);
+}
+#endif
+
 /**
  * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
@@ -241,6 +342,9 @@ uint32_t ext2fs_crc32_be(uint32_t crc, unsigned char const *p, size_t len)
 }
 
 #ifdef UNITTEST
+#include <string.h>
+#include <sys/time.h>
+
 static uint8_t test_buf[] = {
 	0xd9, 0xd7, 0x6a, 0x13, 0x3a, 0xb1, 0x05, 0x48,
 	0xda, 0xad, 0x14, 0xbd, 0x03, 0x3a, 0x58, 0x5e,
@@ -919,11 +1023,123 @@ static int test_crc32c(void)
 	return failures;
 }
 
+#ifdef HAVE_CRC32C_SSE42
+/*
+ * Compare the hardware implementation against the table-driven one
+ * for every alignment and for lengths that exercise each of the
+ * interleaved loops.
+ */
+static int test_crc32c_sse42(void)
+{
+	static const size_t lens[] = { 0, 1, 7, 8, 63, 3 * CRC32C_SHORT - 1,
+		3 * CRC32C_SHORT, 4096, 3 * CRC32C_LONG - 1, 3 * CRC32C_LONG,
+		3 * CRC32C_LONG + 3 * CRC32C_SHORT + 13, 65536 };
+	unsigned char *buf;
+	size_t i, size = 65536 + 8;
+	int failures = 0, align;
+	uint32_t sw, hw;
+
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.2")) {
+		printf("No SSE4.2, skipping hardware crc32c test.\n");
+		return 0;
+	}
+	buf = malloc(size);
+	if (!buf)
+		return 1;
+	for (i = 0; i < size; i++)
+		buf[i] = random();
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		for (align = 0; align < 8; align++) {
+			sw = crc32c_le_sw(~0U, buf + align, lens[i]);
+			hw = crc32c_le_sse42(~0U, buf + align, lens[i]);
+			if (sw != hw) {
+				printf("SSE4.2 length %zu align %d fails, "
+				       "%x != %x\n", lens[i], align, hw, sw);
+				failures++;
+			}
+		}
+	}
+	free(buf);
+	return failures;
+}
+#endif
+
+static double bench_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void bench_one(const char *name,
+		      uint32_t (*fn)(uint32_t, unsigned char const *, size_t),
+		      unsigned char *buf, size_t len)
+{
+	unsigned long long total = 0;
+	uint32_t crc = ~0U;
+	double start, elapsed;
+	int i, iter = 1;
+
+	/* double the iterations until a run takes a quarter second */
+	do {
+		start = bench_time();
+		for (i = 0; i < iter; i++)
+			crc = fn(crc, buf, len);
+		elapsed = bench_time() - start;
+		total = (unsigned long long) iter * len;
+		iter *= 2;
+	} while (elapsed < 0.25);
+	printf("%-8s %8zu bytes: %8.1f MB/s (crc %08x)\n", name, len,
+	       total / elapsed / (1024 * 1024), crc);
+}
+
+/* Microbenchmark: tst_crc32c -b [buffer size...] */
+static void bench_crc32c(int argc, char *argv[])
+{
+	static const size_t default_lens[] = { 128, 1024, 4096, 65536,
+					       1048576 };
+	unsigned char *buf;
+	size_t i, len, max = 1048576;
+	int n;
+
+	for (n = 0; n < argc; n++)
+		if (strtoul(argv[n], 0, 0) > max)
+			max = strtoul(argv[n], 0, 0);
+	buf = malloc(max);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < max; i++)
+		buf[i] = random();
+
+	n = argc ? argc : (int) (sizeof(default_lens) / sizeof(size_t));
+	for (i = 0; i < (size_t) n; i++) {
+		len = argc ? strtoul(argv[i], 0, 0) : default_lens[i];
+		bench_one("table", crc32c_le_sw, buf, len);
+#ifdef HAVE_CRC32C_SSE42
+		if (__builtin_cpu_supports("sse4.2"))
+			bench_one("sse4.2", crc32c_le_sse42, buf, len);
+#endif
+	}
+	free(buf);
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
 
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		bench_crc32c(argc - 2, argv + 2);
+		return 0;
+	}
+
 	ret = test_crc32c();
+#ifdef HAVE_CRC32C_SSE42
+	ret += test_crc32c_sse42();
+#endif
 	if (!ret)
 		printf("No failures.\n");
 
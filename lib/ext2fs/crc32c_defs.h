@@ -14,6 +14,15 @@
 #define CRC32C_POLY_LE 0x82F63B78
 #define CRC32C_POLY_BE 0x1EDC6F41
 
+/*
+ * Block sizes for the interleaved hardware crc32c: buffers are cut into
+ * three streams of CRC32C_LONG (then CRC32C_SHORT) bytes whose crcs are
+ * combined using the precomputed crc32c_long/crc32c_short tables.
+ * Both must be powers of two.
+ */
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
 /* How many bits at a time to use.  Valid values are 1, 2, 4, 8, 32 and 64. */
 /* For less performance-sensitive, use 4 */
 #ifndef CRC_LE_BITS
@@ -626,54 +626,55 @@ errcode_t ext2fs_block_bitmap_csum_set(ext2_filsys fs, dgrp_t group,
 	return 0;
 }
 
-static errcode_t ext2fs_inode_csum(ext2_filsys fs, ext2_ino_t inum,
-			       struct ext2_inode_large *inode,
-			       __u32 *crc, int has_hi)
+/*
+ * Checksum an on-disk inode.  The checksum fields are taken as zero by
+ * feeding the crc the bytes around them plus zeroes, so the inode does
+ * not have to be modified (or copied) to compute it.
+ */
+static __u32 inode_csum(ext2_filsys fs, ext2_ino_t inum,
+			const struct ext2_inode_large *inode, int has_hi)
 {
-	__u32 gen;
-	struct ext2_inode_large *desc = inode;
+	static const unsigned char zero[2];
+	const unsigned char *p = (const unsigned char *) inode;
 	size_t size = EXT2_INODE_SIZE(fs->super);
-	__u16 old_lo;
-	__u16 old_hi = 0;
-
-	old_lo = inode->i_checksum_lo;
-	inode->i_checksum_lo = 0;
-	if (has_hi) {
-		old_hi = inode->i_checksum_hi;
-		inode->i_checksum_hi = 0;
-	}
+	size_t lo = offsetof(struct ext2_inode_large, i_checksum_lo);
+	size_t hi = offsetof(struct ext2_inode_large, i_checksum_hi);
+	__u32 crc, gen;
 
 	inum = ext2fs_cpu_to_le32(inum);
 	gen = inode->i_generation;
-	*crc = ext2fs_crc32c_le(fs->csum_seed, (unsigned char *)&inum,
-				sizeof(inum));
-	*crc = ext2fs_crc32c_le(*crc, (unsigned char *)&gen, sizeof(gen));
-	*crc = ext2fs_crc32c_le(*crc, (unsigned char *)desc, size);
+	crc = ext2fs_crc32c_le(fs->csum_seed, (unsigned char *)&inum,
+			       sizeof(inum));
+	crc = ext2fs_crc32c_le(crc, (unsigned char *)&gen, sizeof(gen));
+	crc = ext2fs_crc32c_le(crc, p, lo);
+	crc = ext2fs_crc32c_le(crc, zero, sizeof(zero));
+	if (has_hi) {
+		crc = ext2fs_crc32c_le(crc, p + lo + 2, hi - lo - 2);
+		crc = ext2fs_crc32c_le(crc, zero, sizeof(zero));
+		crc = ext2fs_crc32c_le(crc, p + hi + 2, size - hi - 2);
+	} else
+		crc = ext2fs_crc32c_le(crc, p + lo + 2, size - lo - 2);
+	return crc;
+}
 
-	inode->i_checksum_lo = old_lo;
-	if (has_hi)
-		inode->i_checksum_hi = old_hi;
-	return 0;
+static int inode_csum_has_hi(ext2_filsys fs,
+			     const struct ext2_inode_large *inode)
+{
+	return (EXT2_INODE_SIZE(fs->super) > EXT2_GOOD_OLD_INODE_SIZE &&
+		ext2fs_le16_to_cpu(inode->i_extra_isize) >=
+		EXT4_INODE_CSUM_HI_EXTRA_END);
 }
 
-int ext2fs_inode_csum_verify(ext2_filsys fs, ext2_ino_t inum,
-			     struct ext2_inode_large *inode)
+static int inode_csum_ok(ext2_filsys fs, ext2_ino_t inum,
+			 const struct ext2_inode_large *inode)
 {
-	errcode_t retval;
 	__u32 provided, calculated;
 	unsigned int i, has_hi;
-	char *cp;
-
-	if (!ext2fs_has_feature_metadata_csum(fs->super))
-		return 1;
-
-	has_hi = (EXT2_INODE_SIZE(fs->super) > EXT2_GOOD_OLD_INODE_SIZE &&
-		  inode->i_extra_isize >= EXT4_INODE_CSUM_HI_EXTRA_END);
+	const char *cp;
 
+	has_hi = inode_csum_has_hi(fs, inode);
 	provided = ext2fs_le16_to_cpu(inode->i_checksum_lo);
-	retval = ext2fs_inode_csum(fs, inum, inode, &calculated, has_hi);
-	if (retval)
-		return 0;
+	calculated = inode_csum(fs, inum, inode, has_hi);
 	if (has_hi) {
 		__u32 hi = ext2fs_le16_to_cpu(inode->i_checksum_hi);
 		provided |= hi << 16;
@@ -691,7 +692,7 @@ int ext2fs_inode_csum_verify(ext2_filsys fs, ext2_ino_t inum,
 	 * worth the bother to figure out how much of the extended
 	 * inode, if any, is present.)
 	 */
-	for (cp = (char *) inode, i = 0;
+	for (cp = (const char *) inode, i = 0;
 	     i < sizeof(struct ext2_inode);
 	     cp++, i++)
 		if (*cp)
@@ -699,22 +700,54 @@ int ext2fs_inode_csum_verify(ext2_filsys fs, ext2_ino_t inum,
 	return 1;		/* Inode must have been all zero's */
 }
 
+int ext2fs_inode_csum_verify(ext2_filsys fs, ext2_ino_t inum,
+			     struct ext2_inode_large *inode)
+{
+	if (!ext2fs_has_feature_metadata_csum(fs->super))
+		return 1;
+
+	return inode_csum_ok(fs, inum, inode);
+}
+
+/*
+ * Verify the checksums of count consecutive inodes, starting with
+ * first_ino, in an inode table buffer in on-disk byte order.  Bit i of
+ * bad_mask (an array of (count + 31) / 32 words) is set if inode
+ * first_ino + i is bad.  Returns the number of bad inodes.
+ */
+int ext2fs_inode_table_csum_verify_block(ext2_filsys fs, ext2_ino_t first_ino,
+					 const void *buf, unsigned int count,
+					 __u32 *bad_mask)
+{
+	const char *p = buf;
+	unsigned int i;
+	int bad = 0;
+
+	memset(bad_mask, 0, ((count + 31) / 32) * sizeof(__u32));
+	if (!ext2fs_has_feature_metadata_csum(fs->super))
+		return 0;
+
+	for (i = 0; i < count; i++, p += EXT2_INODE_SIZE(fs->super)) {
+		if (inode_csum_ok(fs, first_ino + i,
+				  (const struct ext2_inode_large *) p))
+			continue;
+		bad_mask[i / 32] |= 1U << (i % 32);
+		bad++;
+	}
+	return bad;
+}
+
 errcode_t ext2fs_inode_csum_set(ext2_filsys fs, ext2_ino_t inum,
 			   struct ext2_inode_large *inode)
 {
-	errcode_t retval;
 	__u32 crc;
 	int has_hi;
 
 	if (!ext2fs_has_feature_metadata_csum(fs->super))
 		return 0;
 
-	has_hi = (EXT2_INODE_SIZE(fs->super) > EXT2_GOOD_OLD_INODE_SIZE &&
-		  inode->i_extra_isize >= EXT4_INODE_CSUM_HI_EXTRA_END);
-
-	retval = ext2fs_inode_csum(fs, inum, inode, &crc, has_hi);
-	if (retval)
-		return retval;
+	has_hi = inode_csum_has_hi(fs, inode);
+	crc = inode_csum(fs, inum, inode, has_hi);
 	inode->i_checksum_lo = ext2fs_cpu_to_le16(crc & 0xFFFF);
 	if (has_hi)
 		inode->i_checksum_hi = ext2fs_cpu_to_le16(crc >> 16);
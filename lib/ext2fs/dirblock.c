@@ -85,6 +85,10 @@ errcode_t ext2fs_write_dir_block4(ext2_filsys fs, blk64_t block,
 		goto out;
 
 	retval = io_channel_write_blk64(fs->io, block, 1, buf);
+	if (!retval && ino)
+		ext2fs_mark_inode_group_dirty(fs, ino);
+	else if (!retval)
+		ext2fs_mark_block_group_dirty(fs, block);
 
 out:
 #ifdef WORDS_BIGENDIAN
@@ -123,6 +127,8 @@ errcode_t ext2fs_write_dir_block4_multiple(ext2_filsys fs, struct ext2_bmptirec
 
 	/* Write to the duplicates (the total number of copies is in s_dupinode_dup_cnt) of the directory blocks */
 	retval = io_channel_write_blk64_multiple(fs->io, blks, 1, n, buf);
+	if (!retval)
+		ext2fs_mark_inode_group_dirty(fs, ino);
 
 out:
 #ifdef WORDS_BIGENDIAN
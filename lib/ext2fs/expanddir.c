@@ -153,6 +153,8 @@ static int expand_bmpt_dir_proc(ext2_filsys	fs,
 		/* Write duplicates of the directory block */
 		retval = io_channel_write_blk64_multiple(fs->io, blks, 1, n, block);
 		ext2fs_free_mem(&block);
+		if (!retval)
+			ext2fs_mark_inode_group_dirty(fs, es->dir);
 	}
 	if (blockcnt >= 0)
 		es->goalirec = new_blk;
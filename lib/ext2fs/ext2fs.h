@@ -308,6 +308,7 @@ struct struct_ext2_filsys {
 #define EXT2FS_BMAP64_BITARRAY	1
 #define EXT2FS_BMAP64_RBTREE	2
 #define EXT2FS_BMAP64_AUTODIR	3
+#define EXT2FS_BMAP64_ROARING	4
 
 /*
  * Return flags for the block iterator functions
@@ -731,11 +732,17 @@ void ext2fs_block_alloc_stats(ext2_filsys fs, blk_t blk, int inuse);
 void ext2fs_block_alloc_stats2(ext2_filsys fs, blk64_t blk, int inuse);
 void ext2fs_block_alloc_stats_range(ext2_filsys fs, blk64_t blk,
 				    blk_t num, int inuse);
+void ext2fs_mark_group_dirty(ext2_filsys fs, dgrp_t group);
+void ext2fs_mark_inode_group_dirty(ext2_filsys fs, ext2_ino_t ino);
+void ext2fs_mark_block_group_dirty(ext2_filsys fs, blk64_t blk);
 
 /* alloc_tables.c */
 extern errcode_t ext2fs_allocate_tables(ext2_filsys fs);
 extern errcode_t ext2fs_allocate_group_table(ext2_filsys fs, dgrp_t group,
 					     ext2fs_block_bitmap bmap);
+extern errcode_t ext2fs_allocate_dup_inode_tables(ext2_filsys fs,
+						  dgrp_t group, int which,
+						  ext2fs_block_bitmap bmap);
 
 /* badblocks.c */
 extern errcode_t ext2fs_u32_list_create(ext2_u32_list *ret, int size);
@@ -968,6 +975,13 @@ errcode_t ext2fs_map_cluster_block(ext2_filsys fs, ext2_ino_t ino,
 				   struct ext2_inode *inode, blk64_t lblk,
 				   blk64_t *pblk);
 
+/* bmap_summary.c */
+extern errcode_t ext2fs_enable_generic_bmap_summary(ext2fs_generic_bitmap bmap);
+extern void ext2fs_disable_generic_bmap_summary(ext2fs_generic_bitmap bmap);
+extern errcode_t ext2fs_find_first_zero_run_generic_bmap(ext2fs_generic_bitmap bmap,
+						__u64 start, __u64 end,
+						__u64 len, __u64 *out);
+
 #if 0
 /* bmove.c */
 extern errcode_t ext2fs_move_blocks(ext2_filsys fs,
@@ -1088,6 +1102,11 @@ extern errcode_t ext2fs_inode_csum_set(ext2_filsys fs, ext2_ino_t inum,
 				       struct ext2_inode_large *inode);
 extern int ext2fs_inode_csum_verify(ext2_filsys fs, ext2_ino_t inum,
 				    struct ext2_inode_large *inode);
+extern int ext2fs_inode_table_csum_verify_block(ext2_filsys fs,
+						ext2_ino_t first_ino,
+						const void *buf,
+						unsigned int count,
+						__u32 *bad_mask);
 extern void ext2fs_group_desc_csum_set(ext2_filsys fs, dgrp_t group);
 extern int ext2fs_group_desc_csum_verify(ext2_filsys fs, dgrp_t group);
 extern errcode_t ext2fs_set_gdt_csum(ext2_filsys fs);
@@ -1295,6 +1314,10 @@ extern errcode_t ext2fs_extent_goto2(ext2_extent_handle_t handle,
 				     int leaf_level, blk64_t blk);
 extern errcode_t ext2fs_extent_fix_parents(ext2_extent_handle_t handle);
 size_t ext2fs_max_extent_depth(ext2_extent_handle_t handle);
+extern errcode_t ext2fs_extent_build_tree(ext2_filsys fs, ext2_ino_t ino,
+					  struct ext2_inode *inode,
+					  struct ext2fs_extent *extents,
+					  unsigned int count);
 
 /* fallocate.c */
 #define EXT2_FALLOCATE_ZERO_BLOCKS	(0x1)
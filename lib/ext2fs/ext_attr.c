@@ -131,8 +131,13 @@ errcode_t ext2fs_write_ext_attr3(ext2_filsys fs, blk64_t block, void *inbuf,
 #ifdef WORDS_BIGENDIAN
 	ext2fs_free_mem(&write_buf);
 #endif
-	if (!retval)
+	if (!retval) {
 		ext2fs_mark_changed(fs);
+		if (inum)
+			ext2fs_mark_inode_group_dirty(fs, inum);
+		else
+			ext2fs_mark_block_group_dirty(fs, block);
+	}
 	return retval;
 }
 
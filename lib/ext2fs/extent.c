@@ -600,6 +600,9 @@ static errcode_t update_path(ext2_extent_handle_t handle)
 
 		retval = io_channel_write_blk64(handle->fs->io,
 				      blk, 1, handle->path[handle->level].buf);
+		if (!retval)
+			ext2fs_mark_inode_group_dirty(handle->fs,
+						      handle->ino);
 	}
 	return retval;
 }
@@ -1737,6 +1740,174 @@ size_t ext2fs_max_extent_depth(ext2_extent_handle_t handle)
 	return last_result;
 }
 
+/*
+ * Build an inode's extent tree in one pass from an array of extents
+ * sorted by logical block, instead of inserting them one at a time.
+ * Leaves are filled completely, then the index levels are built on top
+ * of them until the remaining entries fit in the inode, so every tree
+ * block is allocated and written exactly once.  Extents longer than
+ * one entry can describe are split.
+ *
+ * The inode must not currently hold a block map or extent tree (any
+ * old tree blocks must already have been released) and must exist on
+ * disk, since its generation is used for the block checksums.  On
+ * return i_block holds the new root and i_blocks includes the tree
+ * blocks; writing the inode back is left to the caller.
+ */
+errcode_t ext2fs_extent_build_tree(ext2_filsys fs, ext2_ino_t ino,
+				   struct ext2_inode *inode,
+				   struct ext2fs_extent *extents,
+				   unsigned int count)
+{
+	struct ext3_extent_header *eh;
+	struct ext3_extent	*leaf = NULL, *ex;
+	struct ext3_extent_idx	*index = NULL, *level = NULL;
+	void			*entries;
+	char			*block_buf = NULL;
+	blk64_t			*tree_blks = NULL, lblk, pblk, len, goal, blk;
+	unsigned int		i, j, n, nr, max_len, piece, depth = 0;
+	unsigned int		root_max, per_block, nr_blks = 0, total;
+	errcode_t		retval;
+
+	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
+
+	/* Flatten into on-disk leaf entries, splitting long extents */
+	for (n = 0, i = 0; i < count; i++) {
+		max_len = (extents[i].e_flags & EXT2_EXTENT_FLAGS_UNINIT) ?
+			EXT_UNINIT_MAX_LEN : EXT_INIT_MAX_LEN;
+		n += (extents[i].e_len + max_len - 1) / max_len;
+	}
+	retval = ext2fs_get_array(n ? n : 1, sizeof(struct ext3_extent),
+				  &leaf);
+	if (retval)
+		return retval;
+	for (ex = leaf, i = 0; i < count; i++) {
+		int uninit = extents[i].e_flags & EXT2_EXTENT_FLAGS_UNINIT;
+
+		max_len = uninit ? EXT_UNINIT_MAX_LEN : EXT_INIT_MAX_LEN;
+		lblk = extents[i].e_lblk;
+		pblk = extents[i].e_pblk;
+		for (len = extents[i].e_len; len; len -= piece, ex++) {
+			piece = len > max_len ? max_len : len;
+			ex->ee_block = ext2fs_cpu_to_le32(lblk);
+			ex->ee_start = ext2fs_cpu_to_le32(pblk & 0xFFFFFFFF);
+			ex->ee_start_hi = ext2fs_cpu_to_le16(pblk >> 32);
+			ex->ee_len = ext2fs_cpu_to_le16(uninit ?
+					piece + EXT_INIT_MAX_LEN : piece);
+			lblk += piece;
+			pblk += piece;
+		}
+	}
+
+	root_max = (sizeof(inode->i_block) - sizeof(*eh)) /
+		sizeof(struct ext3_extent);
+	per_block = (fs->blocksize - sizeof(*eh)) / sizeof(struct ext3_extent);
+	for (total = 0, nr = n; nr > root_max; ) {
+		nr = (nr + per_block - 1) / per_block;
+		total += nr;
+	}
+	if (total) {
+		retval = ext2fs_get_array(total, sizeof(blk64_t), &tree_blks);
+		if (!retval)
+			retval = ext2fs_get_mem(fs->blocksize, &block_buf);
+		if (retval)
+			goto out;
+	}
+
+	entries = leaf;
+	nr = n;
+	while (nr > root_max) {
+		unsigned int nodes = (nr + per_block - 1) / per_block;
+
+		retval = ext2fs_get_array(nodes, sizeof(struct ext3_extent_idx),
+					  &level);
+		if (retval)
+			goto out;
+		for (i = 0; i < nodes; i++) {
+			struct ext3_extent_idx *first = (struct ext3_extent_idx *)
+				entries + i * per_block;
+			unsigned int cnt = nr - i * per_block;
+
+			if (cnt > per_block)
+				cnt = per_block;
+			memset(block_buf, 0, fs->blocksize);
+			eh = (struct ext3_extent_header *) block_buf;
+			eh->eh_magic = ext2fs_cpu_to_le16(EXT3_EXT_MAGIC);
+			eh->eh_entries = ext2fs_cpu_to_le16(cnt);
+			eh->eh_max = ext2fs_cpu_to_le16(per_block);
+			eh->eh_depth = ext2fs_cpu_to_le16(depth);
+			memcpy(EXT_FIRST_INDEX(eh), first,
+			       cnt * sizeof(struct ext3_extent_idx));
+
+			/* Try to put the block before its first child */
+			if (depth == 0)
+				goal = ext2fs_le32_to_cpu(leaf[i * per_block].ee_start) +
+					((__u64) ext2fs_le16_to_cpu(
+					leaf[i * per_block].ee_start_hi) << 32);
+			else
+				goal = ext2fs_le32_to_cpu(first->ei_leaf) +
+					((__u64) ext2fs_le16_to_cpu(
+					first->ei_leaf_hi) << 32);
+			goal -= EXT2FS_CLUSTER_RATIO(fs);
+			goal &= ~EXT2FS_CLUSTER_MASK(fs);
+			if (fs->get_alloc_block)
+				retval = (fs->get_alloc_block)(fs, goal, &blk);
+			else
+				retval = ext2fs_new_block2(fs, goal, 0, &blk);
+			if (retval)
+				goto out;
+			ext2fs_block_alloc_stats2(fs, blk, +1);
+			tree_blks[nr_blks++] = blk;
+
+			retval = ext2fs_extent_block_csum_set(fs, ino, eh);
+			if (retval)
+				goto out;
+			retval = io_channel_write_blk64(fs->io, blk, 1,
+							block_buf);
+			if (retval)
+				goto out;
+
+			level[i].ei_block = first->ei_block;
+			level[i].ei_leaf = ext2fs_cpu_to_le32(blk & 0xFFFFFFFF);
+			level[i].ei_leaf_hi = ext2fs_cpu_to_le16(blk >> 32);
+			level[i].ei_unused = 0;
+		}
+		if (index)
+			ext2fs_free_mem(&index);
+		entries = index = level;
+		level = NULL;
+		nr = nodes;
+		depth++;
+	}
+
+	memset(inode->i_block, 0, sizeof(inode->i_block));
+	eh = (struct ext3_extent_header *) inode->i_block;
+	eh->eh_magic = ext2fs_cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_entries = ext2fs_cpu_to_le16(nr);
+	eh->eh_max = ext2fs_cpu_to_le16(root_max);
+	eh->eh_depth = ext2fs_cpu_to_le16(depth);
+	memcpy(EXT_FIRST_INDEX(eh), entries, nr * sizeof(struct ext3_extent));
+	inode->i_flags |= EXT4_EXTENTS_FL;
+	if (nr_blks)
+		retval = ext2fs_iblk_add_blocks(fs, inode, nr_blks);
+
+out:
+	if (retval) {
+		for (j = 0; j < nr_blks; j++)
+			ext2fs_block_alloc_stats2(fs, tree_blks[j], -1);
+	}
+	if (level)
+		ext2fs_free_mem(&level);
+	if (index)
+		ext2fs_free_mem(&index);
+	if (tree_blks)
+		ext2fs_free_mem(&tree_blks);
+	if (block_buf)
+		ext2fs_free_mem(&block_buf);
+	ext2fs_free_mem(&leaf);
+	return retval;
+}
+
 #ifdef DEBUG
 /*
  * Override debugfs's prompt
@@ -115,6 +115,9 @@ errcode_t ext2fs_alloc_generic_bmap(ext2_filsys fs, errcode_t magic,
 		else
 			ops = &ext2fs_blkmap64_rbtree;
 		break;
+	case EXT2FS_BMAP64_ROARING:
+		ops = &ext2fs_blkmap64_roaring;
+		break;
 	default:
 		return EINVAL;
 	}
@@ -261,6 +264,7 @@ void ext2fs_free_generic_bmap(ext2fs_generic_bitmap bmap)
 	}
 #endif
 
+	ext2fs_bmap_summary_free(bmap);
 	bmap->bitmap_ops->free_bmap(bmap);
 
 	if (bmap->description) {
@@ -357,6 +361,8 @@ errcode_t ext2fs_resize_generic_bmap(ext2fs_generic_bitmap bmap,
 
 	INC_STAT(bmap, resize_count);
 
+	/* The summary is rebuilt by whoever wants it again */
+	ext2fs_bmap_summary_free(bmap);
 	return bmap->bitmap_ops->resize_bmap(bmap, new_end, new_real_end);
 }
 
@@ -385,6 +391,8 @@ errcode_t ext2fs_fudge_generic_bmap_end(ext2fs_generic_bitmap bitmap,
 		return neq;
 	if (oend)
 		*oend = bitmap->end;
+	if (end != bitmap->end)
+		ext2fs_bmap_summary_free(bitmap);
 	bitmap->end = end;
 	return 0;
 }
@@ -421,8 +429,12 @@ void ext2fs_clear_generic_bmap(ext2fs_generic_bitmap bitmap)
 {
 	if (EXT2FS_IS_32_BITMAP(bitmap))
 		ext2fs_clear_generic_bitmap(bitmap);
-	else
+	else {
 		bitmap->bitmap_ops->clear_bmap (bitmap);
+		if (bitmap->summary)
+			ext2fs_bmap_summary_dirty(bitmap, bitmap->start,
+					bitmap->end - bitmap->start + 1);
+	}
 }
 
 int ext2fs_mark_generic_bmap(ext2fs_generic_bitmap bitmap,
@@ -459,6 +471,8 @@ int ext2fs_mark_generic_bmap(ext2fs_generic_bitmap bitmap,
 		return 0;
 	}
 
+	if (bitmap->summary)
+		ext2fs_bmap_summary_dirty(bitmap, arg, 1);
 	return bitmap->bitmap_ops->mark_bmap(bitmap, arg);
 }
 
@@ -489,6 +503,8 @@ int ext2fs_unmark_generic_bmap(ext2fs_generic_bitmap bitmap,
 		return 0;
 	}
 
+	if (bitmap->summary)
+		ext2fs_bmap_summary_dirty(bitmap, arg, 1);
 	return bitmap->bitmap_ops->unmark_bmap(bitmap, arg);
 }
 
@@ -551,6 +567,8 @@ errcode_t ext2fs_set_generic_bmap_range(ext2fs_generic_bitmap bmap,
 
 	INC_STAT(bmap, set_range_count);
 
+	if (bmap->summary)
+		ext2fs_bmap_summary_dirty(bmap, start, num);
 	return bmap->bitmap_ops->set_bmap_range(bmap, start, num, in);
 }
 
@@ -701,6 +719,8 @@ void ext2fs_mark_block_bitmap_range2(ext2fs_block_bitmap bmap,
 		return;
 	}
 
+	if (bmap->summary)
+		ext2fs_bmap_summary_dirty(bmap, block, num);
 	bmap->bitmap_ops->mark_bmap_extent(bmap, block, num);
 }
 
@@ -739,6 +759,8 @@ void ext2fs_unmark_block_bitmap_range2(ext2fs_block_bitmap bmap,
 		return;
 	}
 
+	if (bmap->summary)
+		ext2fs_bmap_summary_dirty(bmap, block, num);
 	bmap->bitmap_ops->unmark_bmap_extent(bmap, block, num);
 }
 
@@ -905,3 +927,70 @@ errcode_t ext2fs_find_first_set_generic_bmap(ext2fs_generic_bitmap bitmap,
 
 	return ENOENT;
 }
+
+/*
+ * Count the bits set between start and end, inclusive.  For cluster
+ * bitmaps this is the number of clusters in use.
+ */
+errcode_t ext2fs_count_set_generic_bmap(ext2fs_generic_bitmap bitmap,
+					__u64 start, __u64 end, __u64 *out)
+{
+	unsigned char *buf, tail;
+	__u64 cstart, cend, count = 0, pos, n;
+	errcode_t retval;
+
+	if (!bitmap)
+		return EINVAL;
+
+	if (EXT2FS_IS_32_BITMAP(bitmap)) {
+		if (((start) & ~0xffffffffULL) ||
+		    ((end) & ~0xffffffffULL) || start > end) {
+			ext2fs_warn_bitmap2(bitmap, EXT2FS_TEST_ERROR, start);
+			return EINVAL;
+		}
+		for (pos = start; pos <= end; pos++)
+			if (ext2fs_test_generic_bitmap(bitmap, pos))
+				count++;
+		*out = count;
+		return 0;
+	}
+
+	if (!EXT2FS_IS_64_BITMAP(bitmap))
+		return EINVAL;
+
+	cstart = start >> bitmap->cluster_bits;
+	cend = end >> bitmap->cluster_bits;
+
+	if (cstart < bitmap->start || cend > bitmap->end || start > end) {
+		warn_bitmap(bitmap, EXT2FS_TEST_ERROR, start);
+		return EINVAL;
+	}
+
+	if (bitmap->bitmap_ops->count_set)
+		return bitmap->bitmap_ops->count_set(bitmap, cstart, cend, out);
+
+	/* Count a chunk at a time from the backend's range dump */
+	retval = ext2fs_get_mem(8192, &buf);
+	if (retval)
+		return retval;
+	for (pos = cstart; pos <= cend; pos += n) {
+		n = cend - pos + 1;
+		if (n > 8192 * 8)
+			n = 8192 * 8;
+		/* Backends may only set the bits which are in use */
+		memset(buf, 0, (n + 7) >> 3);
+		retval = bitmap->bitmap_ops->get_bmap_range(bitmap, pos, n,
+							    buf);
+		if (retval)
+			break;
+		count += ext2fs_bitcount(buf, n >> 3);
+		if (n & 7) {
+			tail = buf[n >> 3] & ((1 << (n & 7)) - 1);
+			count += ext2fs_bitcount(&tail, 1);
+		}
+	}
+	ext2fs_free_mem(&buf);
+	if (!retval)
+		*out = count;
+	return retval;
+}
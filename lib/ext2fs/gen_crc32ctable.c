@@ -75,6 +75,77 @@ static void crc32init_be(void)
 	}
 }
 
+/*
+ * GF(2) matrix helpers used to build the tables that shift a crc32c
+ * over a run of zero bytes, for combining interleaved crcs.
+ */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Build the operator for len zero bytes; len must be a power of two */
+static void crc32c_zeros_op(uint32_t *even, size_t len)
+{
+	uint32_t odd[32], row = 1;
+	int n;
+
+	/* operator for one zero bit */
+	odd[0] = CRC32C_POLY_LE;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd);	/* two zero bits */
+	gf2_matrix_square(odd, even);	/* four zero bits */
+
+	/* the next square yields one zero byte, then two, four... */
+	do {
+		gf2_matrix_square(even, odd);
+		len >>= 1;
+		if (len == 0)
+			return;
+		gf2_matrix_square(odd, even);
+		len >>= 1;
+	} while (len);
+
+	for (n = 0; n < 32; n++)
+		even[n] = odd[n];
+}
+
+static void crc32c_zeros(uint32_t (*zeros)[256], size_t len)
+{
+	uint32_t op[32];
+	uint32_t n;
+
+	crc32c_zeros_op(op, len);
+	for (n = 0; n < 256; n++) {
+		zeros[0][n] = gf2_matrix_times(op, n);
+		zeros[1][n] = gf2_matrix_times(op, n << 8);
+		zeros[2][n] = gf2_matrix_times(op, n << 16);
+		zeros[3][n] = gf2_matrix_times(op, n << 24);
+	}
+}
+
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
 static void output_table(uint32_t (*table)[256], int rows, int len, char *trans)
 {
 	int i, j;
@@ -113,5 +184,15 @@ int main(int argc, char **argv)
 		printf("};\n");
 	}
 
+	/* These are only used with native (little endian) words */
+	crc32c_zeros(crc32c_long, CRC32C_LONG);
+	printf("static const uint32_t crc32c_long[4][256] = {");
+	output_table(crc32c_long, 4, 256, "");
+	printf("};\n");
+	crc32c_zeros(crc32c_short, CRC32C_SHORT);
+	printf("static const uint32_t crc32c_short[4][256] = {");
+	output_table(crc32c_short, 4, 256, "");
+	printf("};\n");
+
 	return 0;
 }
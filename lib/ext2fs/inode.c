@@ -400,6 +400,42 @@ static int extent_head_looks_insane(struct ext2_inode_large *inode)
 	return 1;
 }
 
+/*
+ * Without EXT2_SF_WARN_GARBAGE_INODES we only record which of the blocks
+ * just read have nothing but good inode checksums, so that
+ * ext2fs_get_next_inode_full() need not verify their inodes one by one.
+ */
+static void check_inode_block_csums(ext2_inode_scan scan, blk64_t num_blocks)
+{
+	ext2_ino_t	ino, inodes_to_scan;
+	unsigned int	inodes_per_block, count, blk;
+	char		*block_status;
+	__u32		bad_mask[EXT2_MAX_BLOCK_SIZE /
+				 EXT2_GOOD_OLD_INODE_SIZE / 32];
+
+	block_status = SCAN_BLOCK_STATUS(scan);
+	memset(block_status, 0, scan->inode_buffer_blocks);
+	inodes_per_block = EXT2_INODES_PER_BLOCK(scan->fs->super);
+	if (!ext2fs_has_feature_metadata_csum(scan->fs->super) ||
+	    inodes_per_block < 2 ||
+	    (scan->current_inode % inodes_per_block) != 0)
+		return;
+
+	inodes_to_scan = scan->inodes_left;
+	ino = scan->current_inode + 1;
+	for (blk = 0; blk < num_blocks && inodes_to_scan; blk++) {
+		count = inodes_per_block;
+		if (count > inodes_to_scan)
+			count = inodes_to_scan;
+		if (ext2fs_inode_table_csum_verify_block(scan->fs, ino,
+				scan->inode_buffer + blk * scan->fs->blocksize,
+				count, bad_mask) == 0)
+			block_status[blk] |= IBLOCK_STATUS_CSUMS_OK;
+		ino += count;
+		inodes_to_scan -= count;
+	}
+}
+
 /*
  * Check all the inodes that we just read into the buffer.  Record what we
  * find here -- currently, we can observe that all checksums are ok; more
@@ -414,9 +450,15 @@ static void check_inode_block_sanity(ext2_inode_scan scan, blk64_t num_blocks)
 	struct ext2_inode_large *inode;
 	char		*block_status;
 	unsigned int	blk, bad_csum;
+	unsigned int	batch_left = 0;
+	ext2_ino_t	batch_ino = 0;
+	__u32		bad_mask[EXT2_MAX_BLOCK_SIZE /
+				 EXT2_GOOD_OLD_INODE_SIZE / 32];
 
-	if (!(scan->scan_flags & EXT2_SF_WARN_GARBAGE_INODES))
+	if (!(scan->scan_flags & EXT2_SF_WARN_GARBAGE_INODES)) {
+		check_inode_block_csums(scan, num_blocks);
 		return;
+	}
 
 	inodes_to_scan = scan->inodes_left;
 	inodes_in_buf = num_blocks * scan->fs->blocksize / scan->inode_size;
@@ -440,8 +482,19 @@ static void check_inode_block_sanity(ext2_inode_scan scan, blk64_t num_blocks)
 
 	while (inodes_to_scan > 0) {
 		blk = (p - (char *)scan->inode_buffer) / scan->fs->blocksize;
-		bad_csum = ext2fs_inode_csum_verify(scan->fs, ino,
-				(struct ext2_inode_large *) p) == 0;
+		/* Verify the rest of this block's inodes in one go */
+		if (batch_left == 0) {
+			batch_left = inodes_per_block -
+					((ino - 1) % inodes_per_block);
+			if (batch_left > inodes_to_scan)
+				batch_left = inodes_to_scan;
+			batch_ino = ino;
+			ext2fs_inode_table_csum_verify_block(scan->fs, ino, p,
+							     batch_left,
+							     bad_mask);
+		}
+		bad_csum = (bad_mask[(ino - batch_ino) / 32] >>
+			    ((ino - batch_ino) % 32)) & 1;
 
 #ifdef WORDS_BIGENDIAN
 		ext2fs_swap_inode_full(scan->fs,
@@ -473,6 +526,7 @@ static void check_inode_block_sanity(ext2_inode_scan scan, blk64_t num_blocks)
 			p += scan->inode_size * ino_adj;
 			ino += ino_adj;
 			checksum_failures = badness = 0;
+			batch_left = 0;
 			continue;
 		}
 
@@ -482,6 +536,7 @@ static void check_inode_block_sanity(ext2_inode_scan scan, blk64_t num_blocks)
 			checksum_failures = badness = 0;
 		}
 		inodes_to_scan--;
+		batch_left--;
 		p += scan->inode_size;
 		ino++;
 	};
@@ -970,6 +1025,7 @@ errcode_t ext2fs_write_inode_full(ext2_filsys fs, ext2_ino_t ino,
 	}
 
 	fs->flags |= EXT2_FLAG_CHANGED;
+	ext2fs_mark_group_dirty(fs, group);
 errout:
 	ext2fs_free_mem(&w_inode);
 	return retval;
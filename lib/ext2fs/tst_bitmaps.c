@@ -35,6 +35,10 @@ static char version[] = "1.0";
 ext2_filsys	test_fs;
 int		exit_status = 0;
 
+/* Backend and flags given on the command line, the default for setup */
+static unsigned int	bitmap_type = EXT2FS_BMAP64_BITARRAY;
+static int		bitmap_flags = EXT2_FLAG_64BITS;
+
 static int source_file(const char *cmd_file, int sci_idx)
 {
 	FILE		*f;
@@ -195,8 +199,8 @@ void setup_cmd(int argc, char **argv)
 	int		c, err;
 	unsigned int	blocks = 128;
 	unsigned int	inodes = 0;
-	unsigned int	type = EXT2FS_BMAP64_BITARRAY;
-	int		flags = EXT2_FLAG_64BITS;
+	unsigned int	type = bitmap_type;
+	int		flags = bitmap_flags;
 
 	if (test_fs)
 		ext2fs_close_free(&test_fs);
@@ -621,6 +625,111 @@ void do_ffsi(int argc, char *argv[])
 	printf("First marked inode is %u\n", out);
 }
 
+void do_countb(int argc, char *argv[])
+{
+	unsigned int start, end;
+	int err;
+	errcode_t retval;
+	blk64_t out;
+
+	if (check_fs_open(argv[0]))
+		return;
+
+	if (argc != 3) {
+		com_err(argv[0], 0, "Usage: countb <start> <end>");
+		return;
+	}
+
+	start = parse_ulong(argv[1], argv[0], "start", &err);
+	if (err)
+		return;
+
+	end = parse_ulong(argv[2], argv[0], "end", &err);
+	if (err)
+		return;
+
+	retval = ext2fs_count_set_block_bitmap2(test_fs->block_map,
+						start, end, &out);
+	if (retval) {
+		printf("ext2fs_count_set_block_bitmap2() returned %s\n",
+		       error_message(retval));
+		return;
+	}
+	printf("Marked blocks: %llu\n", out);
+}
+
+void do_ffzrb(int argc, char *argv[])
+{
+	unsigned int start, end, len;
+	int err;
+	errcode_t retval;
+	__u64 out;
+
+	if (check_fs_open(argv[0]))
+		return;
+
+	if (argc != 4) {
+		com_err(argv[0], 0, "Usage: ffzrb <start> <end> <len>");
+		return;
+	}
+
+	start = parse_ulong(argv[1], argv[0], "start", &err);
+	if (err)
+		return;
+
+	end = parse_ulong(argv[2], argv[0], "end", &err);
+	if (err)
+		return;
+
+	len = parse_ulong(argv[3], argv[0], "len", &err);
+	if (err)
+		return;
+
+	/* 32-bit bitmaps can't carry a summary; the search still works */
+	(void) ext2fs_enable_generic_bmap_summary(test_fs->block_map);
+	retval = ext2fs_find_first_zero_run_generic_bmap(test_fs->block_map,
+							 start, end, len, &out);
+	if (retval) {
+		printf("ext2fs_find_first_zero_run_generic_bmap() returned %s\n",
+		       error_message(retval));
+		return;
+	}
+	printf("First possible free run starts at %llu\n", out);
+}
+
+void do_counti(int argc, char *argv[])
+{
+	unsigned int start, end;
+	int err;
+	errcode_t retval;
+	ext2_ino_t out;
+
+	if (check_fs_open(argv[0]))
+		return;
+
+	if (argc != 3) {
+		com_err(argv[0], 0, "Usage: counti <start> <end>");
+		return;
+	}
+
+	start = parse_ulong(argv[1], argv[0], "start", &err);
+	if (err)
+		return;
+
+	end = parse_ulong(argv[2], argv[0], "end", &err);
+	if (err)
+		return;
+
+	retval = ext2fs_count_set_inode_bitmap2(test_fs->inode_map,
+						start, end, &out);
+	if (retval) {
+		printf("ext2fs_count_set_inode_bitmap2() returned %s\n",
+		       error_message(retval));
+		return;
+	}
+	printf("Marked inodes: %u\n", out);
+}
+
 void do_zeroi(int argc, char *argv[])
 {
 	if (check_fs_open(argv[0]))
@@ -630,6 +739,176 @@ void do_zeroi(int argc, char *argv[])
 	ext2fs_clear_inode_bitmap(test_fs->inode_map);
 }
 
+/*
+ * Benchmark the bitmap backends against each other on the block
+ * bitmap of the current file system.  The rbtree timings are only
+ * meaningful in tst_bitmaps_bench, since tst_bitmaps checks the whole
+ * tree after every operation.
+ */
+static const char *bench_type_names[] = {
+	NULL, "bitarray", "rbtree", NULL, "roaring"
+};
+
+static unsigned long bench_rand(unsigned long *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7fffffff;
+}
+
+struct bench_result {
+	unsigned long	tested;
+	unsigned long	runs;
+	unsigned long	counted;
+	unsigned long	csum;
+};
+
+static const char *bench_workloads[] = { "extents", "random", "full" };
+
+static double bench_secs(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static errcode_t bench_one(int type, int workload, unsigned long nops,
+			   unsigned char *buf, struct bench_result *res)
+{
+	ext2fs_block_bitmap bmap;
+	blk64_t		first = test_fs->super->s_first_data_block;
+	blk64_t		last = ext2fs_blocks_count(test_fs->super) - 1;
+	blk64_t		blk, out, used;
+	unsigned long	seed = 1, i, len;
+	int		save_type = test_fs->default_bitmap_type;
+	double		t_fill, t_test, t_scan, t_count, t_get;
+	clock_t		start;
+	errcode_t	retval;
+
+	test_fs->default_bitmap_type = type;
+	retval = ext2fs_allocate_block_bitmap(test_fs, "bench bitmap", &bmap);
+	test_fs->default_bitmap_type = save_type;
+	if (retval)
+		return retval;
+	memset(res, 0, sizeof(struct bench_result));
+
+	start = clock();
+	if (workload == 0) {
+		/* Mostly allocated, with small free holes */
+		for (blk = first; blk <= last; blk += len) {
+			len = bench_rand(&seed) % 512 + 1;
+			if (blk + len > last)
+				len = last - blk + 1;
+			ext2fs_mark_block_bitmap_range2(bmap, blk, len);
+			blk += len;
+			len = bench_rand(&seed) % 64 + 1;
+		}
+	} else if (workload == 1) {
+		/* Sparse random bits */
+		for (i = 0; i < nops; i++)
+			ext2fs_mark_block_bitmap2(bmap, first +
+				bench_rand(&seed) % (last - first + 1));
+	} else {
+		/* Nearly full, with a few scattered free blocks */
+		ext2fs_mark_block_bitmap_range2(bmap, first, last - first + 1);
+		for (i = 0; i < nops / 1000; i++)
+			ext2fs_unmark_block_bitmap2(bmap, first +
+				bench_rand(&seed) % (last - first + 1));
+	}
+	t_fill = bench_secs(start);
+
+	start = clock();
+	for (i = 0; i < nops; i++)
+		res->tested += !!ext2fs_test_block_bitmap2(bmap, first +
+				bench_rand(&seed) % (last - first + 1));
+	t_test = bench_secs(start);
+
+	start = clock();
+	for (blk = first; blk <= last; blk = out + 1) {
+		if (ext2fs_find_first_set_block_bitmap2(bmap, blk, last,
+							&out))
+			break;
+		res->runs++;
+		if (ext2fs_find_first_zero_block_bitmap2(bmap, out, last,
+							 &out))
+			break;
+	}
+	t_scan = bench_secs(start);
+
+	start = clock();
+	for (blk = first; blk <= last; blk += 32768) {
+		if (ext2fs_count_set_block_bitmap2(bmap, blk,
+				blk + 32767 > last ? last : blk + 32767,
+				&used))
+			break;
+		res->counted += used;
+	}
+	t_count = bench_secs(start);
+
+	start = clock();
+	retval = ext2fs_get_block_bitmap_range2(bmap, first,
+						last - first + 1, buf);
+	t_get = bench_secs(start);
+	ext2fs_free_block_bitmap(bmap);
+	if (retval)
+		return retval;
+	/* The bitarray backend copies whole bytes, so ignore the tail */
+	for (i = 0; i < (last - first + 1) / 8; i++)
+		res->csum = res->csum * 31 + buf[i];
+
+	printf("%-8s %-8s fill %7.3fs  test %7.3fs  scan %7.3fs  "
+	       "count %7.3fs  get_range %7.3fs\n", bench_workloads[workload],
+	       bench_type_names[type], t_fill, t_test, t_scan, t_count, t_get);
+	return 0;
+}
+
+void do_bench(int argc, char *argv[])
+{
+	static const int types[] = { EXT2FS_BMAP64_BITARRAY,
+				     EXT2FS_BMAP64_RBTREE,
+				     EXT2FS_BMAP64_ROARING };
+	struct bench_result res, ref;
+	unsigned long	nops = 1000000;
+	unsigned char	*buf;
+	unsigned int	t;
+	int		workload, err;
+	errcode_t	retval;
+
+	if (check_fs_open(argv[0]))
+		return;
+	if (argc > 2) {
+		com_err(argv[0], 0, "Usage: bench [ops]");
+		return;
+	}
+	if (argc == 2) {
+		nops = parse_ulong(argv[1], argv[0], "number of ops", &err);
+		if (err)
+			return;
+	}
+
+	buf = malloc((ext2fs_blocks_count(test_fs->super) + 7) / 8);
+	if (!buf) {
+		com_err(argv[0], 0, "couldn't allocate buffer");
+		return;
+	}
+	for (workload = 0; workload < 3; workload++) {
+		for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+			retval = bench_one(types[t], workload, nops, buf,
+					   t ? &res : &ref);
+			if (retval) {
+				com_err(argv[0], retval, "while running %s "
+					"benchmark", bench_type_names[types[t]]);
+				goto out;
+			}
+			if (t && memcmp(&res, &ref, sizeof(res))) {
+				printf("%s results differ from %s!\n",
+				       bench_type_names[types[t]],
+				       bench_type_names[types[0]]);
+				exit_status++;
+			}
+		}
+	}
+out:
+	free(buf);
+}
+
 int main(int argc, char **argv)
 {
 	unsigned int	blocks = 128;
@@ -695,6 +974,8 @@ int main(int argc, char **argv)
 	printf("%s %s.  Type '?' for a list of commands.\n\n",
 	       subsystem_name, version);
 
+	bitmap_type = type;
+	bitmap_flags = flags;
 	setup_filesystem(argv[0], blocks, inodes, type, flags);
 
 	if (request) {
@@ -1,6 +1,7 @@
 LOCAL_PATH := $(call my-dir)
 
 libext2_quota_src_files := \
+	arena.c \
 	dict.c \
 	mkquota.c \
 	parse_qtype.c \
@@ -0,0 +1,168 @@
+/*
+ * arena.c --- bulk allocator for short-lived bookkeeping structures
+ *
+ * Programs like e2fsck build up millions of small records (list
+ * elements, tree nodes, per-directory arrays) that all die together at
+ * the end of a pass.  Allocating each of them with malloc() costs a
+ * header per object and a free() per object at teardown.  An arena
+ * carves objects out of large chunks instead, keeps a free list per
+ * size class so that objects released early can be reused, and hands
+ * all of its chunks back at once in arena_release().
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct arena_chunk {
+	struct arena_chunk	*next;
+	size_t			size;
+};
+
+#define ARENA_HDR_SIZE	((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & \
+			 ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_ROUND(x)	(((x) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+static unsigned long long arena_in_use;
+static unsigned long long arena_peak;
+static unsigned long long arena_max_peak;
+
+static void arena_account(struct arena *a, long long delta)
+{
+	a->reserved += delta;
+	arena_in_use += delta;
+	if (arena_in_use > arena_peak)
+		arena_peak = arena_in_use;
+	if (arena_peak > arena_max_peak)
+		arena_max_peak = arena_peak;
+}
+
+void arena_init(struct arena *a, size_t chunk_size)
+{
+	memset(a, 0, sizeof(struct arena));
+	a->chunk_size = chunk_size;
+}
+
+static struct arena_chunk *arena_new_chunk(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+
+	c = malloc(ARENA_HDR_SIZE + size);
+	if (!c)
+		return NULL;
+	c->size = ARENA_HDR_SIZE + size;
+	c->next = a->chunks;
+	a->chunks = c;
+	arena_account(a, c->size);
+	return c;
+}
+
+/*
+ * Returns zeroed memory, or NULL if we are out of memory.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+	unsigned int	cls;
+	void		*ret;
+
+	if (!a->chunk_size)
+		a->chunk_size = ARENA_DEFAULT_CHUNK;
+	size = size ? ARENA_ROUND(size) : ARENA_ALIGN;
+
+	cls = size / ARENA_ALIGN - 1;
+	if (cls < ARENA_NUM_CLASSES && a->free_list[cls]) {
+		ret = a->free_list[cls];
+		a->free_list[cls] = *(void **) ret;
+		goto out;
+	}
+
+	/*
+	 * Big objects get a chunk of their own so they don't waste the
+	 * tail of the current chunk.
+	 */
+	if (size > a->chunk_size / 4) {
+		c = arena_new_chunk(a, size);
+		if (!c)
+			return NULL;
+		ret = (char *) c + ARENA_HDR_SIZE;
+		goto out;
+	}
+
+	if (size > a->avail) {
+		c = arena_new_chunk(a, a->chunk_size);
+		if (!c)
+			return NULL;
+		a->next = (char *) c + ARENA_HDR_SIZE;
+		a->avail = a->chunk_size;
+	}
+	ret = a->next;
+	a->next += size;
+	a->avail -= size;
+out:
+	memset(ret, 0, size);
+	return ret;
+}
+
+/*
+ * Give an object back early.  Small objects are kept for reuse by
+ * later allocations of the same size; the memory of anything else is
+ * only returned by arena_release().
+ */
+void arena_free(struct arena *a, void *ptr, size_t size)
+{
+	unsigned int	cls;
+
+	if (!ptr)
+		return;
+	size = size ? ARENA_ROUND(size) : ARENA_ALIGN;
+	cls = size / ARENA_ALIGN - 1;
+	if (cls >= ARENA_NUM_CLASSES)
+		return;
+	*(void **) ptr = a->free_list[cls];
+	a->free_list[cls] = ptr;
+}
+
+/*
+ * Free every object allocated from the arena.  The arena stays usable
+ * afterwards.
+ */
+void arena_release(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+	size_t		chunk_size = a->chunk_size;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	arena_in_use -= a->reserved;
+	arena_init(a, chunk_size);
+}
+
+void arena_usage(unsigned long long *in_use, unsigned long long *peak,
+		 unsigned long long *max_peak)
+{
+	if (in_use)
+		*in_use = arena_in_use;
+	if (peak)
+		*peak = arena_peak;
+	if (max_peak)
+		*max_peak = arena_max_peak;
+}
+
+/*
+ * Start a new measurement interval for the peak returned by
+ * arena_usage(); the overall maximum is not affected.
+ */
+void arena_reset_peak(void)
+{
+	arena_peak = arena_in_use;
+}
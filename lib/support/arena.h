@@ -0,0 +1,46 @@
+/*
+ * arena.h --- bulk allocator for short-lived bookkeeping structures
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#ifndef _SUPPORT_ARENA_H
+#define _SUPPORT_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN		8
+#define ARENA_NUM_CLASSES	32	/* free lists for 8..256 bytes */
+#define ARENA_DEFAULT_CHUNK	65536
+
+struct arena_chunk;
+
+/*
+ * An all-zero struct arena is a valid, empty arena using the default
+ * chunk size, so arenas can live in zeroed contexts without being
+ * explicitly initialized.
+ */
+struct arena {
+	struct arena_chunk	*chunks;
+	char			*next;		/* free space in chunks */
+	size_t			avail;
+	size_t			chunk_size;
+	void			*free_list[ARENA_NUM_CLASSES];
+	unsigned long long	reserved;	/* bytes held by this arena */
+};
+
+extern void arena_init(struct arena *a, size_t chunk_size);
+extern void *arena_alloc(struct arena *a, size_t size);
+extern void arena_free(struct arena *a, void *ptr, size_t size);
+extern void arena_release(struct arena *a);
+
+/* Usage summed over all arenas in the program */
+extern void arena_usage(unsigned long long *in_use,
+			unsigned long long *peak,
+			unsigned long long *max_peak);
+extern void arena_reset_peak(void);
+
+#endif /* _SUPPORT_ARENA_H */
@@ -129,9 +129,132 @@ static errcode_t set_inode_extra(ext2_filsys fs, ext2_ino_t ino,
 	return retval;
 }
 
+/*
+ * Many inodes carry the same extended attributes (SELinux labels, for
+ * instance).  The EA blocks written so far are remembered by a hash of
+ * their contents, so that later inodes with identical attributes can
+ * share a block instead of each getting their own copy.
+ */
+#define XATTR_CACHE_HASH	1024	/* must be a power of two */
+#define XATTR_CACHE_MAX		4096
+
+struct xattr_block_s {
+	blk64_t	blk;
+	__u32	hash;
+	int	next;		/* next entry in the same hash chain, or -1 */
+	char	*data;		/* contents, refcount and checksum zeroed */
+};
+
+struct xattr_cache_s {
+	int			count;
+	struct xattr_block_s	ent[XATTR_CACHE_MAX];
+	int			hash[XATTR_CACHE_HASH];
+};
+
+static errcode_t xattr_cache_init(struct xattr_cache_s **ret)
+{
+	struct xattr_cache_s *cache;
+	errcode_t retval;
+	int i;
+
+	retval = ext2fs_get_memzero(sizeof(struct xattr_cache_s), &cache);
+	if (retval)
+		return retval;
+	for (i = 0; i < XATTR_CACHE_HASH; i++)
+		cache->hash[i] = -1;
+	*ret = cache;
+	return 0;
+}
+
+static void xattr_cache_free(struct xattr_cache_s *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++)
+		ext2fs_free_mem(&cache->ent[i].data);
+	ext2fs_free_mem(&cache);
+}
+
 #ifdef HAVE_LLISTXATTR
+/*
+ * If the EA block just written for ino matches one that is already in
+ * the cache, point the inode at the cached block and free its own.
+ * Otherwise remember the new block.
+ */
+static errcode_t share_xattr_block(ext2_filsys fs, ext2_ino_t ino,
+				   struct xattr_cache_s *cache)
+{
+	struct ext2_inode		inode;
+	struct ext2_ext_attr_header	*header;
+	struct xattr_block_s		*ent;
+	char				*buf;
+	blk64_t				blk;
+	__u32				hash, refcount;
+	errcode_t			retval;
+	int				i;
+
+	retval = ext2fs_read_inode(fs, ino, &inode);
+	if (retval)
+		return retval;
+	blk = ext2fs_file_acl_block(fs, &inode);
+	if (!blk)
+		return 0;
+
+	retval = ext2fs_get_mem(fs->blocksize, &buf);
+	if (retval)
+		return retval;
+	retval = ext2fs_read_ext_attr3(fs, blk, buf, ino);
+	if (retval)
+		goto out;
+	header = (struct ext2_ext_attr_header *) buf;
+	if (header->h_refcount != 1 || header->h_blocks != 1)
+		goto out;
+	header->h_refcount = 0;
+	header->h_checksum = 0;
+	hash = ext2fs_crc32c_le(~0, (unsigned char *) buf, fs->blocksize);
+
+	for (i = cache->hash[hash & (XATTR_CACHE_HASH - 1)]; i >= 0;
+	     i = ent->next) {
+		ent = &cache->ent[i];
+		if (ent->hash != hash ||
+		    memcmp(ent->data, buf, fs->blocksize))
+			continue;
+		retval = ext2fs_adjust_ea_refcount3(fs, ent->blk, NULL, +1,
+						    &refcount, ino);
+		if (retval)
+			goto out;
+		if (refcount > EXT2_EXT_ATTR_REFCOUNT_MAX) {
+			/* That one is full; share ours from now on */
+			retval = ext2fs_adjust_ea_refcount3(fs, ent->blk, NULL,
+							    -1, NULL, ino);
+			ent->blk = blk;
+			goto out;
+		}
+		ext2fs_file_acl_block_set(fs, &inode, ent->blk);
+		retval = ext2fs_write_inode(fs, ino, &inode);
+		if (retval)
+			goto out;
+		ext2fs_block_alloc_stats2(fs, blk, -1);
+		goto out;
+	}
+
+	if (cache->count < XATTR_CACHE_MAX) {
+		ent = &cache->ent[cache->count];
+		ent->blk = blk;
+		ent->hash = hash;
+		ent->data = buf;
+		buf = NULL;
+		ent->next = cache->hash[hash & (XATTR_CACHE_HASH - 1)];
+		cache->hash[hash & (XATTR_CACHE_HASH - 1)] = cache->count++;
+	}
+out:
+	ext2fs_free_mem(&buf);
+	return retval;
+}
+
 static errcode_t set_inode_xattr(ext2_filsys fs, ext2_ino_t ino,
-				 const char *filename)
+				 const char *filename,
+				 struct xattr_cache_s *cache)
 {
 	errcode_t			retval, close_retval;
 	struct ext2_xattr_handle	*handle;
@@ -217,13 +340,20 @@ static errcode_t set_inode_xattr(ext2_filsys fs, ext2_ino_t ino,
 		com_err(__func__, retval, _("while closing inode %u"), ino);
 		retval = retval ? retval : close_retval;
 	}
+	if (retval == 0 && cache) {
+		retval = share_xattr_block(fs, ino, cache);
+		if (retval)
+			com_err(__func__, retval,
+				_("while sharing attribute block of inode %u"),
+				ino);
+	}
 	return retval;
-	return 0;
 }
 #else /* HAVE_LLISTXATTR */
 static errcode_t set_inode_xattr(ext2_filsys fs EXT2FS_ATTR((unused)),
 				 ext2_ino_t ino EXT2FS_ATTR((unused)),
-				 const char *filename EXT2FS_ATTR((unused)))
+				 const char *filename EXT2FS_ATTR((unused)),
+				 struct xattr_cache_s *cache EXT2FS_ATTR((unused)))
 {
 	return 0;
 }
@@ -398,16 +528,233 @@ static ssize_t my_pread(int fd, void *buf, size_t count, off_t offset)
 }
 #endif /* !defined HAVE_PREAD64 && !defined HAVE_PREAD */
 
+/*
+ * Data of extent-mapped files bypasses the ext2_file buffer: each run
+ * of non-zero blocks is allocated and mapped as a whole and written
+ * straight to the device.
+ */
+static int copy_file_direct(ext2_filsys fs, ext2_file_t e2_file)
+{
+	struct ext2_inode *inode = ext2fs_file_get_inode(e2_file);
+
+	return (inode->i_flags & EXT4_EXTENTS_FL) &&
+		!(inode->i_flags & EXT4_INLINE_DATA_FL) &&
+		EXT2FS_CLUSTER_RATIO(fs) == 1;
+}
+
+/*
+ * Allocate and map count blocks at lblk if it lies beyond the last
+ * mapped block of the file, and set *mapped.  The run goes right after
+ * the file's last block, or, for the first run, into free space that
+ * can hold the whole file, so files end up in one piece whenever
+ * possible.  Otherwise nothing is done and *mapped is cleared.
+ *
+ * ext2fs_fallocate() can't be used here: it never lengthens initialized
+ * extents without zeroing the new blocks, and it places a run that
+ * follows a hole as far from the previous extent as the hole is long.
+ */
+static errcode_t copy_map_run(ext2_filsys fs, ext2_ino_t ino,
+			      struct ext2_inode *inode, blk64_t lblk,
+			      blk64_t count, int *mapped)
+{
+	ext2_extent_handle_t	handle;
+	struct ext2fs_extent	last, newex;
+	blk64_t			goal, pblk, plen;
+	errcode_t		err;
+	int			have_last = 0;
+
+	*mapped = 0;
+	err = ext2fs_extent_open2(fs, ino, inode, &handle);
+	if (err)
+		return err;
+	if (ext2fs_inode_data_blocks2(fs, inode) &&
+	    ext2fs_extent_get(handle, EXT2_EXTENT_LAST_LEAF, &last) == 0) {
+		if (lblk < last.e_lblk + last.e_len)
+			goto out;
+		have_last = 1;
+		goal = last.e_pblk + last.e_len;
+	} else {
+		goal = ext2fs_find_inode_goal(fs, ino, inode, 0);
+		plen = (EXT2_I_SIZE(inode) + fs->blocksize - 1) /
+			fs->blocksize;
+		if (ext2fs_new_range(fs, EXT2_NEWRANGE_MIN_LENGTH, goal, plen,
+				     NULL, &pblk, &plen) == 0)
+			goal = pblk;
+	}
+
+	*mapped = 1;
+	while (count) {
+		err = ext2fs_new_range(fs, 0, goal, count, NULL, &pblk, &plen);
+		if (err)
+			goto out;
+		if (plen > EXT_INIT_MAX_LEN)
+			plen = EXT_INIT_MAX_LEN;
+		ext2fs_block_alloc_stats_range(fs, pblk, plen, +1);
+
+		if (have_last && !(last.e_flags & EXT2_EXTENT_FLAGS_UNINIT) &&
+		    last.e_lblk + last.e_len == lblk &&
+		    last.e_pblk + last.e_len == pblk &&
+		    last.e_len + plen <= EXT_INIT_MAX_LEN) {
+			last.e_len += plen;
+			err = ext2fs_extent_replace(handle, 0, &last);
+		} else {
+			newex.e_lblk = lblk;
+			newex.e_pblk = pblk;
+			newex.e_len = plen;
+			newex.e_flags = 0;
+			err = ext2fs_extent_insert(handle, have_last ?
+						   EXT2_EXTENT_INSERT_AFTER : 0,
+						   &newex);
+			last = newex;
+		}
+		if (err) {
+			ext2fs_block_alloc_stats_range(fs, pblk, plen, -1);
+			goto out;
+		}
+		have_last = 1;
+		err = ext2fs_extent_fix_parents(handle);
+		if (err)
+			goto out;
+		ext2fs_iblk_add_blocks(fs, inode, plen);
+
+		lblk += plen;
+		count -= plen;
+		goal = pblk + plen;
+	}
+out:
+	ext2fs_extent_free(handle);
+	return err;
+}
+
+static errcode_t copy_run_direct(ext2_filsys fs, ext2_file_t e2_file,
+				 blk64_t lblk, blk64_t count, char *ptr)
+{
+	ext2_ino_t		ino = ext2fs_file_get_inode_num(e2_file);
+	struct ext2_inode	*inode = ext2fs_file_get_inode(e2_file);
+	ext2_extent_handle_t	handle;
+	struct ext2fs_extent	extent;
+	unsigned int		written;
+	blk64_t			n;
+	errcode_t		err;
+	int			mapped;
+
+	err = copy_map_run(fs, ino, inode, lblk, count, &mapped);
+	if (err)
+		return err;
+	if (!mapped) {
+		/* Not an append; let the file code sort it out */
+		err = ext2fs_file_lseek(e2_file, lblk * fs->blocksize,
+					EXT2_SEEK_SET, NULL);
+		while (!err && count) {
+			err = ext2fs_file_write(e2_file, ptr, fs->blocksize,
+						&written);
+			count--;
+			ptr += fs->blocksize;
+		}
+		return err;
+	}
+
+	err = ext2fs_extent_open2(fs, ino, inode, &handle);
+	if (err)
+		return err;
+	while (count) {
+		err = ext2fs_extent_goto(handle, lblk);
+		if (err)
+			break;
+		err = ext2fs_extent_get(handle, EXT2_EXTENT_CURRENT, &extent);
+		if (err)
+			break;
+		n = extent.e_lblk + extent.e_len - lblk;
+		if (n > count)
+			n = count;
+		err = io_channel_write_blk64(fs->io,
+					     extent.e_pblk + lblk - extent.e_lblk,
+					     n, ptr);
+		if (err)
+			break;
+		lblk += n;
+		count -= n;
+		ptr += n * fs->blocksize;
+	}
+	ext2fs_extent_free(handle);
+	return err;
+}
+
+static errcode_t copy_chunk_direct(ext2_filsys fs, ext2_file_t e2_file,
+				   off_t off, char *buf, ssize_t got,
+				   char *zerobuf)
+{
+	blk64_t	lblk = off / fs->blocksize, run = 0, i, count;
+	errcode_t err;
+
+	/* Pad a short last block; it is written out whole */
+	count = (got + fs->blocksize - 1) / fs->blocksize;
+	memset(buf + got, 0, count * fs->blocksize - got);
+
+	for (i = 0; i <= count; i++) {
+		if (i < count &&
+		    memcmp(buf + i * fs->blocksize, zerobuf, fs->blocksize))
+			continue;
+		if (i > run) {
+			err = copy_run_direct(fs, e2_file, lblk + run, i - run,
+					      buf + run * fs->blocksize);
+			if (err)
+				return err;
+		}
+		run = i + 1;
+	}
+	return 0;
+}
+
+/* Copy got bytes of data, which belong at offset off, into e2_file */
+static errcode_t copy_file_buf(ext2_filsys fs, ext2_file_t e2_file, off_t off,
+			       char *buf, ssize_t got, char *zerobuf,
+			       int direct)
+{
+	off_t bpos;
+	ssize_t blen;
+	unsigned int written;
+	char *ptr;
+	errcode_t err;
+
+	if (direct)
+		return copy_chunk_direct(fs, e2_file, off, buf, got, zerobuf);
+
+	for (bpos = 0, ptr = buf; bpos < got; bpos += fs->blocksize) {
+		blen = fs->blocksize;
+		if (blen > got - bpos)
+			blen = got - bpos;
+		if (memcmp(ptr, zerobuf, blen) == 0) {
+			ptr += blen;
+			continue;
+		}
+		err = ext2fs_file_lseek(e2_file, off + bpos, EXT2_SEEK_SET,
+					NULL);
+		if (err)
+			return err;
+		while (blen > 0) {
+			err = ext2fs_file_write(e2_file, ptr, blen, &written);
+			if (err)
+				return err;
+			if (written == 0)
+				return EIO;
+			blen -= written;
+			ptr += written;
+		}
+	}
+	return 0;
+}
+
 static errcode_t copy_file_chunk(ext2_filsys fs, int fd, ext2_file_t e2_file,
 				 off_t start, off_t end, char *buf,
 				 char *zerobuf)
 {
-	off_t off, bpos;
-	ssize_t got, blen;
-	unsigned int written;
-	char *ptr;
+	off_t off;
+	ssize_t got;
 	errcode_t err = 0;
+	int direct;
 
+	direct = copy_file_direct(fs, e2_file) && !(start % fs->blocksize);
 	for (off = start; off < end; off += COPY_FILE_BUFLEN) {
 #ifdef HAVE_PREAD64
 		got = pread64(fd, buf, COPY_FILE_BUFLEN, off);
@@ -420,31 +767,13 @@ static errcode_t copy_file_chunk(ext2_filsys fs, int fd, ext2_file_t e2_file,
 			err = errno;
 			goto fail;
 		}
-		for (bpos = 0, ptr = buf; bpos < got; bpos += fs->blocksize) {
-			blen = fs->blocksize;
-			if (blen > got - bpos)
-				blen = got - bpos;
-			if (memcmp(ptr, zerobuf, blen) == 0) {
-				ptr += blen;
-				continue;
-			}
-			err = ext2fs_file_lseek(e2_file, off + bpos,
-						EXT2_SEEK_SET, NULL);
-			if (err)
-				goto fail;
-			while (blen > 0) {
-				err = ext2fs_file_write(e2_file, ptr, blen,
-							&written);
-				if (err)
-					goto fail;
-				if (written == 0) {
-					err = EIO;
-					goto fail;
-				}
-				blen -= written;
-				ptr += written;
-			}
-		}
+		/* Don't map anything the next chunk will copy */
+		if (direct && got > end - off)
+			got = end - off;
+		err = copy_file_buf(fs, e2_file, off, buf, got, zerobuf,
+				    direct);
+		if (err)
+			goto fail;
 	}
 fail:
 	return err;
@@ -581,17 +910,38 @@ static errcode_t copy_file(ext2_filsys fs, int fd, struct stat *statbuf,
 out:
 	ext2fs_free_mem(&zerobuf);
 	ext2fs_free_mem(&buf);
+	/* Direct copies updated the block map behind e2_file's back */
+	if (copy_file_direct(fs, e2_file)) {
+		close_err = ext2fs_write_inode(fs, ino,
+					ext2fs_file_get_inode(e2_file));
+		if (err == 0)
+			err = close_err;
+	}
 	close_err = ext2fs_file_close(e2_file);
 	if (err == 0)
 		err = close_err;
 	return err;
 }
 
+/*
+ * Hard links are found through a hash table with as many chains as
+ * there are slots in hdl[], which is always a power of two.
+ */
+static unsigned int hdlink_hash(struct hdlinks_s *hdlinks, dev_t dev,
+				ino_t ino)
+{
+	__u64 key = ((__u64) ino) ^ ((__u64) dev << 32) ^ (__u64) dev;
+
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (unsigned int) (key >> 32) & (hdlinks->size - 1);
+}
+
 static int is_hardlink(struct hdlinks_s *hdlinks, dev_t dev, ino_t ino)
 {
 	int i;
 
-	for (i = 0; i < hdlinks->count; i++) {
+	for (i = hdlinks->hash[hdlink_hash(hdlinks, dev, ino)]; i >= 0;
+	     i = hdlinks->hdl[i].next) {
 		if (hdlinks->hdl[i].src_dev == dev &&
 		    hdlinks->hdl[i].src_ino == ino)
 			return i;
@@ -599,37 +949,83 @@ static int is_hardlink(struct hdlinks_s *hdlinks, dev_t dev, ino_t ino)
 	return -1;
 }
 
-/* Copy the native file to the fs */
-errcode_t do_write_internal(ext2_filsys fs, ext2_ino_t cwd, const char *src,
-			    const char *dest, ext2_ino_t root)
+static errcode_t hdlinks_init(struct hdlinks_s *hdlinks, int size)
 {
-	int		fd;
-	struct stat	statbuf;
-	ext2_ino_t	newfile;
-	errcode_t	retval;
-	struct ext2_inode inode;
+	int i;
 
-	fd = ext2fs_open_file(src, O_RDONLY, 0);
-	if (fd < 0) {
-		retval = errno;
-		com_err(__func__, retval, _("while opening \"%s\" to copy"),
-			src);
-		return retval;
+	hdlinks->count = 0;
+	hdlinks->size = size;
+	hdlinks->hdl = malloc(size * sizeof(struct hdlink_s));
+	hdlinks->hash = malloc(size * sizeof(int));
+	if (hdlinks->hdl == NULL || hdlinks->hash == NULL) {
+		free(hdlinks->hdl);
+		free(hdlinks->hash);
+		return EXT2_ET_NO_MEMORY;
 	}
-	if (fstat(fd, &statbuf) < 0) {
-		retval = errno;
-		goto out;
+	for (i = 0; i < size; i++)
+		hdlinks->hash[i] = -1;
+	return 0;
+}
+
+static void hdlinks_free(struct hdlinks_s *hdlinks)
+{
+	free(hdlinks->hdl);
+	free(hdlinks->hash);
+}
+
+static errcode_t add_hardlink(struct hdlinks_s *hdlinks, dev_t dev,
+			      ino_t ino, ext2_ino_t dst_ino)
+{
+	struct hdlinks_s new_links;
+	struct hdlink_s *hdl;
+	unsigned int h;
+	errcode_t retval;
+	int i;
+
+	/* Double the table when it fills up and rehash everything */
+	if (hdlinks->count == hdlinks->size) {
+		retval = hdlinks_init(&new_links, hdlinks->size * 2);
+		if (retval)
+			return retval;
+		for (i = 0; i < hdlinks->count; i++) {
+			hdl = &new_links.hdl[i];
+			*hdl = hdlinks->hdl[i];
+			h = hdlink_hash(&new_links, hdl->src_dev,
+					hdl->src_ino);
+			hdl->next = new_links.hash[h];
+			new_links.hash[h] = i;
+		}
+		new_links.count = hdlinks->count;
+		hdlinks_free(hdlinks);
+		*hdlinks = new_links;
 	}
 
+	hdl = &hdlinks->hdl[hdlinks->count];
+	hdl->src_dev = dev;
+	hdl->src_ino = ino;
+	hdl->dst_ino = dst_ino;
+	h = hdlink_hash(hdlinks, dev, ino);
+	hdl->next = hdlinks->hash[h];
+	hdlinks->hash[h] = hdlinks->count++;
+	return 0;
+}
+
+/* Create an empty regular file with statbuf's mode and size */
+static errcode_t create_file(ext2_filsys fs, ext2_ino_t cwd, const char *dest,
+			     ext2_ino_t root, struct stat *statbuf,
+			     ext2_ino_t *ret_ino)
+{
+	ext2_ino_t	newfile;
+	errcode_t	retval;
+	struct ext2_inode inode;
+
 	retval = ext2fs_namei(fs, root, cwd, dest, &newfile);
-	if (retval == 0) {
-		retval = EXT2_ET_FILE_EXISTS;
-		goto out;
-	}
+	if (retval == 0)
+		return EXT2_ET_FILE_EXISTS;
 
 	retval = ext2fs_new_inode(fs, cwd, 010755, 0, &newfile);
 	if (retval)
-		goto out;
+		return retval;
 #ifdef DEBUGFS
 	printf("Allocated inode: %u\n", newfile);
 #endif
@@ -648,11 +1044,11 @@ errcode_t do_write_internal(ext2_filsys fs, ext2_ino_t cwd, const char *src,
 		com_err(__func__, 0, "Warning: inode already set");
 	ext2fs_inode_alloc_stats2(fs, newfile, +1, 0);
 	memset(&inode, 0, sizeof(inode));
-	inode.i_mode = (statbuf.st_mode & ~LINUX_S_IFMT) | LINUX_S_IFREG;
+	inode.i_mode = (statbuf->st_mode & ~LINUX_S_IFMT) | LINUX_S_IFREG;
 	inode.i_atime = inode.i_ctime = inode.i_mtime =
 		fs->now ? fs->now : time(0);
 	inode.i_links_count = 1;
-	retval = ext2fs_inode_size_set(fs, &inode, statbuf.st_size);
+	retval = ext2fs_inode_size_set(fs, &inode, statbuf->st_size);
 	if (retval)
 		goto out;
 	if (ext2fs_has_feature_inline_data(fs->super)) {
@@ -675,24 +1071,185 @@ errcode_t do_write_internal(ext2_filsys fs, ext2_ino_t cwd, const char *src,
 		if (retval)
 			goto out;
 	}
-	if (LINUX_S_ISREG(inode.i_mode)) {
-		retval = copy_file(fs, fd, &statbuf, newfile);
-		if (retval)
+	*ret_ino = newfile;
+out:
+	return retval;
+}
+
+/* Copy the native file open on fd to the fs */
+static errcode_t __do_write_internal(ext2_filsys fs, ext2_ino_t cwd, int fd,
+				     const char *dest, ext2_ino_t root)
+{
+	struct stat	statbuf;
+	ext2_ino_t	newfile;
+	errcode_t	retval;
+
+	if (fstat(fd, &statbuf) < 0)
+		return errno;
+
+	retval = create_file(fs, cwd, dest, root, &statbuf, &newfile);
+	if (retval)
+		return retval;
+	return copy_file(fs, fd, &statbuf, newfile);
+}
+
+/* Copy the native file to the fs */
+errcode_t do_write_internal(ext2_filsys fs, ext2_ino_t cwd, const char *src,
+			    const char *dest, ext2_ino_t root)
+{
+	int		fd;
+	errcode_t	retval;
+
+	fd = ext2fs_open_file(src, O_RDONLY, 0);
+	if (fd < 0) {
+		retval = errno;
+		com_err(__func__, retval, _("while opening \"%s\" to copy"),
+			src);
+		return retval;
+	}
+	retval = __do_write_internal(fs, cwd, fd, dest, root);
+	close(fd);
+	return retval;
+}
+
+/*
+ * A directory is read and lstat()ed in one go before anything in it is
+ * created.  While the entries are being copied, up to POPULATE_RA_FILES
+ * of the regular files that come next (but not past the next
+ * subdirectory) are kept open with their first POPULATE_RA_BYTES read
+ * ahead by the kernel, so that reading the source tree overlaps with
+ * allocating and writing the new inodes.
+ */
+#define POPULATE_RA_FILES	16
+#define POPULATE_RA_BYTES	(16 * 1024 * 1024)
+
+struct populate_ent {
+	char		*name;
+	struct stat	st;
+	int		fd;		/* open if read ahead, else -1 */
+};
+
+struct populate_ra {
+	int		next;		/* next entry to consider */
+	int		files;
+	off_t		bytes;
+};
+
+static off_t populate_ra_len(struct populate_ent *ent)
+{
+	return ent->st.st_size < POPULATE_RA_BYTES ? ent->st.st_size :
+		POPULATE_RA_BYTES;
+}
+
+static void populate_readahead(struct populate_ent *ents, int count, int cur,
+			       struct populate_ra *ra)
+{
+	struct populate_ent *ent;
+	off_t	len;
+
+	for (; ra->next < count; ra->next++) {
+		ent = &ents[ra->next];
+		if (ra->next < cur || !S_ISREG(ent->st.st_mode) ||
+		    ent->st.st_size == 0) {
+			if (ra->next >= cur && S_ISDIR(ent->st.st_mode))
+				break;
+			continue;
+		}
+		len = populate_ra_len(ent);
+		if (ra->files &&
+		    (ra->files >= POPULATE_RA_FILES ||
+		     ra->bytes + len > POPULATE_RA_BYTES))
+			break;
+		ent->fd = ext2fs_open_file(ent->name, O_RDONLY, 0);
+		if (ent->fd < 0) {
+			/*
+			 * Maybe we ran out of descriptors; try again once
+			 * the ones we hold are closed.  The caller reports
+			 * any real error when it opens the file itself.
+			 */
+			if (ra->files)
+				break;
+			continue;
+		}
+#ifdef HAVE_POSIX_FADVISE
+		(void) posix_fadvise(ent->fd, 0, len, POSIX_FADV_WILLNEED);
+#endif
+		ra->files++;
+		ra->bytes += len;
+	}
+}
+
+static void populate_ent_done(struct populate_ent *ent, struct populate_ra *ra)
+{
+	if (ent->fd >= 0) {
+		close(ent->fd);
+		ent->fd = -1;
+		ra->files--;
+		ra->bytes -= populate_ra_len(ent);
+	}
+}
+
+/* Read the names and inodes of everything in the current directory */
+static errcode_t populate_scan_dir(DIR *dh, const char *source_dir,
+				   struct populate_ent **ret_ents,
+				   int *ret_count)
+{
+	struct populate_ent *ents = NULL, *ent;
+	struct dirent	*dent;
+	errcode_t	retval = 0;
+	int		count = 0, size = 0;
+
+	while ((dent = readdir(dh))) {
+		if ((!strcmp(dent->d_name, ".")) ||
+		    (!strcmp(dent->d_name, "..")))
+			continue;
+		if (count == size) {
+			void *p = realloc(ents, (size + 64) *
+					  sizeof(struct populate_ent));
+			if (p == NULL) {
+				retval = EXT2_ET_NO_MEMORY;
+				com_err(__func__, retval,
+					_("while reading directory \"%s\""),
+					source_dir);
+				goto out;
+			}
+			ents = p;
+			size += 64;
+		}
+		ent = &ents[count];
+		ent->fd = -1;
+		ent->name = strdup(dent->d_name);
+		if (ent->name == NULL) {
+			retval = EXT2_ET_NO_MEMORY;
+			com_err(__func__, retval,
+				_("while reading directory \"%s\""),
+				source_dir);
+			goto out;
+		}
+		count++;
+		if (lstat(ent->name, &ent->st)) {
+			retval = errno;
+			com_err(__func__, retval, _("while lstat \"%s\""),
+				ent->name);
 			goto out;
+		}
 	}
 out:
-	close(fd);
+	*ret_ents = ents;
+	*ret_count = count;
 	return retval;
 }
 
 /* Copy files from source_dir to fs */
 static errcode_t __populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 			       const char *source_dir, ext2_ino_t root,
-			       struct hdlinks_s *hdlinks)
+			       struct hdlinks_s *hdlinks,
+			       struct xattr_cache_s *xattrs)
 {
 	const char	*name;
 	DIR		*dh;
-	struct dirent	*dent;
+	struct populate_ent *ents = NULL;
+	struct populate_ra ra;
 	struct stat	st;
 	char		*ln_target = NULL;
 	unsigned int	save_inode;
@@ -700,6 +1257,7 @@ static errcode_t __populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 	errcode_t	retval = 0;
 	int		read_cnt;
 	int		hdlink;
+	int		i, count = 0;
 
 	if (chdir(source_dir) < 0) {
 		retval = errno;
@@ -716,17 +1274,15 @@ static errcode_t __populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 		return retval;
 	}
 
-	while ((dent = readdir(dh))) {
-		if ((!strcmp(dent->d_name, ".")) ||
-		    (!strcmp(dent->d_name, "..")))
-			continue;
-		if (lstat(dent->d_name, &st)) {
-			retval = errno;
-			com_err(__func__, retval, _("while lstat \"%s\""),
-				dent->d_name);
-			goto out;
-		}
-		name = dent->d_name;
+	retval = populate_scan_dir(dh, source_dir, &ents, &count);
+	if (retval)
+		goto out;
+
+	memset(&ra, 0, sizeof(ra));
+	for (i = 0; i < count; populate_ent_done(&ents[i++], &ra)) {
+		populate_readahead(ents, count, i, &ra);
+		st = ents[i].st;
+		name = ents[i].name;
 
 		/* Check for hardlinks */
 		save_inode = 0;
@@ -796,8 +1352,13 @@ static errcode_t __populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 			}
 			break;
 		case S_IFREG:
-			retval = do_write_internal(fs, parent_ino, name, name,
-						   root);
+			if (ents[i].fd >= 0)
+				retval = __do_write_internal(fs, parent_ino,
+							     ents[i].fd, name,
+							     root);
+			else
+				retval = do_write_internal(fs, parent_ino,
+							   name, name, root);
 			if (retval) {
 				com_err(__func__, retval,
 					_("while writing file \"%s\""), name);
@@ -824,7 +1385,8 @@ find_lnf:
 					goto out;
 			}
 			/* Populate the dir recursively*/
-			retval = __populate_fs(fs, ino, name, root, hdlinks);
+			retval = __populate_fs(fs, ino, name, root, hdlinks,
+					       xattrs);
 			if (retval)
 				goto out;
 			if (chdir("..")) {
@@ -853,7 +1415,7 @@ find_lnf:
 			goto out;
 		}
 
-		retval = set_inode_xattr(fs, ino, name);
+		retval = set_inode_xattr(fs, ino, name, xattrs);
 		if (retval) {
 			com_err(__func__, retval,
 				_("while setting xattrs for \"%s\""), name);
@@ -862,32 +1424,23 @@ find_lnf:
 
 		/* Save the hardlink ino */
 		if (save_inode) {
-			/*
-			 * Check whether need more memory, and we don't need
-			 * free() since the lifespan will be over after the fs
-			 * populated.
-			 */
-			if (hdlinks->count == hdlinks->size) {
-				void *p = realloc(hdlinks->hdl,
-						(hdlinks->size + HDLINK_CNT) *
-						sizeof(struct hdlink_s));
-				if (p == NULL) {
-					retval = EXT2_ET_NO_MEMORY;
-					com_err(name, retval,
-						_("while saving inode data"));
-					goto out;
-				}
-				hdlinks->hdl = p;
-				hdlinks->size += HDLINK_CNT;
+			retval = add_hardlink(hdlinks, st.st_dev, st.st_ino,
+					      ino);
+			if (retval) {
+				com_err(name, retval,
+					_("while saving inode data"));
+				goto out;
 			}
-			hdlinks->hdl[hdlinks->count].src_dev = st.st_dev;
-			hdlinks->hdl[hdlinks->count].src_ino = st.st_ino;
-			hdlinks->hdl[hdlinks->count].dst_ino = ino;
-			hdlinks->count++;
 		}
 	}
 
 out:
+	for (i = 0; i < count; i++) {
+		if (ents[i].fd >= 0)
+			close(ents[i].fd);
+		free(ents[i].name);
+	}
+	free(ents);
 	closedir(dh);
 	return retval;
 }
@@ -896,6 +1449,7 @@ errcode_t populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 		      const char *source_dir, ext2_ino_t root)
 {
 	struct hdlinks_s hdlinks;
+	struct xattr_cache_s *xattrs;
 	errcode_t retval;
 
 	if (!(fs->flags & EXT2_FLAG_RW)) {
@@ -903,17 +1457,632 @@ errcode_t populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 		return EROFS;
 	}
 
-	hdlinks.count = 0;
-	hdlinks.size = HDLINK_CNT;
-	hdlinks.hdl = realloc(NULL, hdlinks.size * sizeof(struct hdlink_s));
-	if (hdlinks.hdl == NULL) {
-		retval = errno;
+	retval = hdlinks_init(&hdlinks, HDLINK_CNT);
+	if (retval) {
+		com_err(__func__, retval, _("while allocating memory"));
+		return retval;
+	}
+	retval = xattr_cache_init(&xattrs);
+	if (retval) {
 		com_err(__func__, retval, _("while allocating memory"));
+		hdlinks_free(&hdlinks);
+		return retval;
+	}
+
+	retval = __populate_fs(fs, parent_ino, source_dir, root, &hdlinks,
+			       xattrs);
+
+	xattr_cache_free(xattrs);
+	hdlinks_free(&hdlinks);
+	return retval;
+}
+
+/*
+ * Populating from a tar archive.  The archive is read front to back in
+ * a single pass, so it may come from a pipe: each member is created as
+ * soon as its header has been read, and the data of regular files is
+ * copied from the stream straight into newly allocated blocks.  Memory
+ * use does not depend on the size of the archive.
+ *
+ * The ustar format is understood, along with the GNU long name ('L'
+ * and 'K') members and the path, linkpath and size keywords of POSIX
+ * pax ('x') headers.  Sparse members and extended attributes are not
+ * supported.
+ */
+#define TAR_BLOCK_SIZE	512
+#define TAR_MAX_META	65536	/* largest long name or pax header */
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+struct tar_stream {
+	int		fd;
+	char		*buf;		/* COPY_FILE_BUFLEN bytes */
+	char		*zerobuf;	/* one zeroed fs block */
+	char		*path;		/* set by 'L' or pax headers */
+	char		*link;		/* set by 'K' or pax headers */
+	__u64		size;		/* set by pax headers */
+	int		has_size;
+	char		*dir_path;	/* last directory looked up */
+	ext2_ino_t	dir_ino;
+};
+
+/* Read exactly len bytes; a clean end of file is EXT2_ET_SHORT_READ */
+static errcode_t tar_read(struct tar_stream *ts, void *buf, size_t len)
+{
+	char	*ptr = buf;
+	ssize_t	got;
+
+	while (len > 0) {
+		got = read(ts->fd, ptr, len);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (got == 0)
+			return EXT2_ET_SHORT_READ;
+		ptr += got;
+		len -= got;
+	}
+	return 0;
+}
+
+/* Member data is padded to a whole number of blocks */
+#define TAR_PAD(size)	((TAR_BLOCK_SIZE - (size) % TAR_BLOCK_SIZE) % \
+			 TAR_BLOCK_SIZE)
+
+static errcode_t tar_skip(struct tar_stream *ts, __u64 len)
+{
+	size_t		n;
+	errcode_t	retval;
+
+	while (len > 0) {
+		n = len > COPY_FILE_BUFLEN ? COPY_FILE_BUFLEN : len;
+		retval = tar_read(ts, ts->buf, n);
+		if (retval)
+			return retval;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Parse an octal field, or a GNU base-256 one if the top bit is set */
+static int tar_number(const char *field, int len, __u64 *ret)
+{
+	const unsigned char *p = (const unsigned char *) field;
+	__u64	val = 0;
+	int	i = 0;
+
+	if (p[0] & 0x80) {
+		val = p[0] & 0x3f;
+		for (i = 1; i < len; i++) {
+			if (val >> 56)
+				return -1;
+			val = (val << 8) | p[i];
+		}
+		*ret = val;
+		return 0;
+	}
+	while (i < len && p[i] == ' ')
+		i++;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+		if (val >> 61)
+			return -1;
+		val = (val << 3) | (p[i] - '0');
+	}
+	if (i < len && p[i] != ' ' && p[i] != '\0')
+		return -1;
+	*ret = val;
+	return 0;
+}
+
+static int tar_checksum_ok(struct tar_header *hdr)
+{
+	unsigned char	*p = (unsigned char *) hdr;
+	__u64		sum;
+	unsigned int	i, usum = 0;
+	int		ssum = 0;
+
+	if (tar_number(hdr->chksum, sizeof(hdr->chksum), &sum))
+		return 0;
+	for (i = 0; i < TAR_BLOCK_SIZE; i++) {
+		if (i >= offsetof(struct tar_header, chksum) &&
+		    i < offsetof(struct tar_header, typeflag)) {
+			usum += ' ';
+			ssum += ' ';
+			continue;
+		}
+		usum += p[i];
+		ssum += (signed char) p[i];
+	}
+	return sum == usum || sum == (__u64) ssum;
+}
+
+/* Read the data of an 'L', 'K' or 'x' member into a string */
+static errcode_t tar_read_meta(struct tar_stream *ts, __u64 size, char **ret)
+{
+	char		*str;
+	errcode_t	retval;
+
+	if (size >= TAR_MAX_META)
+		return EXT2_ET_INVALID_ARGUMENT;
+	str = malloc(size + 1);
+	if (!str)
+		return EXT2_ET_NO_MEMORY;
+	retval = tar_read(ts, str, size);
+	if (retval == 0)
+		retval = tar_skip(ts, TAR_PAD(size));
+	if (retval) {
+		free(str);
+		return retval;
+	}
+	str[size] = '\0';
+	free(*ret);
+	*ret = str;
+	return 0;
+}
+
+/* Pick the keywords we care about out of a pax extended header */
+static errcode_t tar_parse_pax(struct tar_stream *ts, char *pax, __u64 size)
+{
+	char		*rec = pax, *end = pax + size, *key, *val, *p;
+	char		**dest;
+	unsigned long	len;
+
+	while (rec < end) {
+		len = strtoul(rec, &p, 10);
+		if (p == rec || *p != ' ' || len > (unsigned long) (end - rec) ||
+		    len < 2 || rec[len - 1] != '\n')
+			return EXT2_ET_INVALID_ARGUMENT;
+		rec[len - 1] = '\0';
+		key = p + 1;
+		val = strchr(key, '=');
+		if (!val)
+			return EXT2_ET_INVALID_ARGUMENT;
+		*val++ = '\0';
+		dest = NULL;
+		if (strcmp(key, "path") == 0)
+			dest = &ts->path;
+		else if (strcmp(key, "linkpath") == 0)
+			dest = &ts->link;
+		else if (strcmp(key, "size") == 0) {
+			ts->size = strtoull(val, NULL, 10);
+			ts->has_size = 1;
+		}
+		if (dest) {
+			free(*dest);
+			*dest = strdup(val);
+			if (!*dest)
+				return EXT2_ET_NO_MEMORY;
+		}
+		rec += len;
+	}
+	return 0;
+}
+
+/*
+ * Make a member's name relative to the directory being populated:
+ * leading slashes and "." components go, as does any trailing slash.
+ * Names with ".." components are refused.
+ */
+static int tar_clean_path(char *path)
+{
+	char	*src = path, *dst = path, *comp;
+
+	while (*src) {
+		while (*src == '/')
+			src++;
+		comp = src;
+		while (*src && *src != '/')
+			src++;
+		if (src - comp == 1 && comp[0] == '.')
+			continue;
+		if (src - comp == 2 && comp[0] == '.' && comp[1] == '.')
+			return -1;
+		if (src == comp)
+			break;
+		if (dst != path)
+			*dst++ = '/';
+		memmove(dst, comp, src - comp);
+		dst += src - comp;
+	}
+	*dst = '\0';
+	return 0;
+}
+
+/*
+ * Find (creating it and any missing parents, as tar does) the
+ * directory dir below parent_ino.  Archives list the members of a
+ * directory together, so the last answer is remembered.
+ */
+static errcode_t tar_lookup_dir(ext2_filsys fs, struct tar_stream *ts,
+				ext2_ino_t parent_ino, ext2_ino_t root,
+				char *dir, ext2_ino_t *ret)
+{
+	ext2_ino_t	ino = parent_ino;
+	char		*comp, *next;
+	errcode_t	retval;
+
+	if (!*dir) {
+		*ret = parent_ino;
+		return 0;
+	}
+	if (ts->dir_path && strcmp(ts->dir_path, dir) == 0) {
+		*ret = ts->dir_ino;
+		return 0;
+	}
+
+	for (comp = dir; comp; comp = next) {
+		next = strchr(comp, '/');
+		if (next)
+			*next = '\0';
+		retval = ext2fs_lookup(fs, ino, comp, strlen(comp), 0, &ino);
+		if (retval == EXT2_ET_FILE_NOT_FOUND) {
+			retval = do_mkdir_internal(fs, ino, comp, root);
+			if (retval == 0)
+				retval = ext2fs_lookup(fs, ino, comp,
+						       strlen(comp), 0, &ino);
+		}
+		if (next)
+			*next++ = '/';
+		if (retval)
+			return retval;
+	}
+
+	free(ts->dir_path);
+	ts->dir_path = strdup(dir);
+	ts->dir_ino = ino;
+	*ret = ino;
+	return 0;
+}
+
+/* Copy size bytes of member data from the stream into a new file */
+static errcode_t tar_copy_data(ext2_filsys fs, struct tar_stream *ts,
+			       ext2_ino_t ino, __u64 size)
+{
+	ext2_file_t	e2_file;
+	__u64		off;
+	size_t		n;
+	errcode_t	err, close_err;
+	int		direct;
+
+	err = ext2fs_file_open(fs, ino, EXT2_FILE_WRITE, &e2_file);
+	if (err)
+		return err;
+	direct = copy_file_direct(fs, e2_file);
+	for (off = 0; off < size; off += n) {
+		n = size - off > COPY_FILE_BUFLEN ? COPY_FILE_BUFLEN :
+						    size - off;
+		err = tar_read(ts, ts->buf, n);
+		if (err)
+			break;
+		err = copy_file_buf(fs, e2_file, off, ts->buf, n,
+				    ts->zerobuf, direct);
+		if (err)
+			break;
+	}
+	if (direct) {
+		close_err = ext2fs_write_inode(fs, ino,
+					ext2fs_file_get_inode(e2_file));
+		if (err == 0)
+			err = close_err;
+	}
+	close_err = ext2fs_file_close(e2_file);
+	if (err == 0)
+		err = close_err;
+	if (err == 0)
+		err = tar_skip(ts, TAR_PAD(size));
+	return err;
+}
+
+/* Create one archive member; *copied is set once its data is consumed */
+static errcode_t tar_add_member(ext2_filsys fs, struct tar_stream *ts,
+				ext2_ino_t parent_ino, ext2_ino_t root,
+				struct tar_header *hdr, char *path,
+				struct stat *st, int *copied)
+{
+	char		*name, *dir, *link = NULL;
+	char		linkbuf[sizeof(hdr->linkname) + 1];
+	ext2_ino_t	dir_ino, ino;
+	__u64		major, minor;
+	errcode_t	retval;
+
+	name = strrchr(path, '/');
+	if (name) {
+		*name++ = '\0';
+		dir = path;
+	} else {
+		name = path;
+		dir = "";
+	}
+	retval = tar_lookup_dir(fs, ts, parent_ino, root, dir, &dir_ino);
+	if (retval) {
+		com_err(__func__, retval, _("while looking up \"%s\""), dir);
+		return retval;
+	}
+
+	if (hdr->typeflag == '1' || hdr->typeflag == '2') {
+		if (ts->link)
+			link = ts->link;
+		else {
+			memcpy(linkbuf, hdr->linkname, sizeof(hdr->linkname));
+			linkbuf[sizeof(hdr->linkname)] = '\0';
+			link = linkbuf;
+		}
+	}
+
+	retval = ext2fs_lookup(fs, dir_ino, name, strlen(name), 0, &ino);
+	if (retval == 0) {
+		/* Directories may be listed after their contents */
+		if ((hdr->typeflag == '5' || hdr->typeflag == 'D') &&
+		    ext2fs_check_directory(fs, ino) == 0)
+			goto set_extra;
+		com_err(__func__, EXT2_ET_FILE_EXISTS, _("while adding \"%s\""),
+			name);
+		return EXT2_ET_FILE_EXISTS;
+	}
+
+	switch (hdr->typeflag) {
+	case '0':
+	case '\0':
+	case '7':
+		retval = create_file(fs, dir_ino, name, root, st, &ino);
+		if (retval == 0) {
+			retval = tar_copy_data(fs, ts, ino, st->st_size);
+			*copied = 1;
+		}
+		if (retval) {
+			com_err(__func__, retval,
+				_("while writing file \"%s\""), name);
+			return retval;
+		}
+		break;
+	case '1':
+		if (tar_clean_path(link) < 0 || !*link) {
+			com_err(__func__, 0, _("ignoring entry \"%s\""), name);
+			return 0;
+		}
+		retval = ext2fs_namei(fs, root, parent_ino, link, &ino);
+		if (retval) {
+			com_err(__func__, retval,
+				_("while looking up \"%s\""), link);
+			return retval;
+		}
+		/* The link shares the attributes of its target */
+		return add_link(fs, dir_ino, ino, name);
+	case '2':
+		retval = do_symlink_internal(fs, dir_ino, name, link, root);
+		if (retval)
+			return retval;
+		break;
+	case '3':
+	case '4':
+	case '6':
+		if (tar_number(hdr->devmajor, sizeof(hdr->devmajor), &major) ||
+		    tar_number(hdr->devminor, sizeof(hdr->devminor), &minor))
+			major = minor = 0;
+		st->st_rdev = makedev(major, minor);
+		retval = do_mknod_internal(fs, dir_ino, name, st);
+		if (retval) {
+			com_err(__func__, retval,
+				_("while creating special file "
+				  "\"%s\""), name);
+			return retval;
+		}
+		break;
+	case '5':
+	case 'D':	/* GNU dumpdir; its list of names is skipped */
+		retval = do_mkdir_internal(fs, dir_ino, name, root);
+		if (retval) {
+			com_err(__func__, retval,
+				_("while making dir \"%s\""), name);
+			return retval;
+		}
+		break;
+	default:
+		com_err(__func__, 0, _("ignoring entry \"%s\""), name);
+		return 0;
+	}
+
+	retval = ext2fs_lookup(fs, dir_ino, name, strlen(name), 0, &ino);
+	if (retval) {
+		com_err(name, retval, _("while looking up \"%s\""), name);
 		return retval;
 	}
+set_extra:
+	retval = set_inode_extra(fs, ino, st);
+	if (retval)
+		com_err(__func__, retval,
+			_("while setting inode for \"%s\""), name);
+	return retval;
+}
+
+static const mode_t tar_types[] = {
+	['\0'] = S_IFREG, ['0'] = S_IFREG, ['7'] = S_IFREG, ['1'] = S_IFREG,
+	['2'] = S_IFLNK, ['3'] = S_IFCHR, ['4'] = S_IFBLK, ['5'] = S_IFDIR, ['6'] = S_IFIFO,
+	['D'] = S_IFDIR,
+};
+
+static errcode_t __populate_fs_tar(ext2_filsys fs, ext2_ino_t parent_ino,
+				   struct tar_stream *ts, ext2_ino_t root)
+{
+	struct tar_header hdr;
+	struct stat	st;
+	char		*path, namebuf[sizeof(hdr.prefix) + sizeof(hdr.name) + 2];
+	__u64		size, val;
+	int		copied, zero_blocks = 0;
+	errcode_t	retval;
+
+	while (1) {
+		retval = tar_read(ts, &hdr, sizeof(hdr));
+		/* Some archivers leave out the trailing zeroed blocks */
+		if (retval == EXT2_ET_SHORT_READ && zero_blocks == 0)
+			return 0;
+		if (retval)
+			goto read_err;
+		if (memcmp(&hdr, ts->zerobuf, sizeof(hdr)) == 0) {
+			if (++zero_blocks == 2)
+				return 0;
+			continue;
+		}
+		zero_blocks = 0;
+		if (!tar_checksum_ok(&hdr) ||
+		    tar_number(hdr.size, sizeof(hdr.size), &size)) {
+			com_err(__func__, EXT2_ET_INVALID_ARGUMENT, "%s",
+				_("while reading archive header"));
+			return EXT2_ET_INVALID_ARGUMENT;
+		}
+
+		/* Metadata for the next member */
+		if (hdr.typeflag == 'L' || hdr.typeflag == 'K' ||
+		    hdr.typeflag == 'x') {
+			char **dest = hdr.typeflag == 'K' ? &ts->link :
+							      &ts->path;
+			char *pax = NULL;
+
+			if (hdr.typeflag != 'x') {
+				retval = tar_read_meta(ts, size, dest);
+				if (retval)
+					goto read_err;
+				continue;
+			}
+			retval = tar_read_meta(ts, size, &pax);
+			if (retval == 0)
+				retval = tar_parse_pax(ts, pax, size);
+			free(pax);
+			if (retval)
+				goto read_err;
+			continue;
+		}
+		if (hdr.typeflag == 'g') {
+			retval = tar_skip(ts, size + TAR_PAD(size));
+			if (retval)
+				goto read_err;
+			continue;
+		}
+
+		if (ts->has_size)
+			size = ts->size;
+		if (ts->path)
+			path = ts->path;
+		else {
+			path = namebuf;
+			/*
+			 * Old GNU headers ("ustar  ") keep the access and
+			 * change times where POSIX has the prefix.
+			 */
+			if (hdr.prefix[0] &&
+			    memcmp(hdr.magic, "ustar", 6) == 0 &&
+			    memcmp(hdr.version, "00", 2) == 0)
+				snprintf(namebuf, sizeof(namebuf), "%.*s/%.*s",
+					 (int) sizeof(hdr.prefix), hdr.prefix,
+					 (int) sizeof(hdr.name), hdr.name);
+			else
+				snprintf(namebuf, sizeof(namebuf), "%.*s",
+					 (int) sizeof(hdr.name), hdr.name);
+		}
+
+		memset(&st, 0, sizeof(st));
+		if (tar_number(hdr.mode, sizeof(hdr.mode), &val) == 0)
+			st.st_mode = val & 07777;
+		if ((unsigned char) hdr.typeflag < sizeof(tar_types) /
+						   sizeof(tar_types[0]))
+			st.st_mode |= tar_types[(unsigned char) hdr.typeflag];
+		if (tar_number(hdr.uid, sizeof(hdr.uid), &val) == 0)
+			st.st_uid = val;
+		if (tar_number(hdr.gid, sizeof(hdr.gid), &val) == 0)
+			st.st_gid = val;
+		if (tar_number(hdr.mtime, sizeof(hdr.mtime), &val) == 0)
+			st.st_atime = st.st_ctime = st.st_mtime = val;
+		if (hdr.typeflag == '\0' || hdr.typeflag == '0' ||
+		    hdr.typeflag == '7')
+			st.st_size = size;
+
+		copied = 0;
+		if (tar_clean_path(path) < 0)
+			com_err(__func__, 0, _("ignoring entry \"%s\""), path);
+		else if (*path) {
+			retval = tar_add_member(fs, ts, parent_ino, root, &hdr,
+						path, &st, &copied);
+			if (retval)
+				return retval;
+		}
+		if (!copied) {
+			retval = tar_skip(ts, size + TAR_PAD(size));
+			if (retval)
+				goto read_err;
+		}
+
+		free(ts->path);
+		free(ts->link);
+		ts->path = ts->link = NULL;
+		ts->has_size = 0;
+	}
 
-	retval = __populate_fs(fs, parent_ino, source_dir, root, &hdlinks);
+read_err:
+	com_err(__func__, retval, "%s", _("while reading archive"));
+	return retval;
+}
 
-	free(hdlinks.hdl);
+/* Copy the members of a tar archive ("-" for stdin) to fs */
+errcode_t populate_fs_tar(ext2_filsys fs, ext2_ino_t parent_ino,
+			  const char *archive, ext2_ino_t root)
+{
+	struct tar_stream ts;
+	errcode_t	retval;
+
+	if (!(fs->flags & EXT2_FLAG_RW)) {
+		com_err(__func__, 0, "Filesystem opened readonly");
+		return EROFS;
+	}
+
+	memset(&ts, 0, sizeof(ts));
+	if (strcmp(archive, "-") == 0)
+		ts.fd = 0;
+	else {
+		ts.fd = ext2fs_open_file(archive, O_RDONLY, 0);
+		if (ts.fd < 0) {
+			retval = errno;
+			com_err(__func__, retval,
+				_("while opening \"%s\" to copy"), archive);
+			return retval;
+		}
+	}
+
+	retval = ext2fs_get_mem(COPY_FILE_BUFLEN, &ts.buf);
+	if (retval == 0)
+		retval = ext2fs_get_memzero(fs->blocksize > TAR_BLOCK_SIZE ?
+					    fs->blocksize : TAR_BLOCK_SIZE,
+					    &ts.zerobuf);
+	if (retval)
+		com_err(__func__, retval, _("while allocating memory"));
+	else
+		retval = __populate_fs_tar(fs, parent_ino, &ts, root);
+
+	free(ts.path);
+	free(ts.link);
+	free(ts.dir_path);
+	ext2fs_free_mem(&ts.zerobuf);
+	ext2fs_free_mem(&ts.buf);
+	if (ts.fd > 0)
+		close(ts.fd);
 	return retval;
 }
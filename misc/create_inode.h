@@ -13,6 +13,7 @@ struct hdlink_s
 	dev_t src_dev;
 	ino_t src_ino;
 	ext2_ino_t dst_ino;
+	int next;		/* next entry in the same hash chain, or -1 */
 };
 
 struct hdlinks_s
@@ -20,13 +21,16 @@ struct hdlinks_s
 	int count;
 	int size;
 	struct hdlink_s *hdl;
+	int *hash;		/* first entry of each hash chain, or -1 */
 };
 
-#define HDLINK_CNT	(4)
+#define HDLINK_CNT	(4)	/* initial size, a power of two */
 
 /* For populating the filesystem */
 extern errcode_t populate_fs(ext2_filsys fs, ext2_ino_t parent_ino,
 			     const char *source_dir, ext2_ino_t root);
+extern errcode_t populate_fs_tar(ext2_filsys fs, ext2_ino_t parent_ino,
+				 const char *archive, ext2_ino_t root);
 extern errcode_t do_mknod_internal(ext2_filsys fs, ext2_ino_t cwd,
 				   const char *name, struct stat *st);
 extern errcode_t do_symlink_internal(ext2_filsys fs, ext2_ino_t cwd,
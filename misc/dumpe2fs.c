@@ -50,10 +50,11 @@ static const char * program_name = "dumpe2fs";
 static char * device_name = NULL;
 static int hex_format = 0;
 static int blocks64 = 0;
+static int check_inode_csums = 0;
 
 static void usage(void)
 {
-	fprintf(stderr, _("Usage: %s [-bfghixV] [-o superblock=<num>] "
+	fprintf(stderr, _("Usage: %s [-bcfghixV] [-o superblock=<num>] "
 		 "[-o blocksize=<num>] device\n"), program_name);
 	exit(1);
 }
@@ -122,7 +123,8 @@ static void print_bg_opts(ext2_filsys fs, dgrp_t i)
 {
 	int first = 1, bg_flags = 0;
 
-	if (ext2fs_has_group_desc_csum(fs))
+	if (ext2fs_has_group_desc_csum(fs) ||
+	    (fs->super->s_flags & EXT2_FLAGS_TRACK_DIRTY))
 		bg_flags = ext2fs_bg_flags(fs, i);
 
 	print_bg_opt(bg_flags, EXT2_BG_INODE_UNINIT, "INODE_UNINIT",
@@ -131,6 +133,7 @@ static void print_bg_opts(ext2_filsys fs, dgrp_t i)
  		     &first);
 	print_bg_opt(bg_flags, EXT2_BG_INODE_ZEROED, "ITABLE_ZEROED",
  		     &first);
+	print_bg_opt(bg_flags, EXT2_BG_DIRTY, "DIRTY", &first);
 	if (!first)
 		fputc(']', stdout);
 	fputc('\n', stdout);
@@ -150,12 +153,66 @@ static void print_bg_rel_offset(ext2_filsys fs, blk64_t block, int itable,
 	}
 }
 
+/*
+ * Count the in-use part of a group's inode table (starting at itable)
+ * whose checksums are wrong, or return -1 if it could not be read.
+ */
+static int count_bad_inode_csums(ext2_filsys fs, dgrp_t group, blk64_t itable,
+				 char *buf)
+{
+	__u32 bad_mask[EXT2_MAX_BLOCK_SIZE / EXT2_GOOD_OLD_INODE_SIZE / 32];
+	unsigned int inodes_per_block = EXT2_INODES_PER_BLOCK(fs->super);
+	ext2_ino_t ino = group * fs->super->s_inodes_per_group + 1;
+	unsigned int left = fs->super->s_inodes_per_group, count;
+	int bad = 0;
+
+	if (ext2fs_has_group_desc_csum(fs)) {
+		if (ext2fs_bg_flags_test(fs, group, EXT2_BG_INODE_UNINIT))
+			return 0;
+		left -= ext2fs_bg_itable_unused(fs, group);
+	}
+	for (; left; itable++, ino += count, left -= count) {
+		count = left < inodes_per_block ? left : inodes_per_block;
+		if (io_channel_read_blk64(fs->io, itable, 1, buf))
+			return -1;
+		bad += ext2fs_inode_table_csum_verify_block(fs, ino, buf,
+							    count, bad_mask);
+	}
+	return bad;
+}
+
+static void print_bad_inode_csums(ext2_filsys fs, dgrp_t group, char *buf)
+{
+	int bad, copy;
+
+	bad = count_bad_inode_csums(fs, group,
+				    ext2fs_inode_table_loc(fs, group), buf);
+	fputs(_("  Inode checksum errors: "), stdout);
+	if (bad < 0)
+		fputs(_("unreadable"), stdout);
+	else
+		printf("%d", bad);
+	if (ext2fs_has_feature_fyp(fs->super)) {
+		for (copy = 1; copy < EXT2_FYP_ITB_N_DUPS; copy++) {
+			bad = count_bad_inode_csums(fs, group,
+				ext2fs_dup_inode_table_loc(fs, group, copy),
+				buf);
+			printf(_(", copy %d: "), copy);
+			if (bad < 0)
+				fputs(_("unreadable"), stdout);
+			else
+				printf("%d", bad);
+		}
+	}
+	fputc('\n', stdout);
+}
+
 static void list_desc(ext2_filsys fs, int grp_only)
 {
 	unsigned long i;
 	blk64_t	first_block, last_block;
 	blk64_t	super_blk, old_desc_blk, new_desc_blk;
-	char *block_bitmap=NULL, *inode_bitmap=NULL;
+	char *block_bitmap=NULL, *inode_bitmap=NULL, *itable_buf=NULL;
 	const char *units = _("blocks");
 	int inode_blocks_per_group, old_desc_blocks, reserved_gdt;
 	int		block_nbytes, inode_nbytes;
@@ -174,6 +231,9 @@ static void list_desc(ext2_filsys fs, int grp_only)
 		block_bitmap = malloc(block_nbytes);
 	if (fs->inode_map)
 		inode_bitmap = malloc(inode_nbytes);
+	if (check_inode_csums &&
+	    ext2fs_has_feature_metadata_csum(fs->super))
+		itable_buf = malloc(fs->blocksize);
 
 	inode_blocks_per_group = ((fs->super->s_inodes_per_group *
 				   EXT2_INODE_SIZE(fs->super)) +
@@ -285,6 +345,8 @@ static void list_desc(ext2_filsys fs, int grp_only)
 		if (ext2fs_bg_itable_unused(fs, i))
 			printf (_(", %u unused inodes\n"),
 				ext2fs_bg_itable_unused(fs, i));
+		if (itable_buf)
+			print_bad_inode_csums(fs, i, itable_buf);
 		if (block_bitmap) {
 			fputs(_("  Free blocks: "), stdout);
 			retval = ext2fs_get_block_bitmap_range2(fs->block_map,
@@ -319,6 +381,8 @@ static void list_desc(ext2_filsys fs, int grp_only)
 		free(block_bitmap);
 	if (inode_bitmap)
 		free(inode_bitmap);
+	if (itable_buf)
+		free(itable_buf);
 }
 
 static void list_bad_blocks(ext2_filsys fs, int dump)
@@ -524,11 +588,14 @@ int main (int argc, char ** argv)
 	if (argc && *argv)
 		program_name = *argv;
 
-	while ((c = getopt(argc, argv, "bfghixVo:")) != EOF) {
+	while ((c = getopt(argc, argv, "bcfghixVo:")) != EOF) {
 		switch (c) {
 		case 'b':
 			print_badblocks++;
 			break;
+		case 'c':
+			check_inode_csums++;
+			break;
 		case 'f':
 			force++;
 			break;
@@ -734,7 +734,12 @@ static void *op_init(struct fuse_conn_info *conn)
 	conn->want |= FUSE_CAP_IOCTL_DIR;
 #endif
 	if (fs->flags & EXT2_FLAG_RW) {
-		fs->super->s_mnt_count++;
+		/*
+		 * Our changes are recorded in the dirty groups, so this
+		 * mount need not keep e2fsck -E incremental from working.
+		 */
+		if (!(fs->super->s_flags & EXT2_FLAGS_TRACK_DIRTY))
+			fs->super->s_mnt_count++;
 		fs->super->s_mtime = time(NULL);
 		fs->super->s_state &= ~EXT2_VALID_FS;
 		ext2fs_mark_super_dirty(fs);
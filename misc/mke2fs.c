@@ -24,6 +24,7 @@
 #include <strings.h>
 #include <ctype.h>
 #include <time.h>
+#include <sys/time.h>
 #ifdef __linux__
 #include <sys/utsname.h>
 #define KERNEL_VERSION(a,b,c) (((a) << 16) + ((b) << 8) + (c))
@@ -396,22 +397,49 @@ static errcode_t packed_allocate_tables(ext2_filsys fs)
 	return 0;
 }
 
+/*
+ * The inode tables, and on fyp file systems their duplicates, are
+ * zeroed in physical block order with adjacent tables merged into a
+ * single request.  With flex_bg this turns one write per group into a
+ * few large writes (or zero-out commands) per flex group.
+ */
+struct zero_range {
+	blk64_t	blk;
+	blk64_t	num;
+};
+
+#define ZERO_RANGE_MAX	(1 << 30)	/* ext2fs_zero_blocks2 takes an int */
+
+static EXT2_QSORT_TYPE zero_range_cmp(const void *a, const void *b)
+{
+	const struct zero_range *ra = a, *rb = b;
+
+	if (ra->blk < rb->blk)
+		return -1;
+	return ra->blk > rb->blk;
+}
+
 static void write_inode_tables(ext2_filsys fs, int lazy_flag, int itable_zeroed)
 {
 	errcode_t	retval;
-	blk64_t		blk;
+	blk64_t		blk, done = 0, total = 0;
 	dgrp_t		i;
-	int		num;
+	int		num, j, dups, n = 0, r;
+	struct zero_range *ranges;
 	struct ext2fs_numeric_progress_struct progress;
-
-	ext2fs_numeric_progress_init(fs, &progress,
-				     _("Writing inode tables: "),
-				     fs->group_desc_count);
+	struct timeval	start, end;
+	double		secs;
+
+	dups = ext2fs_has_feature_fyp(fs->super) ? EXT2_FYP_ITB_N_DUPS : 1;
+	ranges = malloc(sizeof(struct zero_range) * fs->group_desc_count *
+			dups);
+	if (!ranges) {
+		com_err(program_name, ENOMEM, "%s",
+			_("while allocating inode table zeroing list"));
+		exit(1);
+	}
 
 	for (i = 0; i < fs->group_desc_count; i++) {
-		ext2fs_numeric_progress_update(fs, &progress, i);
-
-		blk = ext2fs_inode_table_loc(fs, i);
 		num = fs->inode_blocks_per_group;
 
 		if (lazy_flag)
@@ -424,24 +452,69 @@ static void write_inode_tables(ext2_filsys fs, int lazy_flag, int itable_zeroed)
 			ext2fs_bg_flags_set(fs, i, EXT2_BG_INODE_ZEROED);
 			ext2fs_group_desc_csum_set(fs, i);
 		}
-		if (!itable_zeroed) {
-			retval = ext2fs_zero_blocks2(fs, blk, num, &blk, &num);
-			if (retval) {
-				fprintf(stderr, _("\nCould not write %d "
-					  "blocks in inode table starting at %llu: %s\n"),
-					num, blk, error_message(retval));
-				exit(1);
-			}
+		if (itable_zeroed || !num)
+			continue;
+		for (j = 0; j < dups; j++) {
+			blk = j ? ext2fs_dup_inode_table_loc(fs, i, j) :
+				ext2fs_inode_table_loc(fs, i);
+			if (!blk)
+				continue;
+			ranges[n].blk = blk;
+			ranges[n].num = num;
+			total += num;
+			n++;
+		}
+	}
+
+	qsort(ranges, n, sizeof(struct zero_range), zero_range_cmp);
+	for (r = 0, j = 1; j < n; j++) {
+		if (ranges[r].blk + ranges[r].num == ranges[j].blk &&
+		    ranges[r].num + ranges[j].num <= ZERO_RANGE_MAX)
+			ranges[r].num += ranges[j].num;
+		else
+			ranges[++r] = ranges[j];
+	}
+	if (n)
+		n = r + 1;
+
+	ext2fs_numeric_progress_init(fs, &progress,
+				     _("Writing inode tables: "),
+				     fs->group_desc_count);
+	gettimeofday(&start, NULL);
+	for (r = 0; r < n; r++) {
+		ext2fs_numeric_progress_update(fs, &progress,
+				total ? done * fs->group_desc_count / total : 0);
+
+		blk = ranges[r].blk;
+		num = ranges[r].num;
+		retval = ext2fs_zero_blocks2(fs, blk, num, &blk, &num);
+		if (retval) {
+			fprintf(stderr, _("\nCould not write %d "
+				  "blocks in inode table starting at %llu: %s\n"),
+				num, blk, error_message(retval));
+			exit(1);
 		}
+		done += ranges[r].num;
 		if (sync_kludge) {
 			if (sync_kludge == 1)
 				sync();
-			else if ((i % sync_kludge) == 0)
+			else if ((r % sync_kludge) == 0)
 				sync();
 		}
 	}
+	gettimeofday(&end, NULL);
 	ext2fs_numeric_progress_close(fs, &progress,
 				      _("done                            \n"));
+	free(ranges);
+
+	if (verbose && total) {
+		secs = (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1000000.0;
+		printf(_("Zeroed %llu inode table blocks in %d ranges, "
+			 "%.1f MiB/s\n"), total, n,
+		       secs > 0 ? (double) total * fs->blocksize /
+		       (1024 * 1024) / secs : 0.0);
+	}
 
 	/* Reserved inodes must always have correct checksums */
 	if (ext2fs_has_feature_metadata_csum(fs->super))
@@ -3222,13 +3295,20 @@ no_journal:
 	retval = mk_hugefiles(fs, device_name);
 	if (retval)
 		com_err(program_name, retval, "while creating huge files");
-	/* Copy files from the specified directory */
+	/* Copy files from the specified directory or tar archive */
 	if (src_root_dir) {
+		struct stat st;
+
 		if (!quiet)
 			printf("%s", _("Copying files into the device: "));
 
-		retval = populate_fs(fs, EXT2_ROOT_INO, src_root_dir,
-				     EXT2_ROOT_INO);
+		if (strcmp(src_root_dir, "-") == 0 ||
+		    (stat(src_root_dir, &st) == 0 && !S_ISDIR(st.st_mode)))
+			retval = populate_fs_tar(fs, EXT2_ROOT_INO,
+						 src_root_dir, EXT2_ROOT_INO);
+		else
+			retval = populate_fs(fs, EXT2_ROOT_INO, src_root_dir,
+					     EXT2_ROOT_INO);
 		if (retval) {
 			com_err(program_name, retval, "%s",
 				_("while populating file system"));
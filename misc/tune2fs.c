@@ -1951,6 +1951,7 @@ static int parse_extended_opts(ext2_filsys fs, const char *opts)
 	char	*buf, *token, *next, *p, *arg;
 	int	len, hash_alg;
 	int	r_usage = 0;
+	dgrp_t	group;
 
 	len = strlen(opts);
 	buf = malloc(len+1);
@@ -2013,6 +2014,26 @@ static int parse_extended_opts(ext2_filsys fs, const char *opts)
 			fs->super->s_flags &= ~EXT2_FLAGS_TEST_FILESYS;
 			printf("Clearing test filesystem flag\n");
 			ext2fs_mark_super_dirty(fs);
+		} else if (!strcmp(token, "track_dirty_groups")) {
+			/*
+			 * Nothing is known about changes made before
+			 * tracking starts, so every group starts out dirty.
+			 */
+			fs->super->s_flags |= EXT2_FLAGS_TRACK_DIRTY;
+			for (group = 0; group < fs->group_desc_count; group++)
+				ext2fs_mark_group_dirty(fs, group);
+			fs->flags &= ~EXT2_FLAG_SUPER_ONLY;
+			printf("Setting dirty group tracking flag\n");
+			ext2fs_mark_super_dirty(fs);
+		} else if (!strcmp(token, "^track_dirty_groups")) {
+			fs->super->s_flags &= ~EXT2_FLAGS_TRACK_DIRTY;
+			for (group = 0; group < fs->group_desc_count; group++) {
+				ext2fs_bg_flags_clear(fs, group, EXT2_BG_DIRTY);
+				ext2fs_group_desc_csum_set(fs, group);
+			}
+			fs->flags &= ~EXT2_FLAG_SUPER_ONLY;
+			printf("Clearing dirty group tracking flag\n");
+			ext2fs_mark_super_dirty(fs);
 		} else if (strcmp(token, "stride") == 0) {
 			if (!arg) {
 				r_usage++;
@@ -2088,7 +2109,9 @@ static int parse_extended_opts(ext2_filsys fs, const char *opts)
 			"\tstride=<RAID per-disk chunk size in blocks>\n"
 			"\tstripe_width=<RAID stride*data disks in blocks>\n"
 			"\ttest_fs\n"
-			"\t^test_fs\n"));
+			"\t^test_fs\n"
+			"\ttrack_dirty_groups\n"
+			"\t^track_dirty_groups\n"));
 		free(buf);
 		return 1;
 	}
@@ -2465,30 +2488,28 @@ err_out:
 
 static errcode_t ext2fs_calculate_summary_stats(ext2_filsys fs)
 {
-	blk64_t		blk;
-	ext2_ino_t	ino;
-	unsigned int	group = 0;
-	unsigned int	count = 0;
-	int		total_free = 0;
-	int		group_free = 0;
+	blk64_t		first_blk, last_blk, used, group_free;
+	blk64_t		total_free = 0;
+	ext2_ino_t	first_ino, used_inodes;
+	int		total_inodes_free = 0;
+	unsigned int	group;
+	errcode_t	retval;
 
 	/*
 	 * First calculate the block statistics
 	 */
-	for (blk = fs->super->s_first_data_block;
-	     blk < ext2fs_blocks_count(fs->super); blk++) {
-		if (!ext2fs_fast_test_block_bitmap2(fs->block_map, blk)) {
-			group_free++;
-			total_free++;
-		}
-		count++;
-		if ((count == fs->super->s_blocks_per_group) ||
-		    (blk == ext2fs_blocks_count(fs->super)-1)) {
-			ext2fs_bg_free_blocks_count_set(fs, group++,
-							group_free);
-			count = 0;
-			group_free = 0;
-		}
+	for (group = 0; group < fs->group_desc_count; group++) {
+		first_blk = ext2fs_group_first_block2(fs, group);
+		last_blk = ext2fs_group_last_block2(fs, group);
+		retval = ext2fs_count_set_block_bitmap2(fs->block_map,
+							first_blk, last_blk,
+							&used);
+		if (retval)
+			return retval;
+		group_free = EXT2FS_B2C(fs, last_blk) -
+			EXT2FS_B2C(fs, first_blk) + 1 - used;
+		ext2fs_bg_free_blocks_count_set(fs, group, group_free);
+		total_free += group_free;
 	}
 	total_free = EXT2FS_C2B(fs, total_free);
 	ext2fs_free_blocks_count_set(fs->super, total_free);
@@ -2496,27 +2517,20 @@ static errcode_t ext2fs_calculate_summary_stats(ext2_filsys fs)
 	/*
 	 * Next, calculate the inode statistics
 	 */
-	group_free = 0;
-	total_free = 0;
-	count = 0;
-	group = 0;
-
-	/* Protect loop from wrap-around if s_inodes_count maxed */
-	for (ino = 1; ino <= fs->super->s_inodes_count && ino > 0; ino++) {
-		if (!ext2fs_fast_test_inode_bitmap2(fs->inode_map, ino)) {
-			group_free++;
-			total_free++;
-		}
-		count++;
-		if ((count == fs->super->s_inodes_per_group) ||
-		    (ino == fs->super->s_inodes_count)) {
-			ext2fs_bg_free_inodes_count_set(fs, group++,
-							group_free);
-			count = 0;
-			group_free = 0;
-		}
-	}
-	fs->super->s_free_inodes_count = total_free;
+	for (group = 0; group < fs->group_desc_count; group++) {
+		first_ino = group * fs->super->s_inodes_per_group + 1;
+		retval = ext2fs_count_set_inode_bitmap2(fs->inode_map,
+				first_ino,
+				first_ino + fs->super->s_inodes_per_group - 1,
+				&used_inodes);
+		if (retval)
+			return retval;
+		ext2fs_bg_free_inodes_count_set(fs, group,
+				fs->super->s_inodes_per_group - used_inodes);
+		total_inodes_free += fs->super->s_inodes_per_group -
+			used_inodes;
+	}
+	fs->super->s_free_inodes_count = total_inodes_free;
 	ext2fs_mark_super_dirty(fs);
 	return 0;
 }
@@ -2772,6 +2786,7 @@ int tune2fs_main(int argc, char **argv)
 	io_manager io_ptr, io_ptr_orig = NULL;
 	int rc = 0;
 	char default_undo_file[1] = { 0 };
+	dgrp_t group;
 
 #ifdef ENABLE_NLS
 	setlocale(LC_MESSAGES, "");
@@ -3181,6 +3196,8 @@ retry_open:
 			printf(_("Setting inode size %lu\n"),
 							new_inode_size);
 			rewrite_checksums = 1;
+			for (group = 0; group < fs->group_desc_count; group++)
+				ext2fs_mark_group_dirty(fs, group);
 		} else {
 			printf("%s", _("Failed to change inode size\n"));
 			rc = 1;
@@ -24,12 +24,25 @@ struct ext2_extent_entry {
 	__u64	size;
 };
 
+/*
+ * Once sorted, the table is searched through a sparse index holding
+ * the first old_loc of every EXTENT_INDEX_STRIDE'th entry.  The index
+ * is small enough to stay in cache, so a lookup touches at most one
+ * stride of the (much larger) entry array.  Most callers translate
+ * locations in ascending order, so we first try the entry that
+ * satisfied the previous lookup and the one following it.
+ */
+#define EXTENT_INDEX_STRIDE	64
+
 struct _ext2_extent {
 	struct ext2_extent_entry *list;
 	__u64	cursor;
 	__u64	size;
 	__u64	num;
 	__u64	sorted;
+	__u64	*index;
+	__u64	index_num;	/* valid index entries; 0 if stale */
+	__u64	hint;		/* entry found by the last lookup */
 };
 
 /*
@@ -69,6 +82,8 @@ void ext2fs_free_extent_table(ext2_extent extent)
 {
 	if (extent->list)
 		ext2fs_free_mem(&extent->list);
+	if (extent->index)
+		ext2fs_free_mem(&extent->index);
 	extent->list = 0;
 	extent->size = 0;
 	extent->num = 0;
@@ -86,7 +101,8 @@ errcode_t ext2fs_add_extent_entry(ext2_extent extent, __u64 old_loc, __u64 new_l
 	__u64				curr;
 
 	if (extent->num >= extent->size) {
-		newsize = extent->size + 100;
+		/* Grow geometrically; millions of extents may be added */
+		newsize = extent->size * 2;
 		retval = ext2fs_resize_mem(sizeof(struct ext2_extent_entry) *
 					   extent->size,
 					   sizeof(struct ext2_extent_entry) *
@@ -119,6 +135,7 @@ errcode_t ext2fs_add_extent_entry(ext2_extent extent, __u64 old_loc, __u64 new_l
 	ent->new_loc = new_loc;
 	ent->size = 1;
 	extent->num++;
+	extent->index_num = 0;
 	return 0;
 }
 
@@ -133,62 +150,143 @@ static EXT2_QSORT_TYPE extent_cmp(const void *a, const void *b)
 	db_a = (const struct ext2_extent_entry *) a;
 	db_b = (const struct ext2_extent_entry *) b;
 
-	return (db_a->old_loc - db_b->old_loc);
+	if (db_a->old_loc == db_b->old_loc)
+		return 0;
+	return (db_a->old_loc < db_b->old_loc) ? -1 : 1;
 }
 
 /*
- * Given an inode map and inode number, look up the old inode number
- * and return the new inode number.
+ * Sort the table if needed, merging entries which turn out to be
+ * contiguous, and rebuild the index.  If there is no memory for the
+ * index, extent_search() simply does without it.
  */
-__u64 ext2fs_extent_translate(ext2_extent extent, __u64 old_loc)
+static void extent_prepare(ext2_extent extent)
 {
-	__s64	low, high, mid;
-	__u64	lowval, highval;
-	float	range;
+	struct ext2_extent_entry *ent, *last;
+	__u64		i, n;
 
 	if (!extent->sorted) {
 		qsort(extent->list, extent->num,
 		      sizeof(struct ext2_extent_entry), extent_cmp);
 		extent->sorted = 1;
+		extent->index_num = 0;
+		for (i = 1, last = extent->list; i < extent->num; i++) {
+			ent = extent->list + i;
+			if (last->old_loc + last->size == ent->old_loc &&
+			    last->new_loc + last->size == ent->new_loc)
+				last->size += ent->size;
+			else
+				*++last = *ent;
+		}
+		if (extent->num)
+			extent->num = last - extent->list + 1;
 	}
+	if (extent->index_num || !extent->num)
+		return;
+
+	extent->hint = 0;
+	n = (extent->num + EXTENT_INDEX_STRIDE - 1) / EXTENT_INDEX_STRIDE;
+	if (extent->index)
+		ext2fs_free_mem(&extent->index);
+	if (ext2fs_get_array(n, sizeof(__u64), &extent->index))
+		return;
+	for (i = 0; i < n; i++)
+		extent->index[i] = extent->list[i * EXTENT_INDEX_STRIDE].old_loc;
+	extent->index_num = n;
+}
+
+/*
+ * Return the first entry which ends after old_loc, or extent->num if
+ * there is none.  The table must be prepared.
+ */
+static __u64 extent_search(ext2_extent extent, __u64 old_loc)
+{
+	struct ext2_extent_entry *ent;
+	__u64	low, high, mid;
+
+	/* Sequential lookups usually hit the last entry or the next one */
+	for (mid = extent->hint; mid < extent->num &&
+		     mid < extent->hint + 2; mid++) {
+		ent = extent->list + mid;
+		if (old_loc < ent->old_loc + ent->size &&
+		    (mid == 0 || old_loc >= ent[-1].old_loc + ent[-1].size))
+			return mid;
+	}
+
+	/* Find the last stride starting at or below old_loc... */
 	low = 0;
-	high = extent->num-1;
-	while (low <= high) {
-#if 0
-		mid = (low+high)/2;
-#else
-		if (low == high)
-			mid = low;
-		else {
-			/* Interpolate for efficiency */
-			lowval = extent->list[low].old_loc;
-			highval = extent->list[high].old_loc;
-
-			if (old_loc < lowval)
-				range = 0;
-			else if (old_loc > highval)
-				range = 1;
-			else {
-				range = ((float) (old_loc - lowval)) /
-					(highval - lowval);
-				if (range > 0.9)
-					range = 0.9;
-				if (range < 0.1)
-					range = 0.1;
-			}
-			mid = low + ((__u64) (range * (high-low)));
-		}
-#endif
-		if ((old_loc >= extent->list[mid].old_loc) &&
-		    (old_loc < extent->list[mid].old_loc + extent->list[mid].size))
-			return (extent->list[mid].new_loc +
-				(old_loc - extent->list[mid].old_loc));
-		if (old_loc < extent->list[mid].old_loc)
-			high = mid-1;
+	high = extent->index_num;
+	while (high - low > 1) {
+		mid = (low + high) / 2;
+		if (extent->index[mid] <= old_loc)
+			low = mid;
 		else
-			low = mid+1;
+			high = mid;
 	}
-	return 0;
+
+	/* ...and the first entry in it which ends after old_loc */
+	low *= EXTENT_INDEX_STRIDE;
+	high = extent->index_num ? low + EXTENT_INDEX_STRIDE : extent->num;
+	if (high > extent->num)
+		high = extent->num;
+	while (low < high) {
+		mid = (low + high) / 2;
+		ent = extent->list + mid;
+		if (ent->old_loc + ent->size <= old_loc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/*
+ * Translate the locations old_loc .. old_loc + len - 1, a whole
+ * extent of blocks at a time.  *run is set to the number of locations
+ * from old_loc on which are translated alike: if they were moved, the
+ * location old_loc maps to is returned and the rest follow it
+ * contiguously; if not, 0 is returned.  Callers walk a range by
+ * advancing old_loc by *run until len is used up, so the range gets
+ * split only at relocation boundaries.
+ */
+__u64 ext2fs_extent_translate_range(ext2_extent extent, __u64 old_loc,
+				    __u64 len, __u64 *run)
+{
+	struct ext2_extent_entry *ent;
+	__u64	i, avail;
+
+	*run = len;
+	if (!len)
+		return 0;
+	extent_prepare(extent);
+	if (!extent->num)
+		return 0;
+
+	i = extent_search(extent, old_loc);
+	if (i >= extent->num)
+		return 0;
+	extent->hint = i;
+	ent = extent->list + i;
+	if (old_loc < ent->old_loc) {
+		if (ent->old_loc - old_loc < len)
+			*run = ent->old_loc - old_loc;
+		return 0;
+	}
+	avail = ent->old_loc + ent->size - old_loc;
+	if (avail < len)
+		*run = avail;
+	return ent->new_loc + (old_loc - ent->old_loc);
+}
+
+/*
+ * Given an inode map and inode number, look up the old inode number
+ * and return the new inode number.
+ */
+__u64 ext2fs_extent_translate(ext2_extent extent, __u64 old_loc)
+{
+	__u64	run;
+
+	return ext2fs_extent_translate_range(extent, old_loc, 1, &run);
 }
 
 /*
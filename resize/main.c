@@ -46,7 +46,7 @@ static char *device_name, *io_options;
 
 static void usage (char *prog)
 {
-	fprintf (stderr, _("Usage: %s [-d debug_flags] [-f] [-F] [-M] [-P] "
+	fprintf (stderr, _("Usage: %s [-d debug_flags] [-f] [-F] [-M] [-n] [-P] "
 			   "[-p] device [-b|-s|new_size] [-S RAID-stride] "
 			   "[-z undo_file]\n\n"),
 		 prog);
@@ -285,7 +285,7 @@ int main (int argc, char ** argv)
 	if (argc && *argv)
 		program_name = *argv;
 
-	while ((c = getopt(argc, argv, "d:fFhMPpS:bsz:")) != EOF) {
+	while ((c = getopt(argc, argv, "d:fFhMnPpS:bsz:")) != EOF) {
 		switch (c) {
 		case 'h':
 			usage(program_name);
@@ -299,6 +299,9 @@ int main (int argc, char ** argv)
 		case 'M':
 			force_min_size = 1;
 			break;
+		case 'n':
+			flags |= RESIZE_DRY_RUN;
+			break;
 		case 'P':
 			print_min_size = 1;
 			break;
@@ -400,10 +403,12 @@ int main (int argc, char ** argv)
 		io_ptr = unix_io_manager;
 
 	if (!(mount_flags & EXT2_MF_MOUNTED))
-		io_flags = EXT2_FLAG_RW | EXT2_FLAG_EXCLUSIVE;
+		io_flags = EXT2_FLAG_EXCLUSIVE;
+	if (!(mount_flags & EXT2_MF_MOUNTED) && !(flags & RESIZE_DRY_RUN))
+		io_flags |= EXT2_FLAG_RW;
 
 	io_flags |= EXT2_FLAG_64BITS;
-	if (undo_file) {
+	if (undo_file && !(flags & RESIZE_DRY_RUN)) {
 		retval = resize2fs_setup_tdb(device_name, undo_file, &io_ptr);
 		if (retval)
 			exit(1);
@@ -555,6 +560,9 @@ int main (int argc, char ** argv)
 	    (((__u64) 1) << (sizeof(st_buf.st_size)*8 - 1)) - 1)
 		fd = -1;
 	if ((new_file_size > st_buf.st_size) &&
+	    (fd > 0) && (flags & RESIZE_DRY_RUN))
+		max_size = new_size;
+	else if ((new_file_size > st_buf.st_size) &&
 	    (fd > 0)) {
 		if ((ext2fs_llseek(fd, new_file_size-1, SEEK_SET) >= 0) &&
 		    (write(fd, "0", 1) == 1))
@@ -605,7 +613,33 @@ int main (int argc, char ** argv)
 		fprintf(stderr, _("The filesystem is already 32-bit.\n"));
 		exit(0);
 	}
-	if (mount_flags & EXT2_MF_MOUNTED) {
+	if (flags & RESIZE_DRY_RUN) {
+		if (mount_flags & EXT2_MF_MOUNTED) {
+			fprintf(stderr, _("Cannot plan a resize of a mounted "
+				"filesystem.\n"));
+			exit(1);
+		}
+		if (flags & (RESIZE_DISABLE_64BIT | RESIZE_ENABLE_64BIT)) {
+			fprintf(stderr, _("Cannot plan a change of the 64bit "
+				"feature.\n"));
+			exit(1);
+		}
+		printf(_("Planning the resize of the filesystem on "
+			 "%s to %llu (%dk) blocks.\n"),
+		       device_name, new_size, blocksize / 1024);
+		retval = resize_fs(fs, &new_size, flags, 0);
+		if (retval) {
+			com_err(program_name, retval,
+				_("while planning the resize of %s"),
+				device_name);
+			ext2fs_free(fs);
+			exit(1);
+		}
+		if (fd > 0)
+			close(fd);
+		remove_error_table(&et_ext2_error_table);
+		return (0);
+	} else if (mount_flags & EXT2_MF_MOUNTED) {
 		bigalloc_check(fs, force);
 		retval = online_resize_fs(fs, mtpt, &new_size, flags);
 	} else {
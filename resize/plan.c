@@ -0,0 +1,130 @@
+/*
+ * plan.c --- report what a resize would do, for resize2fs -n
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include "config.h"
+#include "resize2fs.h"
+#include <time.h>
+#include <sys/time.h>
+
+/* How much to read when measuring the throughput of the device */
+#define PLAN_READ_SIZE	(8 * 1024 * 1024)
+#define PLAN_READ_CHUNK	(1024 * 1024)
+
+/* How many scattered blocks to read when measuring the cost of a seek */
+#define PLAN_SEEKS	32
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, 0);
+	return (now.tv_sec - start->tv_sec) +
+		((double) now.tv_usec - start->tv_usec) / 1000000;
+}
+
+/*
+ * Time a sequential read, starting at the first block which would be
+ * moved, and a series of single block reads scattered over the whole
+ * file system.  Nothing is written.
+ */
+void measure_resize_io(ext2_resize_t rfs)
+{
+	struct resize_plan	*plan = &rfs->plan;
+	ext2_filsys		fs = rfs->old_fs;
+	struct timeval		start;
+	blk64_t			blk, count, done, num, chunk, end;
+	__u64			old_loc, new_loc, size;
+	char			*buf = NULL;
+	double			t;
+	int			i;
+
+	end = ext2fs_blocks_count(fs->super);
+	blk = fs->super->s_first_data_block;
+	if (rfs->bmap && !ext2fs_iterate_extent(rfs->bmap, 0, 0, 0) &&
+	    !ext2fs_iterate_extent(rfs->bmap, &old_loc, &new_loc, &size) &&
+	    size && EXT2FS_C2B(fs, old_loc) < end)
+		blk = EXT2FS_C2B(fs, old_loc);
+
+	chunk = PLAN_READ_CHUNK / fs->blocksize;
+	count = PLAN_READ_SIZE / fs->blocksize;
+	if (count > end - blk)
+		count = end - blk;
+	if (io_channel_alloc_buf(fs->io, chunk, &buf))
+		return;
+
+	gettimeofday(&start, 0);
+	for (done = 0; done < count; done += num) {
+		num = count - done;
+		if (num > chunk)
+			num = chunk;
+		if (io_channel_read_blk64(fs->io, blk + done, num, buf))
+			break;
+	}
+	t = elapsed(&start);
+	if (done && t > 0)
+		plan->read_rate = (double) done * fs->blocksize / t;
+
+	gettimeofday(&start, 0);
+	for (i = 0; i < PLAN_SEEKS; i++) {
+		blk = fs->super->s_first_data_block + i +
+			(end / PLAN_SEEKS) * ((i * 7) % PLAN_SEEKS);
+		if (blk >= end ||
+		    io_channel_read_blk64(fs->io, blk, 1, buf))
+			break;
+	}
+	t = elapsed(&start);
+	if (i) {
+		plan->seek_time = t / i;
+		if (plan->read_rate > 0)
+			plan->seek_time -= fs->blocksize / plan->read_rate;
+		if (plan->seek_time < 0)
+			plan->seek_time = 0;
+	}
+	ext2fs_free_mem(&buf);
+}
+
+void print_resize_plan(ext2_resize_t rfs)
+{
+	struct resize_plan	*plan = &rfs->plan;
+	double			secs = 0;
+
+	printf("%s", _("Resize plan (nothing has been changed):\n"));
+	printf(_("  Blocks to move:              %llu in %llu runs\n"),
+	       (unsigned long long) plan->blocks_moved,
+	       (unsigned long long) plan->block_runs);
+	printf(_("  Extended attribute blocks:   %llu\n"),
+	       (unsigned long long) plan->ea_blocks);
+	printf(_("  Inode tables to move:        %u (%llu blocks)\n"),
+	       plan->itables_moved, (unsigned long long) plan->itable_blocks);
+	printf(_("  Inode table blocks to zero:  %llu\n"),
+	       (unsigned long long) plan->itable_init);
+	printf(_("  Inodes scanned:              %u\n"), plan->inodes_scanned);
+	printf(_("  Inodes to move:              %u\n"), plan->inodes_moved);
+	printf(_("  Inodes with blocks to remap: %u\n"),
+	       plan->inodes_remapped);
+	printf(_("  Directory blocks to update:  %llu\n"),
+	       (unsigned long long) plan->dir_blocks);
+	printf(_("  Estimated seeks:             %llu\n"),
+	       (unsigned long long) plan->seeks);
+	printf(_("  Estimated I/O:               %llu KiB read, "
+		 "%llu KiB written\n"),
+	       (unsigned long long) (plan->bytes_read + 1023) / 1024,
+	       (unsigned long long) (plan->bytes_written + 1023) / 1024);
+	if (plan->read_rate <= 0) {
+		printf("%s", _("  Could not measure the device throughput\n"));
+		return;
+	}
+	/* Writes are assumed to be as fast as reads */
+	secs = plan->seeks * plan->seek_time +
+		(plan->bytes_read + plan->bytes_written) / plan->read_rate;
+	printf(_("  Measured throughput:         %.1f MB/s, "
+		 "%.2f ms per seek\n"),
+	       plan->read_rate / 1000000, plan->seek_time * 1000);
+	printf(_("  Estimated time:              %.1f seconds\n"), secs);
+}
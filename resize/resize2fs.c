@@ -59,6 +59,7 @@ static errcode_t reserve_sparse_super2_last_group(ext2_resize_t rfs,
 static errcode_t resize_group_descriptors(ext2_resize_t rfs, blk64_t new_size);
 static errcode_t move_bg_metadata(ext2_resize_t rfs);
 static errcode_t zero_high_bits_in_inodes(ext2_resize_t rfs);
+static errcode_t plan_resize(ext2_resize_t rfs);
 
 /*
  * Some helper functions to check if a block is in a metadata area
@@ -80,6 +81,56 @@ static int is_inode_tb(ext2_filsys fs, unsigned int grp, blk64_t blk)
 		      fs->inode_blocks_per_group);
 }
 
+/*
+ * On fyp file systems each group's inode table has duplicates, which
+ * may live in any other group.  Copy 0 is the primary table.
+ */
+static inline int itable_copies(ext2_filsys fs)
+{
+	return ext2fs_has_feature_fyp(fs->super) ? EXT2_FYP_ITB_N_DUPS : 1;
+}
+
+static inline blk64_t itable_loc(ext2_filsys fs, dgrp_t grp, int copy)
+{
+	return copy ? ext2fs_dup_inode_table_loc(fs, grp, copy) :
+		ext2fs_inode_table_loc(fs, grp);
+}
+
+static int is_dup_inode_tb(ext2_filsys fs, unsigned int grp, int copy,
+			   blk64_t blk)
+{
+	blk64_t	itb = ext2fs_dup_inode_table_loc(fs, grp, copy);
+
+	return itb && blk >= itb && blk < itb + fs->inode_blocks_per_group;
+}
+
+/*
+ * Find a home for a duplicate inode table whose location has been
+ * zeroed.  The library only looks in the group mke2fs would have
+ * used, which may be full or gone after a resize, so fall back to
+ * any free run of blocks.
+ */
+static errcode_t allocate_dup_itable(ext2_filsys fs, dgrp_t group, int copy,
+				     ext2fs_block_bitmap bmap)
+{
+	blk64_t		blk;
+	errcode_t	retval;
+
+	retval = ext2fs_allocate_dup_inode_tables(fs, group, copy, bmap);
+	if (retval != EXT2_ET_BLOCK_ALLOC_FAIL)
+		return retval;
+
+	retval = ext2fs_get_free_blocks2(fs, fs->super->s_first_data_block,
+					 ext2fs_blocks_count(fs->super) - 1,
+					 fs->inode_blocks_per_group, bmap,
+					 &blk);
+	if (retval)
+		return retval;
+	ext2fs_mark_block_bitmap_range2(bmap, blk, fs->inode_blocks_per_group);
+	ext2fs_dup_inode_table_loc_set(fs, group, copy, blk);
+	return 0;
+}
+
 /* Some bigalloc helper macros which are more succinct... */
 #define B2C(x)	EXT2FS_B2C(fs, (x))
 #define C2B(x)	EXT2FS_C2B(fs, (x))
@@ -102,6 +153,7 @@ errcode_t resize_fs(ext2_filsys fs, blk64_t *new_size, int flags,
 	ext2_resize_t	rfs;
 	errcode_t	retval;
 	struct resource_track	rtrack, overall_track;
+	dgrp_t		i;
 
 	/*
 	 * Create the data structure
@@ -124,9 +176,11 @@ errcode_t resize_fs(ext2_filsys fs, blk64_t *new_size, int flags,
 		goto errout;
 	print_resource_track(rfs, &rtrack, fs->io);
 
-	fs->super->s_state |= EXT2_ERROR_FS;
-	ext2fs_mark_super_dirty(fs);
-	ext2fs_flush(fs);
+	if (!(flags & RESIZE_DRY_RUN)) {
+		fs->super->s_state |= EXT2_ERROR_FS;
+		ext2fs_mark_super_dirty(fs);
+		ext2fs_flush(fs);
+	}
 
 	init_resource_track(&rtrack, "fix_uninit_block_bitmaps 1", fs->io);
 	fix_uninit_block_bitmaps(fs);
@@ -188,6 +242,31 @@ errcode_t resize_fs(ext2_filsys fs, blk64_t *new_size, int flags,
 		goto errout;
 	print_resource_track(rfs, &rtrack, fs->io);
 
+	/*
+	 * A dry run stops here: everything up to now only changed the
+	 * in-memory copies of the file system.
+	 */
+	if (rfs->flags & RESIZE_DRY_RUN) {
+		retval = plan_resize(rfs);
+		if (retval)
+			goto errout;
+		measure_resize_io(rfs);
+		print_resize_plan(rfs);
+
+		ext2fs_free(rfs->new_fs);
+		ext2fs_free(rfs->old_fs);
+		if (rfs->bmap)
+			ext2fs_free_extent_table(rfs->bmap);
+		if (rfs->itable_buf)
+			ext2fs_free_mem(&rfs->itable_buf);
+		if (rfs->reserve_blocks)
+			ext2fs_free_block_bitmap(rfs->reserve_blocks);
+		if (rfs->move_blocks)
+			ext2fs_free_block_bitmap(rfs->move_blocks);
+		ext2fs_free_mem(&rfs);
+		return 0;
+	}
+
 	init_resource_track(&rtrack, "inode_scan_and_fix", fs->io);
 	retval = inode_scan_and_fix(rfs);
 	if (retval)
@@ -228,6 +307,13 @@ errcode_t resize_fs(ext2_filsys fs, blk64_t *new_size, int flags,
 		goto errout;
 	print_resource_track(rfs, &rtrack, fs->io);
 
+	/*
+	 * Blocks and inodes may have been moved anywhere, so an
+	 * incremental fsck has to look at every group.
+	 */
+	for (i = 0; i < rfs->new_fs->group_desc_count; i++)
+		ext2fs_mark_group_dirty(rfs->new_fs, i);
+
 	retval = ext2fs_set_gdt_csum(rfs->new_fs);
 	if (retval)
 		goto errout;
@@ -633,6 +719,7 @@ static errcode_t free_gdp_blocks(ext2_filsys fs,
 {
 	blk64_t		blk;
 	unsigned int	j;
+	int		copy;
 	dgrp_t		i;
 	ext2fs_block_bitmap bg_map = NULL;
 	errcode_t	retval = 0;
@@ -666,14 +753,20 @@ static errcode_t free_gdp_blocks(ext2_filsys fs,
 			ext2fs_mark_block_bitmap2(reserve_blocks, blk);
 		}
 
-		blk = ext2fs_inode_table_loc(old_fs, i);
-		for (j = 0;
-		     j < fs->inode_blocks_per_group; j++, blk++) {
-			if (blk >= ext2fs_blocks_count(fs->super) ||
-			    (bg_map && ext2fs_test_block_bitmap2(bg_map, blk)))
+		/* The duplicate inode tables may be in surviving groups */
+		for (copy = 0; copy < itable_copies(old_fs); copy++) {
+			blk = itable_loc(old_fs, i, copy);
+			if (!blk)
 				continue;
-			ext2fs_block_alloc_stats2(fs, blk, -1);
-			ext2fs_mark_block_bitmap2(reserve_blocks, blk);
+			for (j = 0;
+			     j < fs->inode_blocks_per_group; j++, blk++) {
+				if (blk >= ext2fs_blocks_count(fs->super) ||
+				    (bg_map &&
+				     ext2fs_test_block_bitmap2(bg_map, blk)))
+					continue;
+				ext2fs_block_alloc_stats2(fs, blk, -1);
+				ext2fs_mark_block_bitmap2(reserve_blocks, blk);
+			}
 		}
 	}
 
@@ -698,7 +791,7 @@ errcode_t adjust_fs_info(ext2_filsys fs, ext2_filsys old_fs,
 	blk64_t		old_numblocks, numblocks, adjblocks;
 	unsigned long	i, j, old_desc_blocks;
 	unsigned int	meta_bg, meta_bg_size;
-	int		has_super, csum_flag, has_bg;
+	int		has_super, csum_flag, has_bg, copy;
 	unsigned long long new_inodes;	/* u64 to check for overflow */
 	double		percent;
 
@@ -1000,6 +1093,24 @@ retry:
 
 		group_block += fs->super->s_blocks_per_group;
 	}
+
+	/*
+	 * The duplicate inode tables of the new groups go into other
+	 * groups, so place them only after every new primary table has
+	 * been placed in its own group.
+	 */
+	for (i = old_fs->group_desc_count;
+	     i < fs->group_desc_count; i++) {
+		for (copy = 1; copy < itable_copies(fs); copy++) {
+			retval = allocate_dup_itable(fs, i, copy,
+						     fs->block_map);
+			if (retval)
+				goto errout;
+			ext2fs_block_alloc_stats_range(fs,
+				ext2fs_dup_inode_table_loc(fs, i, copy),
+				fs->inode_blocks_per_group, +1);
+		}
+	}
 	retval = 0;
 
 	/*
@@ -1024,7 +1135,7 @@ errout:
 static errcode_t adjust_superblock(ext2_resize_t rfs, blk64_t new_size)
 {
 	ext2_filsys	fs = rfs->new_fs;
-	int		adj = 0;
+	int		adj = 0, copy;
 	errcode_t	retval;
 	blk64_t		group_block;
 	unsigned long	i;
@@ -1082,6 +1193,18 @@ static errcode_t adjust_superblock(ext2_resize_t rfs, blk64_t new_size)
 		goto errout;
 	}
 
+	if (rfs->flags & RESIZE_DRY_RUN) {
+		i = (fs->group_desc_count - rfs->old_fs->group_desc_count) *
+			itable_copies(fs);
+		rfs->plan.itable_init = (blk64_t) i *
+			fs->inode_blocks_per_group;
+		rfs->plan.seeks += i;
+		rfs->plan.bytes_written += rfs->plan.itable_init *
+			fs->blocksize;
+		retval = 0;
+		goto errout;
+	}
+
 	/*
 	 * Initialize the inode table
 	 */
@@ -1106,11 +1229,14 @@ static errcode_t adjust_superblock(ext2_resize_t rfs, blk64_t new_size)
 		/*
 		 * Write out the new inode table
 		 */
-		retval = ext2fs_zero_blocks2(fs, ext2fs_inode_table_loc(fs, i),
-					     fs->inode_blocks_per_group, NULL,
-					     NULL);
-		if (retval)
-			goto errout;
+		for (copy = 0; copy < itable_copies(fs); copy++) {
+			retval = ext2fs_zero_blocks2(fs,
+						     itable_loc(fs, i, copy),
+						     fs->inode_blocks_per_group,
+						     NULL, NULL);
+			if (retval)
+				goto errout;
+		}
 
 		io_channel_flush(fs->io);
 		if (rfs->progress) {
@@ -1149,17 +1275,21 @@ static errcode_t mark_table_blocks(ext2_filsys fs,
 {
 	dgrp_t			i;
 	blk64_t			blk;
+	int			copy;
 
 	for (i = 0; i < fs->group_desc_count; i++) {
 		ext2fs_reserve_super_and_bgd(fs, i, bmap);
 
 		/*
-		 * Mark the blocks used for the inode table
+		 * Mark the blocks used for the inode table and its
+		 * duplicates
 		 */
-		blk = ext2fs_inode_table_loc(fs, i);
-		if (blk)
-			ext2fs_mark_block_bitmap_range2(bmap, blk,
+		for (copy = 0; copy < itable_copies(fs); copy++) {
+			blk = itable_loc(fs, i, copy);
+			if (blk)
+				ext2fs_mark_block_bitmap_range2(bmap, blk,
 						fs->inode_blocks_per_group);
+		}
 
 		/*
 		 * Mark block used for the block bitmap
@@ -1233,6 +1363,22 @@ static void mark_fs_metablock(ext2_resize_t rfs,
 			}
 		}
 	}
+	if (ext2fs_has_feature_fyp(fs->super)) {
+		dgrp_t i;
+		int copy;
+
+		for (i = 0; i < rfs->old_fs->group_desc_count &&
+			    i < fs->group_desc_count; i++) {
+			for (copy = 1; copy < itable_copies(fs); copy++) {
+				if (is_dup_inode_tb(fs, i, copy, blk)) {
+					ext2fs_dup_inode_table_loc_set(fs, i,
+								copy, 0);
+					rfs->needed_blocks++;
+					return;
+				}
+			}
+		}
+	}
 
 	if (ext2fs_has_group_desc_csum(fs) &&
 	    (ext2fs_bg_flags_test(fs, group, EXT2_BG_BLOCK_UNINIT))) {
@@ -1266,7 +1412,7 @@ static errcode_t blocks_to_move(ext2_resize_t rfs)
 	errcode_t	retval;
 	ext2_filsys 	fs, old_fs;
 	ext2fs_block_bitmap	meta_bmap, new_meta_bmap = NULL;
-	int		flex_bg;
+	int		flex_bg, copy;
 
 	fs = rfs->new_fs;
 	old_fs = rfs->old_fs;
@@ -1322,6 +1468,18 @@ static errcode_t blocks_to_move(ext2_resize_t rfs)
 				if (retval)
 					return retval;
 			}
+
+			for (copy = 1; copy < itable_copies(fs); copy++) {
+				blk = ext2fs_dup_inode_table_loc(fs, g, copy);
+				if (blk + fs->inode_blocks_per_group <=
+				    new_size)
+					continue;
+				ext2fs_dup_inode_table_loc_set(fs, g, copy, 0);
+				retval = allocate_dup_itable(fs, g, copy,
+							     fs->block_map);
+				if (retval)
+					return retval;
+			}
 		}
 	}
 
@@ -1486,6 +1644,18 @@ static errcode_t blocks_to_move(ext2_resize_t rfs)
 					ext2fs_inode_table_loc(old_fs, i),
 					old_fs->inode_blocks_per_group);
 
+		/* Duplicate inode tables can be in any group */
+		for (copy = 1; copy < itable_copies(fs); copy++) {
+			blk = ext2fs_dup_inode_table_loc(fs, i, copy);
+			if (!blk)
+				blk = ext2fs_dup_inode_table_loc(old_fs, i,
+								 copy);
+			if (blk)
+				ext2fs_mark_block_bitmap_range2(
+					rfs->reserve_blocks, blk,
+					fs->inode_blocks_per_group);
+		}
+
 		group_blk += rfs->new_fs->super->s_blocks_per_group;
 	}
 
@@ -1556,6 +1726,35 @@ static errcode_t blocks_to_move(ext2_resize_t rfs)
 		     j < fs->inode_blocks_per_group ; j++, blk++)
 			ext2fs_mark_block_bitmap2(rfs->reserve_blocks, blk);
 	}
+
+	/*
+	 * Duplicate inode tables displaced by the new descriptor
+	 * blocks are handled the same way; the old copies were
+	 * reserved above, and move_itables() rewrites them from the
+	 * primary table.
+	 */
+	for (i = 0; i < max_groups; i++) {
+		for (copy = 1; copy < itable_copies(fs); copy++) {
+			if (ext2fs_dup_inode_table_loc(fs, i, copy))
+				continue;
+
+			retval = allocate_dup_itable(fs, i, copy,
+						     rfs->reserve_blocks);
+			if (retval)
+				goto errout;
+			rfs->needed_blocks += fs->inode_blocks_per_group;
+
+			for (blk = ext2fs_dup_inode_table_loc(fs, i, copy), j=0;
+			     j < fs->inode_blocks_per_group ; j++, blk++) {
+				ext2fs_block_alloc_stats2(fs, blk, +1);
+				if (ext2fs_test_block_bitmap2(old_fs->block_map,
+							      blk) &&
+				    !ext2fs_test_block_bitmap2(meta_bmap, blk))
+					ext2fs_mark_block_bitmap2(
+						rfs->move_blocks, blk);
+			}
+		}
+	}
 	retval = 0;
 
 errout:
@@ -1657,14 +1856,130 @@ static errcode_t resize2fs_get_alloc_block(ext2_filsys fs,
 	return 0;
 }
 
+/*
+ * Blocks are copied in batches of up to BMOVE_BUF_SIZE bytes.  All the
+ * source runs of a batch are read into one buffer before any of it is
+ * written.  get_new_block() hands out destinations in increasing
+ * order, so runs whose sources are scattered usually land next to each
+ * other and go out in a single write.  While a batch is being written,
+ * the io manager is asked to read ahead the sources of the next one,
+ * so that reading and writing overlap.
+ *
+ * Destinations are always blocks which are free in the old file
+ * system, so until the metadata is switched over an interrupted move
+ * leaves the old file system intact, just as copying one run at a time
+ * did.
+ */
+#define BMOVE_BUF_SIZE	(8 * 1024 * 1024)
+
+struct bmove_run {
+	blk64_t		old_blk;
+	blk64_t		new_blk;
+	blk64_t		num;
+};
+
+struct bmove_batch {
+	struct bmove_run *runs;
+	int		count;
+	blk64_t		blocks;
+};
+
+/*
+ * Fill batch with up to max blocks, taking them from the rest of the
+ * current extent in *next and then from rfs->bmap.
+ */
+static errcode_t bmove_fill(ext2_resize_t rfs, struct bmove_run *next,
+			    struct bmove_batch *batch, blk64_t max)
+{
+	ext2_filsys		fs = rfs->new_fs;
+	struct bmove_run	*run;
+	__u64			size;
+	errcode_t		retval;
+
+	batch->count = 0;
+	batch->blocks = 0;
+	while (batch->blocks < max) {
+		if (next->num == 0) {
+			retval = ext2fs_iterate_extent(rfs->bmap,
+						       &next->old_blk,
+						       &next->new_blk, &size);
+			if (retval)
+				return retval;
+			if (!size)
+				break;
+			next->old_blk = C2B(next->old_blk);
+			next->new_blk = C2B(next->new_blk);
+			next->num = C2B(size);
+#ifdef RESIZE2FS_DEBUG
+			if (rfs->flags & RESIZE_DEBUG_BMOVE)
+				printf("Moving %llu blocks %llu->%llu\n",
+				       next->num, next->old_blk,
+				       next->new_blk);
+#endif
+		}
+		run = &batch->runs[batch->count++];
+		*run = *next;
+		if (run->num > max - batch->blocks)
+			run->num = max - batch->blocks;
+		next->old_blk += run->num;
+		next->new_blk += run->num;
+		next->num -= run->num;
+		batch->blocks += run->num;
+	}
+	return 0;
+}
+
+/*
+ * Read the sources of a batch into buf, or write buf out to the
+ * destinations, merging runs which are contiguous on disk.
+ */
+static errcode_t bmove_io(ext2_filsys fs, struct bmove_batch *batch,
+			  char *buf, int write)
+{
+	struct bmove_run	*runs = batch->runs;
+	blk64_t			blk, num;
+	errcode_t		retval;
+	int			i, j;
+
+	for (i = 0; i < batch->count; i = j) {
+		blk = write ? runs[i].new_blk : runs[i].old_blk;
+		num = runs[i].num;
+		for (j = i + 1; j < batch->count; j++) {
+			if ((write ? runs[j].new_blk : runs[j].old_blk) !=
+			    blk + num)
+				break;
+			num += runs[j].num;
+		}
+		if (write)
+			retval = io_channel_write_blk64(fs->io, blk, num, buf);
+		else
+			retval = io_channel_read_blk64(fs->io, blk, num, buf);
+		if (retval)
+			return retval;
+		buf += num * fs->blocksize;
+	}
+	return 0;
+}
+
+static void bmove_readahead(ext2_filsys fs, struct bmove_batch *batch)
+{
+	int	i;
+
+	for (i = 0; i < batch->count; i++)
+		io_channel_cache_readahead(fs->io, batch->runs[i].old_blk,
+					   batch->runs[i].num);
+}
+
 static errcode_t block_mover(ext2_resize_t rfs)
 {
-	blk64_t			blk, old_blk, new_blk;
+	blk64_t			blk, new_blk, max;
 	ext2_filsys		fs = rfs->new_fs;
 	ext2_filsys		old_fs = rfs->old_fs;
 	errcode_t		retval;
-	__u64			c, size;
-	int			to_move, moved;
+	struct bmove_batch	batch[2];
+	struct bmove_run	next;
+	char			*buf = NULL;
+	int			to_move, moved, cur;
 	ext2_badblocks_list	badblock_list = 0;
 	int			bb_modified = 0;
 
@@ -1676,13 +1991,6 @@ static errcode_t block_mover(ext2_resize_t rfs)
 		return retval;
 
 	new_blk = fs->super->s_first_data_block;
-	if (!rfs->itable_buf) {
-		retval = ext2fs_get_array(fs->blocksize,
-					fs->inode_blocks_per_group,
-					&rfs->itable_buf);
-		if (retval)
-			return retval;
-	}
 	retval = ext2fs_create_extent_table(&rfs->bmap, 0);
 	if (retval)
 		return retval;
@@ -1692,6 +2000,7 @@ static errcode_t block_mover(ext2_resize_t rfs)
 	 * will go.
 	 */
 	to_move = moved = 0;
+	memset(batch, 0, sizeof(batch));
 	init_block_alloc(rfs);
 	for (blk = B2C(old_fs->super->s_first_data_block);
 	     blk < ext2fs_blocks_count(old_fs->super);
@@ -1731,54 +2040,74 @@ static errcode_t block_mover(ext2_resize_t rfs)
 	retval =  ext2fs_iterate_extent(rfs->bmap, 0, 0, 0);
 	if (retval) goto errout;
 
+	if (rfs->flags & RESIZE_DRY_RUN) {
+		__u64	old_loc, new_loc, size;
+
+		/* Each run is read once and written once */
+		while (!ext2fs_iterate_extent(rfs->bmap, &old_loc,
+					      &new_loc, &size) && size) {
+			rfs->plan.block_runs++;
+			rfs->plan.blocks_moved += C2B(size);
+		}
+		rfs->plan.seeks += 2 * rfs->plan.block_runs;
+		rfs->plan.bytes_read += rfs->plan.blocks_moved * fs->blocksize;
+		rfs->plan.bytes_written += rfs->plan.blocks_moved *
+			fs->blocksize;
+		goto errout;
+	}
+
 	if (rfs->progress) {
 		retval = (rfs->progress)(rfs, E2_RSZ_BLOCK_RELOC_PASS,
 					 0, to_move);
 		if (retval)
 			goto errout;
 	}
-	while (1) {
-		retval = ext2fs_iterate_extent(rfs->bmap, &old_blk, &new_blk, &size);
-		if (retval) goto errout;
-		if (!size)
-			break;
-		old_blk = C2B(old_blk);
-		new_blk = C2B(new_blk);
-		size = C2B(size);
-#ifdef RESIZE2FS_DEBUG
-		if (rfs->flags & RESIZE_DEBUG_BMOVE)
-			printf("Moving %llu blocks %llu->%llu\n",
-			       size, old_blk, new_blk);
-#endif
-		do {
-			c = size;
-			if (c > fs->inode_blocks_per_group)
-				c = fs->inode_blocks_per_group;
-			retval = io_channel_read_blk64(fs->io, old_blk, c,
-						       rfs->itable_buf);
-			if (retval) goto errout;
-			retval = io_channel_write_blk64(fs->io, new_blk, c,
-							rfs->itable_buf);
-			if (retval) goto errout;
-			size -= c;
-			new_blk += c;
-			old_blk += c;
-			moved += c;
-			if (rfs->progress) {
-				io_channel_flush(fs->io);
-				retval = (rfs->progress)(rfs,
-						E2_RSZ_BLOCK_RELOC_PASS,
-						moved, to_move);
-				if (retval)
-					goto errout;
-			}
-		} while (size > 0);
+
+	max = BMOVE_BUF_SIZE / fs->blocksize;
+	retval = io_channel_alloc_buf(fs->io, max, &buf);
+	if (retval)
+		goto errout;
+	retval = ext2fs_get_array(max, sizeof(struct bmove_run),
+				  &batch[0].runs);
+	if (retval)
+		goto errout;
+	retval = ext2fs_get_array(max, sizeof(struct bmove_run),
+				  &batch[1].runs);
+	if (retval)
+		goto errout;
+
+	memset(&next, 0, sizeof(next));
+	retval = bmove_fill(rfs, &next, &batch[0], max);
+	if (retval)
+		goto errout;
+	for (cur = 0; batch[cur].count; cur ^= 1) {
+		retval = bmove_io(fs, &batch[cur], buf, 0);
+		if (retval)
+			goto errout;
+		retval = bmove_fill(rfs, &next, &batch[cur ^ 1], max);
+		if (retval)
+			goto errout;
+		bmove_readahead(fs, &batch[cur ^ 1]);
+		retval = bmove_io(fs, &batch[cur], buf, 1);
+		if (retval)
+			goto errout;
 		io_channel_flush(fs->io);
+		moved += batch[cur].blocks;
+		if (rfs->progress) {
+			retval = (rfs->progress)(rfs, E2_RSZ_BLOCK_RELOC_PASS,
+						 moved, to_move);
+			if (retval)
+				goto errout;
+		}
 	}
 
 errout:
+	ext2fs_free_mem(&batch[0].runs);
+	ext2fs_free_mem(&batch[1].runs);
+	ext2fs_free_mem(&buf);
 	if (badblock_list) {
-		if (!retval && bb_modified)
+		if (!retval && bb_modified &&
+		    !(rfs->flags & RESIZE_DRY_RUN))
 			retval = ext2fs_update_bb_inode(old_fs,
 							badblock_list);
 		ext2fs_badblocks_list_free(badblock_list);
@@ -1859,6 +2188,54 @@ static int process_block(ext2_filsys fs, blk64_t	*block_nr,
 	return ret;
 }
 
+/*
+ * Like process_block(), for the BMPT-mapped directories of fyp file
+ * systems: every replica of a data or tree block may have moved.
+ * Interior blocks are visited before their children are read, so the
+ * children come from the block's new home, which block_mover() has
+ * already filled.
+ */
+static int process_bmpt_block(ext2_filsys fs, int dup_on,
+			      struct ext2_bmptirec *irec, e2_blkcnt_t blockcnt,
+			      struct ext2_bmptirec *ref_irec EXT2FS_ATTR((unused)),
+			      int ref_offset EXT2FS_ATTR((unused)),
+			      void *priv_data)
+{
+	struct process_block_struct *pb;
+	errcode_t	retval;
+	blk64_t		block, new_block;
+	int		i, ret = 0;
+
+	pb = (struct process_block_struct *) priv_data;
+	for (i = 0; pb->rfs->bmap && i < (dup_on ? EXT2_BMPT_N_DUPS : 1); i++) {
+		block = irec->b_blocks[i];
+		if (!block)
+			continue;
+		new_block = extent_translate(fs, pb->rfs->bmap, block);
+		if (!new_block)
+			continue;
+		irec->b_blocks[i] = new_block;
+		ret |= BLOCK_CHANGED;
+		pb->changed = 1;
+#ifdef RESIZE2FS_DEBUG
+		if (pb->rfs->flags & RESIZE_DEBUG_BMOVE)
+			printf("ino=%u, blockcnt=%lld, replica %d, %llu->%llu\n",
+			       pb->old_ino, blockcnt, i, block, new_block);
+#endif
+	}
+
+	if (pb->is_dir && blockcnt >= 0) {
+		retval = ext2fs_add_dir_block2(fs->dblist, pb->ino,
+					       irec->b_blocks[0],
+					       (int) blockcnt);
+		if (retval) {
+			pb->error = retval;
+			ret |= BLOCK_ABORT;
+		}
+	}
+	return ret;
+}
+
 /*
  * Progress callback
  */
@@ -1979,6 +2356,82 @@ out:
 	return errcode;
 }
 
+/* The inode tables are scanned in chunks of up to this size */
+#define INODE_SCAN_BUF_SIZE	(8 * 1024 * 1024)
+
+/*
+ * Remap an extent-mapped file a whole extent at a time: every extent,
+ * and every block of the extent tree, is handed to
+ * ext2fs_extent_translate_range() once instead of having
+ * ext2fs_block_iterate3() translate and set each block.  An extent
+ * which straddles relocation boundaries is split at them.  Returns 1
+ * if the caller has to use ext2fs_block_iterate3() instead.
+ */
+static int remap_extent_inode(ext2_resize_t rfs, ext2_ino_t ino,
+			      struct ext2_inode *inode, errcode_t *ret)
+{
+	ext2_filsys		fs = rfs->old_fs;
+	ext2_extent_handle_t	handle;
+	struct ext2fs_extent	extent, piece;
+	blk64_t			len, off, new_blk;
+	__u64			run;
+	errcode_t		retval;
+
+	*ret = 0;
+	if (!(inode->i_flags & EXT4_EXTENTS_FL) ||
+	    EXT2FS_CLUSTER_RATIO(fs) > 1)
+		return 1;
+	if (ext2fs_extent_open2(fs, ino, inode, &handle))
+		return 1;
+
+	retval = ext2fs_extent_get(handle, EXT2_EXTENT_ROOT, &extent);
+	while (retval == 0) {
+		if (extent.e_flags & EXT2_EXTENT_FLAGS_SECOND_VISIT)
+			goto next;
+		len = (extent.e_flags & EXT2_EXTENT_FLAGS_LEAF) ?
+			extent.e_len : 1;
+		new_blk = ext2fs_extent_translate_range(rfs->bmap,
+					extent.e_pblk, len, &run);
+		if (!new_blk && run == len)
+			goto next;
+
+		piece = extent;
+		for (off = 0; off < len; off += run) {
+			if (off)
+				new_blk = ext2fs_extent_translate_range(
+						rfs->bmap, extent.e_pblk + off,
+						len - off, &run);
+			piece.e_lblk = extent.e_lblk + off;
+			piece.e_pblk = new_blk ? new_blk :
+				extent.e_pblk + off;
+			piece.e_len = run;
+#ifdef RESIZE2FS_DEBUG
+			if (new_blk && (rfs->flags & RESIZE_DEBUG_BMOVE))
+				printf("ino=%u, extent %llu/%llu, %llu->%llu\n",
+				       ino, piece.e_lblk, run,
+				       extent.e_pblk + off, new_blk);
+#endif
+			if (off)
+				retval = ext2fs_extent_insert(handle,
+						EXT2_EXTENT_INSERT_AFTER,
+						&piece);
+			else
+				retval = ext2fs_extent_replace(handle, 0,
+							       &piece);
+			if (retval)
+				goto out;
+		}
+	next:
+		retval = ext2fs_extent_get(handle, EXT2_EXTENT_NEXT, &extent);
+	}
+	if (retval == EXT2_ET_EXTENT_NO_NEXT)
+		retval = 0;
+out:
+	ext2fs_extent_free(handle);
+	*ret = retval;
+	return 0;
+}
+
 static void quiet_com_err_proc(const char *whoami EXT2FS_ATTR((unused)),
 			       errcode_t code EXT2FS_ATTR((unused)),
 			       const char *fmt EXT2FS_ATTR((unused)),
@@ -1995,7 +2448,7 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 	errcode_t		retval;
 	char			*block_buf = 0;
 	ext2_ino_t		start_to_move;
-	int			inode_size;
+	int			inode_size, scan_blocks;
 
 	if ((rfs->old_fs->group_desc_count <=
 	     rfs->new_fs->group_desc_count) &&
@@ -2004,12 +2457,19 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 
 	set_com_err_hook(quiet_com_err_proc);
 
-	retval = ext2fs_open_inode_scan(rfs->old_fs, 0, &scan);
+	/* Read the inode tables in large chunks */
+	scan_blocks = INODE_SCAN_BUF_SIZE / rfs->old_fs->blocksize;
+	if (scan_blocks > rfs->old_fs->inode_blocks_per_group)
+		scan_blocks = rfs->old_fs->inode_blocks_per_group;
+	retval = ext2fs_open_inode_scan(rfs->old_fs, scan_blocks, &scan);
 	if (retval) goto errout;
 
 	retval = ext2fs_init_dblist(rfs->old_fs, 0);
 	if (retval) goto errout;
-	retval = ext2fs_get_array(rfs->old_fs->blocksize, 3, &block_buf);
+	/* The BMPT walker wants a buffer for every level of the tree */
+	retval = ext2fs_get_array(rfs->old_fs->blocksize,
+				  ext2fs_has_feature_fyp(rfs->old_fs->super) ?
+				  EXT2_BMPT_MAXLEVELS : 3, &block_buf);
 	if (retval) goto errout;
 
 	start_to_move = (rfs->new_fs->group_desc_count *
@@ -2108,6 +2568,7 @@ remap_blocks:
 		 * Update inodes to point to new blocks; schedule directory
 		 * blocks for inode remapping.  Need to write out dir blocks
 		 * with new inode numbers if we have metadata_csum enabled.
+		 * Files none of whose blocks moved are left alone.
 		 */
 		if (ext2fs_inode_has_valid_blocks2(rfs->old_fs, inode) &&
 		    (rfs->bmap || pb.is_dir)) {
@@ -2115,9 +2576,16 @@ remap_blocks:
 			pb.old_ino = ino;
 			pb.has_extents = inode->i_flags & EXT4_EXTENTS_FL;
 			rfs->old_fs->flags |= EXT2_FLAG_IGNORE_CSUM_ERRORS;
-			retval = ext2fs_block_iterate3(rfs->old_fs,
-						       new_inode, 0, block_buf,
-						       process_block, &pb);
+			if (inode->i_flags & EXT2_FYP_BMPT_FL)
+				retval = ext2fs_bmpt_block_iterate(rfs->old_fs,
+						new_inode, 0, block_buf,
+						process_bmpt_block, &pb);
+			else if (pb.is_dir ||
+				 remap_extent_inode(rfs, new_inode, inode,
+						    &retval))
+				retval = ext2fs_block_iterate3(rfs->old_fs,
+						new_inode, 0, block_buf,
+						process_block, &pb);
 			rfs->old_fs->flags &= ~EXT2_FLAG_IGNORE_CSUM_ERRORS;
 			if (retval)
 				goto errout;
@@ -2162,6 +2630,8 @@ struct istruct {
 	errcode_t	err;
 	unsigned int	max_dirs;
 	unsigned int	num;
+	ext2_ino_t	last_dir;	/* times already updated */
+	ext2_ino_t	last_fyp_dir;	/* already walked by fix_fyp_dir() */
 };
 
 static int check_and_change_inodes(ext2_ino_t dir,
@@ -2210,7 +2680,10 @@ static int check_and_change_inodes(ext2_ino_t dir,
 
 	dirent->inode = new_inode;
 
-	/* Update the directory mtime and ctime */
+	/* Update the directory mtime and ctime, once per directory */
+	if (dir == is->last_dir)
+		return ret | DIRENT_CHANGED;
+	is->last_dir = dir;
 	retval = ext2fs_read_inode(is->rfs->old_fs, dir, &inode);
 	if (retval == 0) {
 		inode.i_mtime = inode.i_ctime = time(0);
@@ -2222,6 +2695,47 @@ static int check_and_change_inodes(ext2_ino_t dir,
 	return ret | DIRENT_CHANGED;
 }
 
+/*
+ * The directory list is walked in inode order, so that all the blocks
+ * of a directory are seen one after another and check_and_change_inodes()
+ * only updates its times once.
+ */
+static EXT2_QSORT_TYPE db_ino_cmp(const void *a, const void *b)
+{
+	const struct ext2_db_entry2 *db_a = (const struct ext2_db_entry2 *) a;
+	const struct ext2_db_entry2 *db_b = (const struct ext2_db_entry2 *) b;
+
+	if (db_a->ino != db_b->ino)
+		return (db_a->ino < db_b->ino) ? -1 : 1;
+	if (db_a->blockcnt != db_b->blockcnt)
+		return (db_a->blockcnt < db_b->blockcnt) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * ext2fs_dblist_dir_iterate() would only rewrite the first replica of
+ * the directory blocks of a fyp file system, so there we walk each
+ * directory in the list with ext2fs_dir_iterate2(), which writes
+ * changed blocks to every replica.
+ */
+static int fix_fyp_dir(ext2_filsys fs, struct ext2_db_entry2 *db_info,
+		       void *priv_data)
+{
+	struct istruct *is = (struct istruct *) priv_data;
+	errcode_t	retval;
+
+	if (db_info->ino == is->last_fyp_dir)
+		return 0;
+	is->last_fyp_dir = db_info->ino;
+
+	retval = ext2fs_dir_iterate2(fs, db_info->ino,
+				     DIRENT_FLAG_INCLUDE_EMPTY, 0,
+				     check_and_change_inodes, is);
+	if (retval && !is->err)
+		is->err = retval;
+	return is->err ? DBLIST_ABORT : 0;
+}
+
 static errcode_t inode_ref_fix(ext2_resize_t rfs)
 {
 	errcode_t		retval;
@@ -2238,6 +2752,8 @@ static errcode_t inode_ref_fix(ext2_resize_t rfs)
 	is.max_dirs = ext2fs_dblist_count2(rfs->old_fs->dblist);
 	is.rfs = rfs;
 	is.err = 0;
+	is.last_dir = 0;
+	is.last_fyp_dir = 0;
 
 	if (rfs->progress) {
 		retval = (rfs->progress)(rfs, E2_RSZ_INODE_REF_UPD_PASS,
@@ -2247,9 +2763,15 @@ static errcode_t inode_ref_fix(ext2_resize_t rfs)
 	}
 
 	rfs->old_fs->flags |= EXT2_FLAG_IGNORE_CSUM_ERRORS;
-	retval = ext2fs_dblist_dir_iterate(rfs->old_fs->dblist,
-					   DIRENT_FLAG_INCLUDE_EMPTY, 0,
-					   check_and_change_inodes, &is);
+	ext2fs_dblist_sort2(rfs->old_fs->dblist, db_ino_cmp);
+	if (ext2fs_has_feature_fyp(rfs->old_fs->super))
+		retval = ext2fs_dblist_iterate2(rfs->old_fs->dblist,
+						fix_fyp_dir, &is);
+	else
+		retval = ext2fs_dblist_dir_iterate(rfs->old_fs->dblist,
+						   DIRENT_FLAG_INCLUDE_EMPTY,
+						   0, check_and_change_inodes,
+						   &is);
 	rfs->old_fs->flags &= ~EXT2_FLAG_IGNORE_CSUM_ERRORS;
 	if (retval)
 		goto errout;
@@ -2283,6 +2805,21 @@ errout:
  */
 
 
+/*
+ * Returns a mask of the copies of a group's inode table, bit 0 being
+ * the primary, which have a new location.
+ */
+static int itables_moved(ext2_resize_t rfs, dgrp_t group)
+{
+	int	copy, mask = 0;
+
+	for (copy = 0; copy < itable_copies(rfs->new_fs); copy++)
+		if (itable_loc(rfs->old_fs, group, copy) !=
+		    itable_loc(rfs->new_fs, group, copy))
+			mask |= 1 << copy;
+	return mask;
+}
+
 /*
  * A very scary routine --- this one moves the inode table around!!!
  *
@@ -2298,7 +2835,7 @@ static errcode_t move_itables(ext2_resize_t rfs)
 	char		*cp;
 	blk64_t		old_blk, new_blk, blk, cluster_freed;
 	errcode_t	retval;
-	int		to_move, moved;
+	int		to_move, moved, mask, copy;
 	unsigned int	j;
 	ext2fs_block_bitmap	new_bmap = NULL;
 
@@ -2329,8 +2866,7 @@ static errcode_t move_itables(ext2_resize_t rfs)
 	 */
 	to_move = moved = 0;
 	for (i=0; i < max_groups; i++)
-		if (ext2fs_inode_table_loc(rfs->old_fs, i) !=
-		    ext2fs_inode_table_loc(fs, i))
+		if (itables_moved(rfs, i))
 			to_move++;
 
 	if (to_move == 0) {
@@ -2358,16 +2894,23 @@ static errcode_t move_itables(ext2_resize_t rfs)
 			       i, old_blk, new_blk, diff);
 #endif
 
-		if (!diff)
+		mask = itables_moved(rfs, i);
+		if (!mask)
 			continue;
-		if (diff < 0)
-			diff = 0;
 
+		/*
+		 * The primary table is read once; any duplicates which
+		 * moved are rewritten from it below.
+		 */
 		retval = io_channel_read_blk64(fs->io, old_blk,
 					       fs->inode_blocks_per_group,
 					       rfs->itable_buf);
 		if (retval)
 			goto errout;
+		if (!diff)
+			goto move_dups;
+		if (diff < 0)
+			diff = 0;
 		/*
 		 * The end of the inode table segment often contains
 		 * all zeros, and we're often only moving the inode
@@ -2420,6 +2963,38 @@ static errcode_t move_itables(ext2_resize_t rfs)
 		}
 
 		ext2fs_inode_table_loc_set(rfs->old_fs, i, new_blk);
+
+	move_dups:
+		for (copy = 1; copy < itable_copies(fs); copy++) {
+			if (!(mask & (1 << copy)))
+				continue;
+			old_blk = ext2fs_dup_inode_table_loc(rfs->old_fs, i,
+							     copy);
+			new_blk = ext2fs_dup_inode_table_loc(fs, i, copy);
+#ifdef RESIZE2FS_DEBUG
+			if (rfs->flags & RESIZE_DEBUG_ITABLEMOVE)
+				printf("Itable copy %d move group %d "
+				       "block %llu->%llu\n",
+				       copy, i, old_blk, new_blk);
+#endif
+			retval = io_channel_write_blk64(fs->io, new_blk,
+						fs->inode_blocks_per_group,
+						rfs->itable_buf);
+			if (retval)
+				goto errout;
+
+			for (blk = old_blk, j = 0;
+			     j < fs->inode_blocks_per_group; j++, blk++) {
+				if (blk >= ext2fs_blocks_count(fs->super) ||
+				    (new_bmap &&
+				     ext2fs_test_block_bitmap2(new_bmap, blk)))
+					continue;
+				ext2fs_block_alloc_stats2(fs, blk, -1);
+			}
+			ext2fs_dup_inode_table_loc_set(rfs->old_fs, i, copy,
+						       new_blk);
+		}
+
 		ext2fs_group_desc_csum_set(rfs->old_fs, i);
 		ext2fs_mark_super_dirty(rfs->old_fs);
 		ext2fs_flush(rfs->old_fs);
@@ -2445,6 +3020,195 @@ errout:
 	return retval;
 }
 
+/* --------------------------------------------------------------------
+ *
+ * Dry run support
+ *
+ * --------------------------------------------------------------------
+ */
+
+static int plan_block(ext2_filsys fs, blk64_t *block_nr,
+		      e2_blkcnt_t blockcnt,
+		      blk64_t ref_block EXT2FS_ATTR((unused)),
+		      int ref_offset EXT2FS_ATTR((unused)), void *priv_data)
+{
+	struct process_block_struct *pb;
+
+	pb = (struct process_block_struct *) priv_data;
+	if (pb->rfs->bmap && extent_translate(fs, pb->rfs->bmap, *block_nr))
+		pb->changed = 1;
+	if (pb->is_dir && blockcnt >= 0)
+		pb->rfs->plan.dir_blocks++;
+	return 0;
+}
+
+static int plan_bmpt_block(ext2_filsys fs, int dup_on,
+			   struct ext2_bmptirec *irec, e2_blkcnt_t blockcnt,
+			   struct ext2_bmptirec *ref_irec EXT2FS_ATTR((unused)),
+			   int ref_offset EXT2FS_ATTR((unused)),
+			   void *priv_data)
+{
+	struct process_block_struct *pb;
+	int		i;
+
+	pb = (struct process_block_struct *) priv_data;
+	for (i = 0; pb->rfs->bmap && i < (dup_on ? EXT2_BMPT_N_DUPS : 1); i++)
+		if (irec->b_blocks[i] &&
+		    extent_translate(fs, pb->rfs->bmap, irec->b_blocks[i]))
+			pb->changed = 1;
+	if (pb->is_dir && blockcnt >= 0)
+		pb->rfs->plan.dir_blocks++;
+	return 0;
+}
+
+/*
+ * Work out what inode_scan_and_fix(), inode_ref_fix() and
+ * move_itables() would have to do, reading but never writing
+ * anything.  block_mover() has already filled in the relocation
+ * table and accounted for the blocks it would copy.
+ */
+static errcode_t plan_resize(ext2_resize_t rfs)
+{
+	struct resize_plan	*plan = &rfs->plan;
+	struct process_block_struct pb;
+	ext2_filsys		fs = rfs->old_fs;
+	ext2_inode_scan		scan = NULL;
+	struct ext2_inode	*inode = NULL;
+	ext2fs_block_bitmap	ea_map = NULL;
+	ext2_ino_t		ino, start_to_move, dirs = 0;
+	char			*block_buf = NULL;
+	blk64_t			ea_blk;
+	dgrp_t			i, max_groups;
+	int			mask, inode_size, scan_blocks;
+	errcode_t		retval;
+
+	/* Every inode table copy which moves is read and written once */
+	max_groups = rfs->new_fs->group_desc_count;
+	if (max_groups > fs->group_desc_count)
+		max_groups = fs->group_desc_count;
+	for (i = 0; i < max_groups; i++) {
+		for (mask = itables_moved(rfs, i); mask; mask &= mask - 1) {
+			plan->itables_moved++;
+			plan->itable_blocks += fs->inode_blocks_per_group;
+		}
+	}
+	plan->seeks += 2 * plan->itables_moved;
+	plan->bytes_read += plan->itable_blocks * fs->blocksize;
+	plan->bytes_written += plan->itable_blocks * fs->blocksize;
+
+	if ((fs->group_desc_count <= rfs->new_fs->group_desc_count) &&
+	    !rfs->bmap)
+		return 0;
+
+	set_com_err_hook(quiet_com_err_proc);
+
+	scan_blocks = INODE_SCAN_BUF_SIZE / fs->blocksize;
+	if (scan_blocks > fs->inode_blocks_per_group)
+		scan_blocks = fs->inode_blocks_per_group;
+	retval = ext2fs_open_inode_scan(fs, scan_blocks, &scan);
+	if (retval)
+		goto errout;
+	retval = ext2fs_get_array(fs->blocksize,
+				  ext2fs_has_feature_fyp(fs->super) ?
+				  EXT2_BMPT_MAXLEVELS : 3, &block_buf);
+	if (retval)
+		goto errout;
+	inode_size = EXT2_INODE_SIZE(fs->super);
+	inode = malloc(inode_size);
+	if (!inode) {
+		retval = ENOMEM;
+		goto errout;
+	}
+	/* EA blocks may be shared, so only count each one once */
+	if (rfs->bmap) {
+		retval = ext2fs_allocate_block_bitmap(fs,
+					_("extended attribute blocks"),
+					&ea_map);
+		if (retval)
+			goto errout;
+	}
+
+	start_to_move = (rfs->new_fs->group_desc_count *
+			 rfs->new_fs->super->s_inodes_per_group);
+	pb.rfs = rfs;
+	pb.error = 0;
+	while (1) {
+		retval = ext2fs_get_next_inode_full(scan, &ino, inode,
+						    inode_size);
+		if (retval)
+			goto errout;
+		if (!ino)
+			break;
+		if (inode->i_links_count == 0 && ino != EXT2_RESIZE_INO)
+			continue;
+
+		plan->inodes_scanned++;
+		pb.is_dir = LINUX_S_ISDIR(inode->i_mode);
+		pb.changed = 0;
+		if (pb.is_dir)
+			dirs++;
+		ea_blk = ext2fs_file_acl_block(fs, inode);
+		if (rfs->bmap && ea_blk &&
+		    extent_translate(fs, rfs->bmap, ea_blk)) {
+			if (!ext2fs_test_block_bitmap2(ea_map, ea_blk)) {
+				ext2fs_mark_block_bitmap2(ea_map, ea_blk);
+				plan->ea_blocks++;
+			}
+			pb.changed = 1;
+		}
+
+		if (ext2fs_inode_has_valid_blocks2(fs, inode) &&
+		    (rfs->bmap || pb.is_dir)) {
+			pb.ino = pb.old_ino = ino;
+			fs->flags |= EXT2_FLAG_IGNORE_CSUM_ERRORS;
+			if (inode->i_flags & EXT2_FYP_BMPT_FL)
+				retval = ext2fs_bmpt_block_iterate(fs, ino, 0,
+						block_buf, plan_bmpt_block,
+						&pb);
+			else
+				retval = ext2fs_block_iterate3(fs, ino,
+						BLOCK_FLAG_READ_ONLY,
+						block_buf, plan_block, &pb);
+			fs->flags &= ~EXT2_FLAG_IGNORE_CSUM_ERRORS;
+			if (retval)
+				goto errout;
+		}
+
+		if (pb.changed)
+			plan->inodes_remapped++;
+		if (ino > start_to_move)
+			plan->inodes_moved++;
+		/* The inode itself is rewritten */
+		if (pb.changed || ino > start_to_move) {
+			plan->seeks++;
+			plan->bytes_written += fs->blocksize;
+		}
+	}
+
+	/* The inode tables are read front to back, a group at a time */
+	plan->seeks += fs->group_desc_count;
+	plan->bytes_read += (__u64) fs->group_desc_count *
+		fs->inode_blocks_per_group * fs->blocksize;
+
+	/* inode_ref_fix() has to look at every directory block */
+	if (plan->inodes_moved) {
+		plan->seeks += dirs;
+		plan->bytes_read += plan->dir_blocks * fs->blocksize;
+	} else
+		plan->dir_blocks = 0;
+
+errout:
+	reset_com_err_hook();
+	if (scan)
+		ext2fs_close_inode_scan(scan);
+	if (ea_map)
+		ext2fs_free_block_bitmap(ea_map);
+	if (block_buf)
+		ext2fs_free_mem(&block_buf);
+	free(inode);
+	return retval;
+}
+
 /*
  * This function is used when expanding a file system.  It frees the
  * superblock and block group descriptor blocks from the block group
@@ -2637,66 +3401,59 @@ errout:
  */
 static errcode_t ext2fs_calculate_summary_stats(ext2_filsys fs)
 {
-	blk64_t		blk;
-	ext2_ino_t	ino;
-	unsigned int	group = 0;
-	unsigned int	count = 0;
+	blk64_t		blk, first_blk, last_blk, used;
+	ext2_ino_t	first_ino, last_ino, used_inodes;
+	unsigned int	group;
 	blk64_t		total_blocks_free = 0;
 	int		total_inodes_free = 0;
-	int		group_free = 0;
-	int		uninit = 0;
+	blk64_t		group_free;
 	blk64_t		super_blk, old_desc_blk, new_desc_blk;
 	int		old_desc_blocks;
+	errcode_t	retval;
 
-	/*
-	 * First calculate the block statistics
-	 */
-	uninit = ext2fs_bg_flags_test(fs, group, EXT2_BG_BLOCK_UNINIT);
-	ext2fs_super_and_bgd_loc2(fs, group, &super_blk, &old_desc_blk,
-				  &new_desc_blk, 0);
 	if (ext2fs_has_feature_meta_bg(fs->super))
 		old_desc_blocks = fs->super->s_first_meta_bg;
 	else
 		old_desc_blocks = fs->desc_blocks +
 			fs->super->s_reserved_gdt_blocks;
-	for (blk = B2C(fs->super->s_first_data_block);
-	     blk < ext2fs_blocks_count(fs->super);
-	     blk += EXT2FS_CLUSTER_RATIO(fs)) {
-		if ((uninit &&
-		     !(EQ_CLSTR(blk, super_blk) ||
-		       ((old_desc_blk && old_desc_blocks &&
-			 GE_CLSTR(blk, old_desc_blk) &&
-			 LT_CLSTR(blk, old_desc_blk + old_desc_blocks))) ||
-		       ((new_desc_blk && EQ_CLSTR(blk, new_desc_blk))) ||
-		       EQ_CLSTR(blk, ext2fs_block_bitmap_loc(fs, group)) ||
-		       EQ_CLSTR(blk, ext2fs_inode_bitmap_loc(fs, group)) ||
-		       ((GE_CLSTR(blk, ext2fs_inode_table_loc(fs, group)) &&
-			 LT_CLSTR(blk, ext2fs_inode_table_loc(fs, group)
-				  + fs->inode_blocks_per_group))))) ||
-		    (!ext2fs_fast_test_block_bitmap2(fs->block_map, blk))) {
-			group_free++;
-			total_blocks_free++;
-		}
-		count++;
-		if ((count == fs->super->s_clusters_per_group) ||
-		    EQ_CLSTR(blk, ext2fs_blocks_count(fs->super)-1)) {
-			ext2fs_bg_free_blocks_count_set(fs, group, group_free);
-			ext2fs_group_desc_csum_set(fs, group);
-			group++;
-			if (group >= fs->group_desc_count)
-				break;
-			count = 0;
-			group_free = 0;
-			uninit = ext2fs_bg_flags_test(fs, group, EXT2_BG_BLOCK_UNINIT);
-			ext2fs_super_and_bgd_loc2(fs, group, &super_blk,
-						  &old_desc_blk,
-						  &new_desc_blk, 0);
-			if (ext2fs_has_feature_meta_bg(fs->super))
-				old_desc_blocks = fs->super->s_first_meta_bg;
-			else
-				old_desc_blocks = fs->desc_blocks +
-					fs->super->s_reserved_gdt_blocks;
+
+	/*
+	 * First calculate the block statistics.  Initialized groups are
+	 * counted straight from the bitmap; in uninitialized ones only
+	 * the group's metadata is in use.
+	 */
+	for (group = 0; group < fs->group_desc_count; group++) {
+		first_blk = ext2fs_group_first_block2(fs, group);
+		last_blk = ext2fs_group_last_block2(fs, group);
+		group_free = 0;
+		if (!ext2fs_bg_flags_test(fs, group, EXT2_BG_BLOCK_UNINIT)) {
+			retval = ext2fs_count_set_block_bitmap2(fs->block_map,
+						first_blk, last_blk, &used);
+			if (retval)
+				return retval;
+			group_free = B2C(last_blk) - B2C(first_blk) + 1 - used;
+			goto next_group;
+		}
+		ext2fs_super_and_bgd_loc2(fs, group, &super_blk, &old_desc_blk,
+					  &new_desc_blk, 0);
+		for (blk = first_blk; blk <= last_blk;
+		     blk += EXT2FS_CLUSTER_RATIO(fs)) {
+			if (!(EQ_CLSTR(blk, super_blk) ||
+			      ((old_desc_blk && old_desc_blocks &&
+				GE_CLSTR(blk, old_desc_blk) &&
+				LT_CLSTR(blk, old_desc_blk + old_desc_blocks))) ||
+			      ((new_desc_blk && EQ_CLSTR(blk, new_desc_blk))) ||
+			      EQ_CLSTR(blk, ext2fs_block_bitmap_loc(fs, group)) ||
+			      EQ_CLSTR(blk, ext2fs_inode_bitmap_loc(fs, group)) ||
+			      ((GE_CLSTR(blk, ext2fs_inode_table_loc(fs, group)) &&
+				LT_CLSTR(blk, ext2fs_inode_table_loc(fs, group)
+					 + fs->inode_blocks_per_group)))))
+				group_free++;
 		}
+	next_group:
+		ext2fs_bg_free_blocks_count_set(fs, group, group_free);
+		ext2fs_group_desc_csum_set(fs, group);
+		total_blocks_free += group_free;
 	}
 	total_blocks_free = C2B(total_blocks_free);
 	ext2fs_free_blocks_count_set(fs->super, total_blocks_free);
@@ -2704,30 +3461,22 @@ static errcode_t ext2fs_calculate_summary_stats(ext2_filsys fs)
 	/*
 	 * Next, calculate the inode statistics
 	 */
-	group_free = 0;
-	count = 0;
-	group = 0;
-
-	/* Protect loop from wrap-around if s_inodes_count maxed */
-	uninit = ext2fs_bg_flags_test(fs, group, EXT2_BG_INODE_UNINIT);
-	for (ino = 1; ino <= fs->super->s_inodes_count && ino > 0; ino++) {
-		if (uninit ||
-		    !ext2fs_fast_test_inode_bitmap2(fs->inode_map, ino)) {
-			group_free++;
-			total_inodes_free++;
-		}
-		count++;
-		if ((count == fs->super->s_inodes_per_group) ||
-		    (ino == fs->super->s_inodes_count)) {
-			ext2fs_bg_free_inodes_count_set(fs, group, group_free);
-			ext2fs_group_desc_csum_set(fs, group);
-			group++;
-			if (group >= fs->group_desc_count)
-				break;
-			count = 0;
-			group_free = 0;
-			uninit = ext2fs_bg_flags_test(fs, group, EXT2_BG_INODE_UNINIT);
+	for (group = 0; group < fs->group_desc_count; group++) {
+		first_ino = group * fs->super->s_inodes_per_group + 1;
+		last_ino = first_ino + fs->super->s_inodes_per_group - 1;
+		used_inodes = 0;
+		if (!ext2fs_bg_flags_test(fs, group, EXT2_BG_INODE_UNINIT)) {
+			retval = ext2fs_count_set_inode_bitmap2(fs->inode_map,
+						first_ino, last_ino,
+						&used_inodes);
+			if (retval)
+				return retval;
 		}
+		ext2fs_bg_free_inodes_count_set(fs, group,
+				fs->super->s_inodes_per_group - used_inodes);
+		ext2fs_group_desc_csum_set(fs, group);
+		total_inodes_free += fs->super->s_inodes_per_group -
+			used_inodes;
 	}
 	fs->super->s_free_inodes_count = total_inodes_free;
 	ext2fs_mark_super_dirty(fs);
@@ -2767,8 +3516,8 @@ static int calc_group_overhead(ext2_filsys fs, blk64_t grp,
 	blk64_t	super_blk, old_desc_blk, new_desc_blk;
 	int overhead;
 
-	/* inode table blocks plus allocation bitmaps */
-	overhead = fs->inode_blocks_per_group + 2;
+	/* inode table blocks (and duplicates) plus allocation bitmaps */
+	overhead = fs->inode_blocks_per_group * itable_copies(fs) + 2;
 
 	ext2fs_super_and_bgd_loc2(fs, grp, &super_blk,
 				  &old_desc_blk, &new_desc_blk, 0);
@@ -85,6 +85,8 @@ typedef struct ext2_sim_progress *ext2_sim_progmeter;
 #define RESIZE_ENABLE_64BIT		0x0400
 #define RESIZE_DISABLE_64BIT		0x0800
 
+#define RESIZE_DRY_RUN			0x1000
+
 /*
  * This structure is used for keeping track of how much resources have
  * been used for a particular resize2fs pass.
@@ -99,6 +101,27 @@ struct resource_track {
 	unsigned long long bytes_written;
 };
 
+/*
+ * What a dry run (resize2fs -n) found the resize would have to do
+ */
+struct resize_plan {
+	blk64_t		blocks_moved;	/* blocks relocated by block_mover */
+	blk64_t		block_runs;	/* ...as this many contiguous runs */
+	blk64_t		ea_blocks;	/* of which extended attribute blocks */
+	dgrp_t		itables_moved;	/* inode table copies relocated */
+	blk64_t		itable_blocks;	/* ...with this many blocks */
+	blk64_t		itable_init;	/* new inode table blocks to zero */
+	ext2_ino_t	inodes_scanned;	/* in-use inodes looked at */
+	ext2_ino_t	inodes_moved;	/* inodes renumbered */
+	ext2_ino_t	inodes_remapped; /* inodes whose blocks move */
+	blk64_t		dir_blocks;	/* directory blocks to search */
+	__u64		seeks;
+	__u64		bytes_read;
+	__u64		bytes_written;
+	double		read_rate;	/* measured, in bytes per second */
+	double		seek_time;	/* measured, in seconds */
+};
+
 /*
  * The core state structure for the ext2 resizer
  */
@@ -114,6 +137,7 @@ struct ext2_resize_struct {
 	blk64_t		needed_blocks;
 	int		flags;
 	char		*itable_buf;
+	struct resize_plan plan;
 
 	/*
 	 * For the block allocator
@@ -159,6 +183,8 @@ extern void ext2fs_free_extent_table(ext2_extent extent);
 extern errcode_t ext2fs_add_extent_entry(ext2_extent extent,
 					 __u64 old_loc, __u64 new_loc);
 extern __u64 ext2fs_extent_translate(ext2_extent extent, __u64 old_loc);
+extern __u64 ext2fs_extent_translate_range(ext2_extent extent, __u64 old_loc,
+					    __u64 len, __u64 *run);
 extern void ext2fs_extent_dump(ext2_extent extent, FILE *out);
 extern errcode_t ext2fs_iterate_extent(ext2_extent extent, __u64 *old_loc,
 				       __u64 *new_loc, __u64 *size);
@@ -170,6 +196,10 @@ extern char *program_name;
 extern errcode_t online_resize_fs(ext2_filsys fs, const char *mtpt,
 				  blk64_t *new_size, int flags);
 
+/* plan.c */
+extern void measure_resize_io(ext2_resize_t rfs);
+extern void print_resize_plan(ext2_resize_t rfs);
+
 /* resource_track.c */
 extern void init_resource_track(struct resource_track *track, const char *desc,
 				io_channel channel);
@@ -90,6 +90,10 @@ void do_test(FILE *in, FILE *out)
 			num2 = ext2fs_extent_translate(extent, num1);
 			fprintf(out, "# Answer: %llu%s\n", num2,
 				num2 ? "" : " (not found)");
+		} else if (!strcmp(cmd, "range")) {
+			num2 = ext2fs_extent_translate_range(extent, num1,
+							     num2, &size);
+			fprintf(out, "# Answer: %llu (%llu)\n", num2, size);
 		} else if (!strcmp(cmd, "dump")) {
 			ext2fs_extent_dump(extent, out);
 		} else if (!strcmp(cmd, "iter_test")) {